@@ -0,0 +1,63 @@
+# Copyright SUSE LLC
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Follows a file which is still being appended to (e.g. the serial log written by QEMU) via a
+# persistent file handle so only new data needs to be read. If Linux::Inotify2 is available a
+# handle becoming readable on modifications can be used to wait for new data within select.
+
+package OpenQA::FileTail;
+use Mojo::Base -base, -signatures;
+use Fcntl ':seek';
+
+use constant HAS_INOTIFY => eval { require Linux::Inotify2; 1 } // 0;
+use constant READ_CHUNK_SIZE => 1024 * 1024;
+
+has 'file';
+has position => 0;
+
+# reopens the file if it has been replaced and restarts from the beginning if it has been truncated
+sub _handle ($self) {
+    my @stat = stat $self->file;
+    return undef unless @stat;
+    my ($inode, $size) = @stat[1, 7];
+    if (!$self->{fh} || $self->{inode} != $inode) {
+        if ($self->{fh}) {
+            close $self->{fh};
+            $self->position(0);
+        }
+        open($self->{fh}, '<', $self->file) or return undef;
+        $self->{inode} = $inode;
+    }
+    $self->position(0) if $size < $self->position;
+    return $self->{fh};
+}
+
+# returns the data appended since the last call (or since the position has been set)
+sub read ($self) {
+    my $fh = $self->_handle or return '';
+    sysseek $fh, $self->position, SEEK_SET or return '';
+    my $data = '';
+    1 while sysread $fh, $data, READ_CHUNK_SIZE, length $data;
+    $self->position($self->position + length $data);
+    return $data;
+}
+
+# returns a handle becoming readable when the file is modified or undef if not supported
+sub watch_handle ($self) {
+    return undef unless HAS_INOTIFY;
+    return $self->{watch_handle} if $self->{watch_handle};
+    my $inotify = Linux::Inotify2->new or return undef;
+    $inotify->blocking(0);
+    $inotify->watch($self->file, Linux::Inotify2::IN_MODIFY()) or return undef;
+    # use a duplicate so the descriptor is only closed by the Linux::Inotify2 object
+    open(my $watch_handle, '<&', $inotify->fileno) or return undef;
+    $self->{inotify} = $inotify;
+    return $self->{watch_handle} = $watch_handle;
+}
+
+# consumes pending modification events so the watch handle only becomes readable again on new ones
+sub drain ($self) {
+    $self->{inotify}->read if $self->{inotify};
+}
+
+1;
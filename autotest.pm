@@ -16,7 +16,7 @@ use POSIX '_exit';
 use Carp qw();
 use cv;
 use signalblocker;
-use Scalar::Util 'blessed';
+use Scalar::Util qw(blessed looks_like_number);
 use List::Util 'any';
 use Mojo::IOLoop::ReadWriteProcess 'process';
 use Mojo::IOLoop::ReadWriteProcess::Session 'session';
@@ -435,6 +435,9 @@ sub run_all () {
         warn $e;
         $died = 1;    # test execution died
     }
+    # write pending screenshots before isotovideo is told the tests are done as _terminate skips destructors
+    try { tinycv::flush_writes() if defined &tinycv::flush_writes }
+    catch ($e) { bmwqemu::fctwarn("Unable to write screenshots: $e") }    # uncoverable statement
     try {
         bmwqemu::save_vars(no_secret => 1);
         bmwqemu::diag('Sending tests_done');
@@ -483,6 +486,8 @@ sub start_process () {
             bmwqemu::diag "GOT $line";
             # the backend process might have added some defaults for the backend
             bmwqemu::load_vars();
+            my $png_compression = $bmwqemu::vars{SCREENSHOT_PNG_COMPRESSION};
+            tinycv::set_png_compression($png_compression) if looks_like_number $png_compression;
 
             run_all;
         },
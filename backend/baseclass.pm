@@ -23,9 +23,8 @@ use myjsonrpc;
 use needle;
 use Net::SSH2 'LIBSSH2_ERROR_EAGAIN';
 use OpenQA::Benchmark::Stopwatch;
-use MIME::Base64 'encode_base64';
 use File::Which 'which';
-use List::Util 'min';
+use List::Util qw(first max min sum0);
 use List::MoreUtils 'uniq';
 use Scalar::Util 'looks_like_number';
 use Mojo::File 'path';
@@ -34,13 +33,19 @@ use OpenQA::Exceptions;
 use Time::Seconds;
 use English -no_match_vars;
 use OpenQA::NamedIOSelect;
+use OpenQA::FileTail;
 use Data::Dumper;
 
 use constant FULL_SCREEN_SEARCH_FREQUENCY => $ENV{OS_AUTOINST_FULL_SCREEN_SEARCH_FREQUENCY} // 5;
 use constant FULL_UPDATE_REQUEST_FREQUENCY => $ENV{OS_AUTOINST_FULL_UPDATE_REQUEST_FREQUENCY} // 5;
+use constant VIDEO_FRAME_TILE_SIZE => 32;
 use constant FFMPEG_BIN => $ENV{OS_AUTOINST_FFMPEG_BIN} // 'ffmpeg';
 use constant DEFAULT_FFMPEG_CMD => FFMPEG_BIN . ' -y -hide_banner -nostats -r 24 -f image2pipe -vcodec ppm -i - -pix_fmt yuv420p';
 use constant SSH_SERIAL_READ_BUFFER_SIZE => 4096;
+# seconds to wait for new serial output within wait_serial if modifications of the serial file
+# can be watched (only as fallback in case it is replaced) and if it needs to be polled
+use constant SERIAL_WATCH_INTERVAL => 1;
+use constant SERIAL_POLL_INTERVAL => 0.1;
 
 # should be a singleton - and only useful in backend process
 our $backend;    ## no critic (Variables::ProhibitPackageVars)
@@ -59,6 +64,7 @@ sub new ($class) {
     $self->{serialfile} = 'serial0';
     $self->{serial_offset} = 0;
     $self->{video_frame_data} = [];
+    $self->{video_frame_data_bytes} = 0;
     $self->{video_frame_number} = 0;
     $self->{video_encoders} = {};
     $self->{external_video_encoder_image_data} = [];
@@ -117,6 +123,7 @@ sub run ($self, $cmdpipe, $rsppipe) {
     $rsppipe = $io;
     $io->autoflush(1);
     $self->{rsppipe} = $io;
+    myjsonrpc::pair_channels($self->{cmdpipe}, $self->{rsppipe});
 
     bmwqemu::diag "$$: cmdpipe " . fileno($self->{cmdpipe}) . ', rsppipe ' . fileno $self->{rsppipe};
 
@@ -154,6 +161,7 @@ sub _write_buffered_data_to_file_handle ($self, $program_name, $array_of_buffers
     my $offset = $self->{_encoder_write_offset}{$fh} // 0;
     my $data_written = $fh->syswrite($data, $len - $offset, $offset);
     die "$program_name not accepting data: $!" unless defined $data_written;
+    $self->{video_frame_data_bytes} -= $data_written if $array_of_buffers == $self->{video_frame_data};
 
     $offset += $data_written;
     if ($offset == $len) {
@@ -172,6 +180,47 @@ sub _write_buffered_data_to_file_handle ($self, $program_name, $array_of_buffers
     }
 }
 
+sub _queue_video_frame_data ($self, @data) {
+    push @{$self->{video_frame_data}}, @data;
+    $self->{video_frame_data_bytes} += length for @data;
+}
+
+# merges the frames queued for the built-in video encoder if they exceed the configured memory limit;
+# all images but the newest one are replaced by repeats so the video keeps its timing
+sub _limit_video_frame_data ($self) {
+    my $queue = $self->{video_frame_data};
+    my $limit = ($bmwqemu::vars{VIDEO_ENCODER_QUEUE_LIMIT} // 100) * 1024 * 1024;
+    return 0 unless $limit && $self->{video_frame_data_bytes} > $limit;
+
+    # leave a partially written command and the image data of an already written "E" command alone
+    my $encoder_pipe = $self->{encoder_pipe};
+    my $offset = defined $encoder_pipe ? ($self->{_encoder_write_offset}{$encoder_pipe} // 0) : 0;
+    my $start = $offset ? 1 : 0;
+    ++$start while $start < @$queue && $queue->[$start] !~ m/^[EFR]/;
+
+    my @pending = splice @$queue, $start;
+    my $newest = first { $pending[$_] =~ m/^E / } reverse 0 .. $#pending;
+    my $merged = 0;
+    for (my $i = 0; $i < @pending; ++$i) {
+        if ($pending[$i] =~ m/^E / && $i != $newest) {
+            push @$queue, "R\n";
+            ++$i;    # skip the image data
+            ++$merged;
+        }
+        else {
+            # changed tiles are relative to the previous frame which might have been merged
+            $pending[$i] =~ s/ \d+:[0-9a-f]*\n\z/\n/ if $merged && $pending[$i] =~ m/^[EF] /;
+            push @$queue, $pending[$i];
+        }
+    }
+    $self->{video_frame_data_bytes} = sum0(map { length } @$queue) - $offset;
+
+    my $frame_ring = $self->{video_frame_ring};
+    my $lag = $frame_ring ? sprintf(' (%d frames behind)', $self->{video_frame_number} - $frame_ring->consumed) : '';
+    bmwqemu::fctwarn "Video encoder is not keeping up$lag, merged $merged queued frames to limit memory usage";
+    return $merged;
+}
+
 sub _check_for_screen_change ($self, $now) {
     return undef unless my $wait_screen_change = $self->{_wait_screen_change};
     my $similiarity_to_reference = $self->similiarity_to_reference(undef);
@@ -253,6 +302,14 @@ sub do_capture ($self, $buckets, $timeout = undef, $starttime = undef) {
     my $time_to_next = min($time_to_screenshot, $time_to_update_request, $time_to_timeout);
     my ($read_set, $write_set) = IO::Select->select($self->{select_read}->select(), $self->{select_write}->select(), undef, $time_to_next);
 
+    # stop the capture loop when the serial file has been written to, see wait_serial
+    my $serial_watch = $self->{serial_watch};
+    my $serial_written = $serial_watch && $read_set && grep { $_ == $serial_watch } @$read_set;
+    if ($serial_written) {
+        $self->serial_tail->drain;
+        $read_set = [grep { $_ != $serial_watch } @$read_set];
+    }
+
     # We need to check the video encoder and the serial socket
     my ($video_encoder, $external_video_encoder, $other) = (0, 0, 0);
     for my $fh (@$write_set) {
@@ -307,7 +364,7 @@ sub do_capture ($self, $buckets, $timeout = undef, $starttime = undef) {
     # handle interleaved commands (commands received while waiting for the reply to another command)
     $self->_handle_cmd($_->[0]) for splice @{$self->{interleaved_cmds}};
 
-    return 1;
+    return !$serial_written;
 }
 
 =head2 run_capture_loop($timeout)
@@ -384,10 +441,30 @@ sub _auto_detect_external_video_encoder ($self) {
     return DEFAULT_FFMPEG_CMD . ' -c:v libvpx-vp9 -crf 35 -b:v 1500k -cpu-used 1' if $ffmpeg_banner =~ qr/--enable-libvpx(\s|$)/;
 }
 
+sub _built_in_video_codecs () {
+    my $videoencoder = "$bmwqemu::topdir/videoencoder";
+    return () unless -x $videoencoder;
+    return split /\n/, qx{"$videoencoder" -L} // '';
+}
+
+sub _built_in_webm_codec ($self) {
+    my %codecs = map { $_ => 1 } _built_in_video_codecs;
+    return first { $codecs{$_} } qw(av1 vp9);
+}
+
 sub _start_external_video_encoder_if_configured ($self) {
+    delete $self->{built_in_webm_codec};
     return 0 if $bmwqemu::vars{NOVIDEO};
 
-    my $cmd = $bmwqemu::vars{EXTERNAL_VIDEO_ENCODER_CMD} // $self->_auto_detect_external_video_encoder or return 0;
+    my $cmd = $bmwqemu::vars{EXTERNAL_VIDEO_ENCODER_CMD};
+    unless (defined $cmd) {
+        # let the built-in video encoder produce the WebM video if possible so frames are not decoded twice
+        if (my $codec = $self->_built_in_webm_codec) {
+            bmwqemu::diag "Encoding $codec video via built-in video encoder";
+            return $self->{built_in_webm_codec} = $codec;
+        }
+        $cmd = $self->_auto_detect_external_video_encoder or return 0;
+    }
     my $output_file_name = $bmwqemu::vars{EXTERNAL_VIDEO_ENCODER_OUTPUT_FILE_EXTENSION} // 'webm';
     my $output_file_path = "video.$output_file_name";
     $cmd .= " '$output_file_path'" unless $cmd =~ s/%OUTPUT_FILE_NAME%/$output_file_path/;
@@ -397,6 +474,14 @@ sub _start_external_video_encoder_if_configured ($self) {
     return 1;
 }
 
+sub _create_video_frame_ring ($self) {
+    my $slots = $bmwqemu::vars{VIDEO_ENCODER_FRAME_RING_SLOTS} // 8;
+    return undef unless $slots;
+    my $frame_ring = tinycv::new_frame_ring($slots, $self->{xres}, $self->{yres});
+    bmwqemu::fctwarn 'Unable to create frame ring for the video encoder, passing QOI images instead' unless $frame_ring;
+    return $self->{video_frame_ring} = $frame_ring;
+}
+
 sub start_encoder ($self) {
     # start external video encoder if configured
     my $has_external_video_encoder_configured = $self->_start_external_video_encoder_if_configured;
@@ -406,7 +491,30 @@ sub start_encoder ($self) {
     my @cmd = (qw(nice -n 19), "$bmwqemu::topdir/videoencoder", "$cwd/video.ogv");
     push @cmd, '-n' if $bmwqemu::vars{NOVIDEO} || ($has_external_video_encoder_configured && !$bmwqemu::vars{EXTERNAL_VIDEO_ENCODER_ADDITIONALLY});
     push @cmd, '-x', $self->{xres}, '-y', $self->{yres};
+    push @cmd, '-p', $bmwqemu::vars{VIDEO_ENCODER_PIXEL_FORMAT} if $bmwqemu::vars{VIDEO_ENCODER_PIXEL_FORMAT};
+    push @cmd, '-o', "$self->{built_in_webm_codec}:$cwd/video.webm" if $self->{built_in_webm_codec};
+    push @cmd, '-r', $bmwqemu::vars{VIDEO_ENCODER_LIVE_LOG_RATE} if defined $bmwqemu::vars{VIDEO_ENCODER_LIVE_LOG_RATE};
+
+    # pass a duplicate of the frame ring's memfd to the encoder (Perl sets close-on-exec on it, so clear that flag)
+    my $frame_ring_fh;
+    if (my $frame_ring = $self->_create_video_frame_ring) {
+        open $frame_ring_fh, '<&', $frame_ring->fd;
+        fcntl $frame_ring_fh, Fcntl::F_SETFD, 0;
+        push @cmd, '-f', fileno $frame_ring_fh;
+    }
+
+    # let the encoder report statistics via a pipe, see _read_video_encoder_stats
+    my $stats_interval = $bmwqemu::vars{VIDEO_ENCODER_STATS_INTERVAL} // 60;
+    my $stats_writer;
+    if ($stats_interval) {
+        pipe $self->{video_encoder_stats_pipe}, $stats_writer;
+        $self->{video_encoder_stats_pipe}->blocking(0);
+        fcntl $stats_writer, Fcntl::F_SETFD, 0;
+        push @cmd, '-S', fileno $stats_writer, '-I', $stats_interval;
+    }
     $self->_invoke_video_encoder(encoder_pipe => 'built-in video encoder', @cmd);
+    close $frame_ring_fh if $frame_ring_fh;
+    close $stats_writer if $stats_writer;
 
     # open file for recording real time clock timestamps as subtitle
     open $self->{vtt_caption_file}, '>', "$cwd/video_time.vtt";
@@ -415,6 +523,40 @@ sub start_encoder ($self) {
     return;
 }
 
+# logs the statistics reported by the built-in video encoder and keeps the latest ones for DEBUG_IO output
+sub _read_video_encoder_stats ($self) {
+    return 0 unless my $pipe = $self->{video_encoder_stats_pipe};
+    my $buffer = \($self->{_video_encoder_stats_buffer} //= '');
+    {
+        no autodie 'sysread';
+        1 while sysread $pipe, $$buffer, 65536, length $$buffer;
+    }
+    my $count = 0;
+    while ($$buffer =~ s/^(.*)\n//) {
+        my $line = $1;
+        my $stats = Mojo::JSON::j($line);
+        unless (ref $stats eq 'HASH') {
+            bmwqemu::fctwarn "Unable to parse statistics of video encoder: $line";
+            next;
+        }
+        $self->{video_encoder_stats} = $stats;
+        bmwqemu::diag "Video encoder statistics: $line";
+        ++$count;
+    }
+    return $count;
+}
+
+# summarizes the statistics of the video encoder for DEBUG_IO output
+sub _format_video_encoder_stats ($stats) {
+    my $summary = "frames in/out/repeated: $stats->{frames_in}/$stats->{frames_out}/$stats->{repeats}, pending: $stats->{pipe_bytes} bytes";
+    $summary .= " and $stats->{ring_pending} ring slots" if defined $stats->{ring_pending};
+    for my $stage (qw(io decode convert encode)) {
+        next unless my $times = $stats->{$stage};
+        $summary .= sprintf ", $stage p50/p90/max: %.1f/%.1f/%.1f ms", @{$times}{qw(p50 p90 max)} if $times->{count};
+    }
+    return $summary;
+}
+
 sub _stop_video_encoder ($self) {
     my $video_encoders = delete $self->{video_encoders};
     return undef unless defined $video_encoders && keys %$video_encoders;
@@ -461,6 +603,8 @@ sub _stop_video_encoder ($self) {
         }
         last unless keys %$video_encoders;
     }
+    $self->_read_video_encoder_stats;
+    delete $self->{video_encoder_stats_pipe};
     return undef unless keys %$video_encoders;
     bmwqemu::diag "Unable to terminate $video_encoders->{$_}->{name}, sending SIGKILL" for keys %$video_encoders;
     kill KILL => (keys %$video_encoders);
@@ -576,19 +720,39 @@ sub enqueue_screenshot ($self, $image) {
 
     my $external_video_encoder_cmd_pipe = $self->{external_video_encoder_cmd_pipe};
     if ($self->{min_video_similarity} > 50) {    # we ignore smaller differences
-        push @{$self->{video_frame_data}}, "R\n";
+        $self->_queue_video_frame_data("R\n");
         push @{$self->{external_video_encoder_image_data}}, $self->{last_image_data}
           if defined $external_video_encoder_cmd_pipe && defined $self->{last_image_data};
     }
     else {
-        my $imgdata = $self->{last_image_data} = $image->ppm_data;
-        $watch->lap('convert ppm data');
-        push @{$self->{video_frame_data}}, 'E ' . length($imgdata) . "\n";
-        push @{$self->{video_frame_data}}, $imgdata;
+        # tell the built-in encoder which tiles changed since the previous frame so it only converts those
+        my $last_video_frame = $self->{last_video_frame};
+        my $tiles = $last_video_frame ? $last_video_frame->changed_tiles($image, VIDEO_FRAME_TILE_SIZE) : '';
+        my $changes = length $tiles ? ' ' . VIDEO_FRAME_TILE_SIZE . ":$tiles" : '';
+        $self->{last_video_frame} = $image;
+        $watch->lap('changed tiles');
+
+        # prefer passing the raw frame via the frame ring; fall back to QOI if the encoder has not released enough slots
+        my $frame_ring = $self->{video_frame_ring};
+        my $slot = $frame_ring ? $frame_ring->put($image) : -1;
+        if ($slot >= 0) {
+            $self->_queue_video_frame_data(join(' ', F => $slot, $image->xres, $image->yres, $frame_ring->stride) . "$changes\n");
+            $watch->lap('copy frame into ring');
+        }
+        if ($slot < 0) {
+            # the built-in encoder decodes QOI which is far smaller to queue than PPM
+            my $imgdata = $image->qoi_data;
+            $watch->lap('convert qoi data');
+            $self->_queue_video_frame_data('E ' . length($imgdata) . "$changes\n", $imgdata);
+        }
+        if (defined $external_video_encoder_cmd_pipe) {
+            push @{$self->{external_video_encoder_image_data}}, $self->{last_image_data} = $image->ppm_data;
+            $watch->lap('convert ppm data');
+        }
         $self->{min_video_similarity} = 10_000;
-        push @{$self->{external_video_encoder_image_data}}, $imgdata
-          if defined $external_video_encoder_cmd_pipe;
     }
+    $self->_limit_video_frame_data;
+    $self->_read_video_encoder_stats;
     my $encoder_pipe = $self->{encoder_pipe};
     $self->{select_read}->add($encoder_pipe, 'baseclass::encoder_pipe');
     $self->{select_write}->add($encoder_pipe, 'baseclass::encoder_pipe');
@@ -602,6 +766,8 @@ sub enqueue_screenshot ($self, $image) {
     if ($watch->as_data()->{total_time} > $self->screenshot_interval && !$bmwqemu::vars{NO_DEBUG_IO}) {
         bmwqemu::fctwarn sprintf 'enqueue_screenshot took %.2f seconds', $watch->as_data()->{total_time};
         bmwqemu::diag "DEBUG_IO: \n" . $watch->summary();
+        my $stats = $self->{video_encoder_stats};
+        bmwqemu::diag 'DEBUG_IO: video encoder ' . _format_video_encoder_stats($stats) if $stats;
     }
 
     return;
@@ -880,40 +1046,75 @@ sub read_serial ($self, $position, $whence = 0) {
     return ($data, $offset);
 }
 
+=head2 serial_tail
+
+Returns the L<OpenQA::FileTail> following the serial file, e.g. to wait for new
+serial output without reading it again from the start
+
+=cut
+
+sub serial_tail ($self) {
+    my $tail = $self->{serial_tail};
+    return $tail if $tail && $tail->file eq $self->{serialfile};
+    return $self->{serial_tail} = OpenQA::FileTail->new(file => $self->{serialfile});
+}
+
+# returns whether the pattern might match within the data read so far after the chunk has been appended
+sub _serial_search_needed ($search, $chunk) {
+    return 1 unless my $matcher = $search->{matcher};
+    # keep searching once the matcher found a possible match as zero-width assertions are only
+    # evaluated by Perl and might succeed when more data has been read
+    $search->{candidate} = 1 if $matcher->feed($chunk) >= 0;
+    return $search->{candidate};
+}
+
 sub wait_serial ($self, $args) {
     my $regexp = $args->{regexp};
     my $timeout = $args->{timeout};
     my $matched = 0;
-    my $str;
 
     if ($self->{current_console} && $self->{current_console}->is_serial_terminal) {
         return $self->{current_screen}->read_until($regexp, $timeout, %$args);
     }
 
     $regexp = [$regexp] if ref $regexp ne 'ARRAY';
+    my $no_regex = $args->{no_regex};
+    my @searches = map {
+        {pattern => $_, matcher => !$no_regex && defined &tinycv::new_stream_matcher ? tinycv::new_stream_matcher(["$_"]) : undef}
+    } @$regexp;
+    my $tail = $self->serial_tail;
+    $tail->position($self->{serial_offset});
+
+    # wake up from the capture loop as soon as the serial file is written to
+    my $watch = $self->{select_read} ? $tail->watch_handle : undef;
+    $self->{select_read}->add($self->{serial_watch} = $watch, 'baseclass::serial_watch') if $watch;
+    my $watch_guard = scope_guard sub {
+        $self->{select_read}->remove($watch) if $watch;
+        delete $self->{serial_watch};
+    };
+
     my $initial_time = time;
-    my $current_offset = $self->{serial_offset};
-    my $read_pos = $self->{serial_offset};
+    my $str = '';
     while (time < $initial_time + $timeout) {
-        (my $chunk, $read_pos) = $self->read_serial($read_pos);
-        $str = ($str // '') . $chunk;
-        for my $r (@$regexp) {
-            if (!$args->{no_regex} && $str =~ m/$r/) {
-                $current_offset += $LAST_MATCH_END[0];
+        my $chunk = $tail->read;
+        $str .= $chunk;
+        for my $search (@searches) {
+            my $r = $search->{pattern};
+            if (!$no_regex && _serial_search_needed($search, $chunk) && $str =~ m/$r/) {
                 $str = substr $str, 0, $LAST_MATCH_END[0];
                 $matched = 1;
                 last;
-            } elsif ($args->{no_regex} && (my $i = index $str, $r) >= 0) {
-                $current_offset += length($r) + $i;
+            } elsif ($no_regex && (my $i = index $str, $r, max(0, length($str) - length($chunk) - length($r) + 1)) >= 0) {
                 $str = substr $str, 0, $i + length $r;
                 $matched = 1;
                 last;
             }
         }
         last if ($matched);
-        $self->run_capture_loop(1);
+        my $remaining = $initial_time + $timeout - time;
+        $self->run_capture_loop(min($remaining, $watch ? SERIAL_WATCH_INTERVAL : SERIAL_POLL_INTERVAL)) if $remaining > 0;
     }
-    $self->{serial_offset} = $current_offset;
+    $self->{serial_offset} += length $str if $matched;
     return {matched => $matched, string => $str};
 }
 
@@ -961,9 +1162,9 @@ sub set_tags_to_assert ($self, $args) {
     my $mustmatch = $args->{mustmatch};
     my $timeout = $args->{timeout} // $bmwqemu::default_timeout;
 
-    # keep only the most recently used images (https://progress.opensuse.org/issues/15438)
-    needle::clean_image_cache();
     my ($needles, $tags) = find_needles_with_tags($mustmatch);
+    # decode the needles in the background so the first check does not need to wait for it
+    needle::prefetch_images($needles);
     {    # remove duplicates
         my %h = map { $_ => 1 } @$tags;
         @$tags = sort keys %h;
@@ -1007,7 +1208,7 @@ sub _failed_screens_to_json ($self) {
     $failed_screens = [$failed_screens->[-1]] if $self->assert_screen_check && @$failed_screens;
     my @json_fails = map {
         my ($img, $failed_candidates, $testtime, $similarity, $frame) = @$_;
-        {candidates => $failed_candidates, image => encode_base64($img->ppm_data), frame => $frame}
+        {candidates => $failed_candidates, image => myjsonrpc::attachment($img->qoi_data), frame => $frame}
     } @$failed_screens;
 
     # free memory
@@ -1047,7 +1248,7 @@ sub check_asserted_screen ($self, $args) {
     if ($foundneedle) {
         $self->_reset_asserted_screen_check_variables;
         return {
-            image => encode_base64($img->ppm_data),
+            image => myjsonrpc::attachment($img->qoi_data),
             found => $foundneedle,
             candidates => $failed_candidates,
             frame => $frame,
@@ -1087,7 +1288,7 @@ sub check_asserted_screen ($self, $args) {
         # store the final mismatch
         push @$failed_screens, [$img, $failed_candidates, 0, 1000, $frame];
         my $hash = $self->_failed_screens_to_json;
-        $hash->{image} = encode_base64($img->ppm_data);
+        $hash->{image} = myjsonrpc::attachment($img->qoi_data);
         # store stall status
         $hash->{stall} = $self->stall_detected;
 
@@ -1108,6 +1309,7 @@ sub check_asserted_screen ($self, $args) {
         # results of partial searching are rather confusing
 
         # as the images create memory pressure, we only save quite different images
+        # (QOI-encoded via tinycv::CompactImage so they are ready to be sent as well)
         # the last screen is handled automatically and the first screen is only interesting
         # if there are no others
         my $sim = 29;
@@ -1116,7 +1318,7 @@ sub check_asserted_screen ($self, $args) {
             $sim = $failed_screens->[-1]->[0]->similarity($img);
         }
         if ($sim < 30) {
-            push @$failed_screens, [$img, $failed_candidates, $n, $sim, $frame];
+            push @$failed_screens, [$img->compact, $failed_candidates, $n, $sim, $frame];
         }
         # clean up every once in a while to avoid excessive memory consumption.
         # The value here is an arbitrary limit.
@@ -1131,21 +1333,37 @@ sub check_asserted_screen ($self, $args) {
 sub _reduce_to_biggest_changes ($imglist, $limit) {
     return if @$imglist <= $limit;
 
-    my $first = shift @$imglist;
-    @$imglist = (sort { $b->[3] <=> $a->[3] } @$imglist)[0 .. (@$imglist > $limit ? $limit - 1 : $#$imglist)];
-    unshift @$imglist, $first;
+    my ($first, @others) = @$imglist;
+    my %keep = map { $_ => 1 } $first, (sort { $b->[3] <=> $a->[3] } @others)[0 .. $limit - 1];
 
-    # now sort for test time
-    @$imglist = sort { $b->[2] <=> $a->[2] } @$imglist;
-
-    # recalculate similarity
-    for (my $i = 1; $i < @$imglist; ++$i) {
-        $imglist->[$i]->[3] = $imglist->[$i - 1]->[0]->similarity($imglist->[$i]->[0]);
+    # estimate the similarity of each kept image to its new predecessor from the similarities of
+    # the dropped images in between so no images need to be decoded and compared again
+    my (@kept, @dropped);
+    for my $entry (@$imglist) {
+        if (!$keep{$entry}) {
+            push @dropped, $entry->[3];
+            next;
+        }
+        $entry->[3] = _combined_similarity(@dropped, $entry->[3]) if @dropped;
+        @dropped = ();
+        push @kept, $entry;
     }
 
+    # now sort for test time
+    @$imglist = sort { $b->[2] <=> $a->[2] } @kept;
     return;
 }
 
+# The similarity is the PSNR so the noise (distance) between two images is proportional to
+# 10 ** (-similarity / 20). The distance between the first and the last of a series of images is
+# at most the sum of the distances between the images in between (triangle inequality) so the
+# returned similarity is a lower bound.
+sub _combined_similarity (@similarities) {
+    my $noise = sum0 map { 10**(-$_ / 20) } @similarities;
+    return 1_000_000 unless $noise;    # all images are equal (see VERY_SIM in tinycv_impl.cc)
+    return max(0, -20 * log($noise) / log(10));
+}
+
 sub freeze_vm ($self, @) {
     bmwqemu::diag 'ignored freeze_vm';
     return;
@@ -1159,7 +1377,7 @@ sub cont_vm ($self, @) {
 sub last_screenshot_data ($self, $args) {
     return {} unless $self->last_image;
     return {
-        image => encode_base64($self->last_image->ppm_data),
+        image => myjsonrpc::attachment($self->last_image->qoi_data),
         frame => $self->{video_frame_number},
     };
 }
@@ -1167,15 +1385,35 @@ sub last_screenshot_data ($self, $args) {
 sub verify_image ($self, $args) {
     my $imgpath = $args->{imgpath};
     my $mustmatch = $args->{mustmatch};
+    my $wavfile = $args->{wavfile};
 
-    my $img = tinycv::read($imgpath);
+    # compute the spectrogram of recorded sound in memory; the image is only written for the results
+    my $img;
+    if ($wavfile) {
+        $img = tinycv::read_sound($wavfile, $args->{wisdom_dir}) or die "Unable to compute spectrogram of '$wavfile'\n";
+        $img->write($imgpath) or die "Unable to write '$imgpath'\n";
+    }
+    else {
+        $img = tinycv::read($imgpath);
+    }
     my $needles = needle::tags($mustmatch) || [];
 
-    my ($foundneedle, $failed_candidates) = $img->search($needles, 0, 1);
+    my ($foundneedle, $failed_candidates) = $wavfile ? $img->search_sound($needles) : $img->search($needles, 0, 1);
     return {found => $foundneedle, candidates => $failed_candidates} if $foundneedle;
     return {candidates => $failed_candidates};
 }
 
+# matches audio needles against the spectrogram of the audio capture recorded so far; the recording
+# is analysed incrementally so only the samples written since the last check are transformed
+sub check_audiocapture ($self, $args) {
+    my $file = $self->{audiocapture_file} or return {};
+    my $tail = ($self->{audiocapture_tail} //= tinycv::new_sound_tail($file)) or return {};
+    return {} unless $tail->update > 0;
+    my $found = $tail->spectrogram->search_sound(needle::tags($args->{mustmatch}) || []) or return {};
+    my $area = $found->{area}->[-1];
+    return {found => {needle => $found->{needle}->{name}, similarity => $area->{similarity}, seconds => $tail->seconds}};
+}
+
 sub retry_assert_screen ($self, $args) {
     $self->reload_needles if $args->{reload_needles};
     # reset timeout otherwise continue wait_forneedle might just fail if stopped too long than timeout
@@ -1270,6 +1508,20 @@ sub start_ssh_serial ($self, %args) {
     return ($ssh, $chan);
 }
 
+# appends the data to the serial file keeping it open as long as the serial connection exists
+sub _log_ssh_serial ($self, $data) {
+    print $data;
+    my $file = $self->{serialfile};
+    my $log = $self->{serial_log};
+    if (!$log || $self->{serial_log_file} ne $file) {
+        $log = $self->{serial_log} = path($file)->open('>>');
+        # flush every write so readers of the serial file (e.g. wait_serial) see the data immediately
+        $log->autoflush(1);
+        $self->{serial_log_file} = $file;
+    }
+    print $log $data;
+}
+
 sub check_ssh_serial ($self, $fh = undef, $write = undef) {
     my $ssh = $self->{serial};
     return 0 unless $ssh;
@@ -1282,13 +1534,12 @@ sub check_ssh_serial ($self, $fh = undef, $write = undef) {
     }
 
     # read from SSH channel (receiving extended data channel as well via `$chan->ext_data('merge')`)
+    # and pass everything which is available at once to the log
     my $chan = $self->{serial_chan};
-    my $buffer;
-    while (defined(my $bytes_read = $chan->read($buffer, SSH_SERIAL_READ_BUFFER_SIZE))) {
-        return 1 if $bytes_read <= 0;
-        print $buffer;
-        my $serial = path($self->{serialfile})->open('>>')->print($buffer);
-    }
+    my ($buffer, $bytes_read, $data) = (undef, undef, '');
+    $data .= $buffer while ($bytes_read = $chan->read($buffer, SSH_SERIAL_READ_BUFFER_SIZE)) && $bytes_read > 0;
+    $self->_log_ssh_serial($data) if length $data;
+    return 1 if defined $bytes_read;
 
     my ($error_code, $error_name, $error_string) = $ssh->error;
     return 1 if $error_code == LIBSSH2_ERROR_EAGAIN;
@@ -1378,6 +1629,7 @@ sub stop_ssh_serial ($self) {
     $self->{select_read}->remove($ssh->sock);
     $ssh->disconnect;
     $self->{serial_chan} = undef;
+    delete $self->{serial_log};
     return $self->{serial} = undef;
 }
 
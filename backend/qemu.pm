@@ -68,10 +68,14 @@ sub start_audiocapture ($self, $args) {
     # poo#66667: an audiodev id is required by wavcapture when audiodev is used
     my $audiodev_id = $self->requires_audiodev ? 'snd0' : '';
     $self->handle_qmp_command(_wrap_hmc("wavcapture $args->{filename} $audiodev_id 44100 16 1"));
+    $self->{audiocapture_file} = $args->{filename};
+    delete $self->{audiocapture_tail};
 }
 
 sub stop_audiocapture ($self, $args) {
     $self->handle_qmp_command(_wrap_hmc('stopcapture 0'));
+    delete $self->{audiocapture_file};
+    delete $self->{audiocapture_tail};
 }
 
 # parameters: acpi, reset, (on), off
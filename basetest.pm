@@ -12,7 +12,6 @@ use bmwqemu ();
 use ocr;
 use testapi ();
 use autotest ();
-use MIME::Base64 'decode_base64';
 use OpenQA::Exceptions;
 use Mojo::File 'path';
 
@@ -407,6 +406,11 @@ sub save_test_result ($self) {
     };
     $result->{extra_test_results} = $self->{extra_test_results} if $self->{extra_test_results};
 
+    # ensure screenshots referenced by the result are written before the result itself
+    # note: tinycv is only loaded within the test process (see autotest::start_process)
+    try { tinycv::flush_writes() if defined &tinycv::flush_writes }
+    catch ($e) { bmwqemu::fctwarn("Unable to write screenshots of $self->{name}: $e") }
+
     # be aware that $name has to be unique within one job (also assumed in several other places)
     my $fn = bmwqemu::result_dir() . sprintf '/result-%s.json', $self->{name};
     bmwqemu::save_json_file($result, $fn);
@@ -554,7 +558,7 @@ sub _result_add_screenshot ($self, $result) {
     my $img = $rsp->{image};
     return $result unless $img;
 
-    $img = tinycv::from_ppm(decode_base64($img));
+    $img = tinycv::from_ppm(myjsonrpc::attachment_data($img));
     return $result unless $img;
 
     my $file_name = $self->next_resultname('png', undef, 0);
@@ -604,8 +608,11 @@ sub stop_audiocapture ($self) {
     return $result;
 }
 
-sub verify_sound_image ($self, $imgpath, $mustmatch, $check) {
-    my $rsp = autotest::query_isotovideo('backend_verify_image', {imgpath => $imgpath, mustmatch => $mustmatch});
+sub verify_sound_image ($self, $imgpath, $mustmatch, $check, $wavfile = undef, $wisdom_dir = undef) {
+    my %args = (imgpath => $imgpath, mustmatch => $mustmatch);
+    # let the backend compute the spectrogram itself instead of reading it from $imgpath
+    @args{qw(wavfile wisdom_dir)} = ($wavfile, $wisdom_dir) if $wavfile;
+    my $rsp = autotest::query_isotovideo('backend_verify_image', \%args);
 
     my $img = tinycv::read($imgpath);
     if ($rsp->{found}) {
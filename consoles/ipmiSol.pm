@@ -6,9 +6,10 @@ package consoles::ipmiSol;
 use Mojo::Base 'consoles::console', -signatures;
 use autodie ':all';
 require IPC::System::Simple;
-use POSIX '_exit';
+use POSIX qw(_exit WNOHANG);
 use bmwqemu;
 use IO::Pipe;
+use IO::Select;
 
 sub activate ($self) {
     $self->{serial_pipe} = IO::Pipe->new();
@@ -36,44 +37,30 @@ sub activate ($self) {
     # our supermicro boards need workarounds to get SOL ;(
     push @cmd, qw(-W nochecksumcheck);
 
-    my $ipmi_console;
-    $self->{consolepid} = open $ipmi_console, '-|', @cmd;
-    $ipmi_console->blocking(0);
-
-    my $s = IO::Select->new();
-    $s->add($ipmi_console);
-    $s->add($self->{serial_pipe});
-
-    # Start serial grab
-    while (1) {
-        my @ready = $s->can_read;
-        for my $fh (@ready) {
-            if ($fh == $ipmi_console) {
-                my $line = <$ipmi_console>;
-                if (!$line) {
-                    # impi_console is dead, restart it
-                    $ipmi_console->close;
-                    $s->remove($ipmi_console);
-                    my $ret = waitpid $self->{consolepid}, 0;
-                    bmwqemu::diag "SOL failed, reconnecting [$ret]\n";
-                    sleep 1;
-                    $self->{consolepid} = open $ipmi_console, '-|', @cmd;
-                    $ipmi_console->blocking(0);
-                    $s->add($ipmi_console);
-                    next;
-                }
-                open my $serial, '>>', $self->{args}->{serialfile};
-                print $serial $line;
-                close $serial;
-            }
-            else {
-                kill TERM => $self->{consolepid};
-                $ipmi_console->close;
-                waitpid $self->{consolepid}, 0;
-                _exit(0);
-            }
+    # let ipmiconsole write into the serial file directly so its output does not need to be
+    # copied by this process
+    my $serialfile = $self->{args}->{serialfile};
+    my $start_console = sub () {
+        my $pid = fork;
+        return $pid if $pid;
+        {
+            no autodie;
+            open(STDOUT, '>>', $serialfile) and exec @cmd;
         }
+        _exit(1);
+    };
+    $self->{consolepid} = $start_console->();
+
+    # restart ipmiconsole whenever it exits until being told to stop
+    my $s = IO::Select->new($self->{serial_pipe});
+    until ($s->can_read(1)) {
+        next unless waitpid($self->{consolepid}, WNOHANG) > 0;
+        bmwqemu::diag "SOL failed, reconnecting [$?]\n";
+        sleep 1;
+        $self->{consolepid} = $start_console->();
     }
+    kill TERM => $self->{consolepid};
+    waitpid $self->{consolepid}, 0;
     _exit(0);
 }
 
@@ -121,6 +121,21 @@ sub normalise_pattern ($pattern, $no_regex) {
     return $no_regex && ref $pattern ne 'ARRAY' ? [$pattern] : $pattern;
 }
 
+=head2 stream_matcher
+
+  my $matcher = stream_matcher($normalised_pattern, $no_regex);
+
+Returns a tinycv streaming matcher for a pattern normalised via
+C<normalise_pattern> or undef if tinycv is not loaded or does not support the
+pattern.
+
+=cut
+
+sub stream_matcher ($pattern, $no_regex = 0) {
+    return undef unless defined &tinycv::new_stream_matcher;
+    return tinycv::new_stream_matcher($no_regex ? $pattern : ["$pattern"], $no_regex ? 1 : 0);
+}
+
 =head2 do_read
 
   my $num_read = do_read($buffer [, max_size => 2048][,timeout => undef]);
@@ -188,6 +203,12 @@ If the match fails the whole ring buffer is carried over to the next call.
 Setting C<$no_regex> will cause it to do a plain string search using
 C<index()>.
 
+If tinycv is loaded each chunk is also fed once into a streaming matcher (see
+C<tinycv::new_stream_matcher>) and the ring buffer is only searched when the
+matcher reports a possible match within the data still contained in it. That
+avoids scanning the whole ring buffer again after every small read. Patterns
+the matcher does not support are searched for on every read as before.
+
 Returns a map reference like
 C<{ matched => 1, string => 'text from the terminal' }>
 on success and
@@ -211,11 +232,24 @@ sub read_until ($self, $pattern, $timeout, %nargs) {
     $nargs{timeout} = $timeout;
     bmwqemu::log_call(%nargs);
 
+    # stream offsets of the data fed into the matcher so far and of the end of the last chunk
+    # which might contain a match
+    my $matcher = stream_matcher($re, $nargs{no_regex});
+    my ($fed, $candidate, $unfed) = (0, undef, $rbuf);
+
   READ: while (1) {
         $loops++;
 
-        # Search ring buffer for a match and exit if we find it
-        if ($nargs{no_regex}) {
+        if ($matcher && defined $unfed) {
+            $candidate = $fed + length $unfed if $matcher->feed($unfed) >= 0;
+            $fed += length $unfed;
+            $unfed = undef;
+        }
+
+        # Search ring buffer for a match and exit if we find it; pointless unless the matcher has
+        # seen something within the ring buffer which could match
+        my $search = !$matcher || (defined $candidate && $candidate >= $fed - length $rbuf);
+        if ($search && $nargs{no_regex}) {
             for my $p (@$re) {
                 my $i = index $rbuf, $p;
                 if ($i >= 0) {
@@ -226,7 +260,7 @@ sub read_until ($self, $pattern, $timeout, %nargs) {
                 }
             }
         }
-        elsif ($rbuf =~ m/$re/) {
+        elsif ($search && $rbuf =~ m/$re/) {
             # See match variable perf issues: http://bit.ly/2dbGrzo
             $prematch = substr $rbuf, 0, $LAST_MATCH_START[0];
             $match = substr $rbuf, $LAST_MATCH_START[0], $LAST_MATCH_END[0] - $LAST_MATCH_START[0];
@@ -252,6 +286,7 @@ sub read_until ($self, $pattern, $timeout, %nargs) {
             $rbuf = substr $rbuf, $remove_len;
         }
         $rbuf .= $buf;
+        $unfed = $buf;
     }
 
     my $elapsed = elapsed($sttime);
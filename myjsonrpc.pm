@@ -7,14 +7,20 @@ use Mojo::Base -strict, -signatures;
 use Carp qw(cluck confess);
 use IO::Select;
 use Errno;
+use MIME::Base64 'decode_base64';
+use Scalar::Util 'blessed';
 use Mojo::JSON;    # booleans
 use Cpanel::JSON::XS ();
 use bmwqemu ();
 
 use constant DEBUG_JSON => $ENV{PERL_MYJSONRPC_DEBUG} || 0;
 use constant READ_BUFFER => $ENV{PERL_MYJSONRPC_BYTES} || 8_000_000;
+use constant ATTACHMENT_HEADER => 8;    # size of the length prefix (unsigned 64-bit, big endian) of each attachment
 
 my $interleaved_command_handler;    # handler to deal with commands received while waiting for another reply
+my %ACCEPTS_ATTACHMENTS;    # whether the peer on the channel announced to read binary attachments
+my %PAIRED_CHANNELS;    # channel we write to => channel the same peer writes to (for pairs of pipes)
+our $attachments;    # attachments collected while encoding a message sent with binary side channel
 
 sub set_interleaved_command_handler ($handler_or_array) {
     $interleaved_command_handler = ref $handler_or_array eq 'ARRAY' ? sub (@args) { push @$handler_or_array, \@args } : $handler_or_array;
@@ -24,6 +30,62 @@ sub _syswrite ($to_fd, $json, $length = undef, $offset = undef) { syswrite $to_f
 
 sub is_debug () { DEBUG_JSON || $bmwqemu::vars{DEBUG_JSON_RPC} }
 
+=head2 attachment
+
+    my $value = myjsonrpc::attachment($img->ppm_data);
+
+Wraps binary data to be sent by C<send_json>. If the peer announced to support
+it the data is sent as-is in a length-prefixed frame following the JSON line
+and only referenced from the JSON. Otherwise it is embedded as base64 string.
+
+=cut
+
+sub attachment ($data) { bless \$data, 'myjsonrpc::Attachment' }
+
+=head2 attachment_data
+
+Returns the binary data of a value created via C<attachment> after it has been
+received, no matter whether it has been sent as attachment or as base64 string.
+
+=cut
+
+sub attachment_data ($value) { blessed $value && $value->isa('myjsonrpc::Attachment') ? $$value : decode_base64($value) }
+
+=head2 pair_channels
+
+Declares that replies to the messages read from C<$in_fd> are sent via
+C<$out_fd> so the support for attachments announced by the peer on the one
+applies to the other as well. Only needed if the peer is not connected via a
+single socket.
+
+=cut
+
+sub pair_channels ($in_fd, $out_fd) { $PAIRED_CHANNELS{_channel($out_fd) // return} = _channel($in_fd) }
+
+# identifies the socket or pipe behind the handle by its inode so a new peer which happens to get
+# the file descriptor of a closed one is not mistaken for it
+sub _channel ($handle) {
+    my ($dev, $ino) = stat $handle or return undef;
+    return "$dev:$ino";
+}
+
+sub peer_accepts_attachments ($to_fd) {
+    my $channel = _channel($to_fd) // return 0;
+    return $ACCEPTS_ATTACHMENTS{$PAIRED_CHANNELS{$channel} // $channel} // 0;
+}
+
+sub _write_all ($to_fd, $data, $json) {
+    my $written_bytes = 0;
+    my $bytes_to_write = length $data;
+    while ($written_bytes < $bytes_to_write) {
+        $written_bytes += _syswrite($to_fd, $data, $bytes_to_write - $written_bytes, $written_bytes) // 0;
+        if ($!) {
+            die 'myjsonrpc: remote end terminated connection, stopping' if !DEBUG_JSON && $! =~ qr/Broken pipe/;
+            confess sprintf "syswrite failed: err: '%s'; written_bytes: %d/%d; JSON: '%s'", $!, $written_bytes, $bytes_to_write, $json;
+        }
+    }
+}
+
 sub handle_read_error ($fd) {
     # throw an error except can_read has been interrupted
     my $error = $!;
@@ -44,20 +106,20 @@ sub send_json ($to_fd, $cmd) {
     my %cmdcopy = %$cmd;
     # The hash might already contain a json_cmd_token
     $cmdcopy{json_cmd_token} ||= bmwqemu::random_string(8);
+    # announce that we can read attachments within the replies to this message
+    $cmdcopy{json_accepts_attachments} = 1;
 
+    # collect attachments instead of encoding them as base64 if the peer can read them
+    local $attachments = defined $to_fd && peer_accepts_attachments($to_fd) ? [] : undef;
     my $json = $cjx->encode(\%cmdcopy);
     bmwqemu::diag(sprintf 'send_json(%d) JSON=%s', fileno($to_fd), $json =~ s/"([^"]{30})[^"]+"/"$1"/gr) if is_debug();
     $json .= "\n";
 
     confess 'myjsonrpc: called on undefined file descriptor' unless defined $to_fd;
-    my $written_bytes = 0;
-    my $bytes_to_write = length $json;
-    while ($written_bytes < $bytes_to_write) {
-        $written_bytes += _syswrite($to_fd, $json, $bytes_to_write - $written_bytes, $written_bytes) // 0;
-        if ($!) {
-            die 'myjsonrpc: remote end terminated connection, stopping' if !DEBUG_JSON && $! =~ qr/Broken pipe/;
-            confess sprintf "syswrite failed: err: '%s'; written_bytes: %d/%d; JSON: '%s'", $!, $written_bytes, $bytes_to_write, $json;
-        }
+    _write_all($to_fd, $json, $json);
+    for my $attachment (@{$attachments // []}) {
+        _write_all($to_fd, pack('Q>', length $$attachment), $json);
+        _write_all($to_fd, $$attachment, $json);
     }
     return $cmdcopy{json_cmd_token};
 }
@@ -79,6 +141,61 @@ sub _extract_result_for_cmd_token ($results, $cmd_token, $multi) {
     return undef;
 }
 
+# returns references to the places within the received message which refer to attachments, ordered by attachment index
+sub _attachment_slots ($data, $slots = []) {
+    my @slots = ref $data eq 'HASH' ? \(@$data{keys %$data}) : ref $data eq 'ARRAY' ? \(@$data) : ();
+    for my $slot (@slots) {
+        my $value = $$slot;
+        next unless ref $value;
+        if (ref $value eq 'HASH' && keys %$value == 1 && defined $value->{json_attachment}) {
+            $slots->[$value->{json_attachment}] = $slot;
+        }
+        else {
+            _attachment_slots($value, $slots);
+        }
+    }
+    return $slots;
+}
+
+# reads the specified number of bytes taking already buffered bytes first
+sub _read_exactly ($socket, $buffer, $length) {
+    my $data = substr $$buffer, 0, $length, '';
+    while (length $data < $length) {
+        my $read = sysread $socket, $data, $length - length $data, length $data;
+        next if $read || (!defined $read && $!{EINTR});
+        confess sprintf 'myjsonrpc: unable to read attachment from %d: %s', fileno $socket, defined $read ? 'unexpected end of file' : $!;
+    }
+    return $data;
+}
+
+# replaces the references to attachments within the message with the attachments following the JSON text
+sub _read_attachments ($socket, $cjx, $hash) {
+    my $slots = _attachment_slots($hash);
+    return 0 unless @$slots;
+    confess 'myjsonrpc: received incomplete attachment references' if grep { !defined } @$slots;
+
+    # take over the bytes the JSON parser has already buffered, skipping the newline terminating the JSON text
+    my $buffer = $cjx->incr_text;
+    $cjx->incr_text = '';
+    my $header;
+    do { $header = _read_exactly($socket, \$buffer, 1) } while $header eq "\n";
+    for my $slot (@$slots) {
+        $header .= _read_exactly($socket, \$buffer, ATTACHMENT_HEADER - length $header);
+        $$slot = attachment(_read_exactly($socket, \$buffer, unpack 'Q>', $header));
+        $header = '';
+    }
+    # hand back what belongs to subsequent messages
+    $cjx->incr_parse($buffer) if length $buffer;
+    return scalar @$slots;
+}
+
+# drops what is known about the peer on the handle once it is gone
+sub _forget_channel ($handle) {
+    my $channel = _channel($handle) // return;
+    delete $ACCEPTS_ATTACHMENTS{$channel};
+    delete @PAIRED_CHANNELS{grep { $PAIRED_CHANNELS{$_} eq $channel } keys %PAIRED_CHANNELS};
+}
+
 sub read_json ($socket, $cmd_token = undef, $multi = undef) {
     my $fd = fileno $socket;
     bmwqemu::diag("read_json($fd)") if is_debug();
@@ -100,6 +217,9 @@ sub read_json ($socket, $cmd_token = undef, $multi = undef) {
         my $hash = $cjx->incr_parse();
         if ($hash) {
             bmwqemu::diag(sprintf 'read_json(%d) json_cmd_token=%s', $fd, $hash->{json_cmd_token} // 'no-token') if is_debug();
+            my $accepts_attachments = delete $hash->{json_accepts_attachments};
+            if (defined(my $channel = _channel($socket))) { $ACCEPTS_ATTACHMENTS{$channel} = $accepts_attachments ? 1 : 0 }
+            _read_attachments($socket, $cjx, $hash);
             if ($hash->{QUIT}) {
                 bmwqemu::diag('received magic close');
                 push @$results, undef;
@@ -125,7 +245,11 @@ sub read_json ($socket, $cmd_token = undef, $multi = undef) {
         handle_read_error($fd) until (my @res = $s->can_read);
 
         my $qbuffer;
-        if (!sysread $socket, $qbuffer, READ_BUFFER) { bmwqemu::fctwarn("sysread failed: $!") if is_debug(); return $multi ? () : undef }
+        if (!sysread $socket, $qbuffer, READ_BUFFER) {
+            bmwqemu::fctwarn("sysread failed: $!") if is_debug();
+            _forget_channel($socket);
+            return $multi ? () : undef;
+        }
         $cjx->incr_parse($qbuffer);
     }
 
@@ -146,4 +270,13 @@ sub TO_JSON ($regex) {
     return $regex;
 }
 
+package myjsonrpc::Attachment;
+
+sub TO_JSON ($self) {
+    # refer to the attachment sent after the JSON text if the peer supports it, fall back to base64 otherwise
+    return MIME::Base64::encode_base64($$self) unless my $attachments = $myjsonrpc::attachments;
+    push @$attachments, $self;
+    return {json_attachment => $#$attachments};
+}
+
 1;
@@ -8,7 +8,9 @@ use Mojo::Base -strict, -signatures;
 use autodie ':all';
 
 use Cwd 'cwd';
+use Digest::MD5 'md5_hex';
 use File::Find;
+use File::Path 'make_path';
 use Mojo::File qw(path);
 use Mojo::JSON 'decode_json';
 use Cpanel::JSON::XS ();
@@ -17,6 +19,11 @@ use Feature::Compat::Try;
 require IPC::System::Simple;
 use OpenQA::Benchmark::Stopwatch;
 use OpenQA::Isotovideo::Utils 'checkout_git_refspec';
+use Storable qw(dclone nstore retrieve);
+use Time::HiRes ();
+
+# bump when the structure of needle objects changes to ignore indexes written by older versions
+use constant INDEX_VERSION => 1;
 
 our %needles;    ## no critic (Variables::ProhibitPackageVars)
 our %tags;    ## no critic (Variables::ProhibitPackageVars)
@@ -24,6 +31,10 @@ our $cleanuphandler;    ## no critic (Variables::ProhibitPackageVars)
 
 my $needles_dir;
 
+# parsed needles by JSON file as of the last initialization, see _load_indexed
+my %index;
+my $index_file;
+
 sub is_click_point_valid ($click_point) {
     return (ref $click_point eq 'HASH'
           && $click_point->{xpos}
@@ -142,7 +153,7 @@ sub register ($self) {
     }
 }
 
-sub _load_image ($self, $image_path) {
+sub _read_image ($self, $image_path) {
     # read PNG file measuring required time
     my $watch = OpenQA::Benchmark::Stopwatch->new();
     $watch->start();
@@ -158,66 +169,44 @@ sub _load_image ($self, $image_path) {
         next unless $area->{type} eq 'exclude';
         $image->replacerect($area->{xpos}, $area->{ypos}, $area->{width}, $area->{height});
     }
-
-    return {
-        image => $image,
-        image_path => $image_path,
-    };
+    return $image;
 }
 
-my %image_cache;
-my $image_cache_tick = 0;
-
-sub _load_image_with_caching ($self) {
-    # insert newly loaded image to cache or recycle previously cached image
-    my $image_path = $self->{png};
-    my $image_cache_item = $image_cache{$image_path};
-    if (!$image_cache_item) {
-        my $new_image_cache_item = $self->_load_image($image_path);
-        return undef unless $new_image_cache_item;
-
-        $image_cache_item = $image_cache{$image_path} = $new_image_cache_item;
+# returns the directory of the needle store shared between processes or an empty string if disabled
+sub store_dir () {
+    my $dir = $bmwqemu::vars{NEEDLE_STORE_DIR} // '';
+    return '' unless length $dir;
+    try {
+        make_path($dir);
+        $dir = path($dir)->to_abs->to_string;
+    }
+    catch ($e) {
+        bmwqemu::diag("Unable to create needle store $dir: $e");
+        $dir = '';
     }
+    return $dir;
+}
 
-    $image_cache_item->{last_use} = ++$image_cache_tick;
+sub _rects ($self, $type) { [map { @{$_}{qw(xpos ypos width height)} } grep { $_->{type} eq $type } @{$self->{area}}] }
 
-    return $image_cache_item->{image};
-}
+# drops the tiles of all but the specified number of most recently used needles from the cache
+sub clean_image_cache ($limit = 0) { tinycv::trim_needle_cache($limit) }
 
-sub clean_image_cache ($limit = 30) {
-    # compute the number of images to delete
-    my @cache_items = values %image_cache;
-    my $cache_size = scalar @cache_items;
-    my $to_delete = $cache_size - $limit;
-    return if $to_delete <= 0 || $to_delete > $cache_size;
-
-    # sort the cache items by their last use (ascending)
-    my @sorted_cache_items = sort { $a->{last_use} <=> $b->{last_use} } @cache_items;
-
-    # determine the minimum last use to lower the cache tick (so it won't overflow)
-    my $min_last_use = $to_delete == $cache_size ? $image_cache_tick : $sorted_cache_items[$to_delete]->{last_use};
-    $image_cache_tick -= $min_last_use;
-
-    my $index = -1;
-    for my $image_cache_item (@sorted_cache_items) {
-        if (++$index < $to_delete) {
-            # delete cache items up to the number of items to delete
-            delete $image_cache{$image_cache_item->{image_path}};
-        }
-        else {
-            # adapt last_use of items to keep to new $image_cache_tick
-            $image_cache_item->{last_use} -= $min_last_use;
-        }
+sub image_cache_size () { (tinycv::needle_cache_usage())[0] }
+
+# loads the tiles of the match areas of the needles into the cache in the background
+sub prefetch_images ($needles) {
+    for my $needle (@$needles) {
+        my $areas = $needle->_rects('match');
+        tinycv::prefetch_needle($needle->{png}, $areas, $needle->_rects('exclude')) if @$areas;
     }
 }
 
-sub image_cache_size () { scalar keys %image_cache }
-
+# returns the whole image (not cached) or the cached tile containing the specified area which can
+# be searched in place of the whole image
 sub get_image ($self, $area = undef) {
-    my $image = $self->_load_image_with_caching;
-    return undef unless $image;
-    return $image unless $area;
-    return $area->{img} //= $image->copyrect($area->{xpos}, $area->{ypos}, $area->{width}, $area->{height});
+    return $self->_read_image($self->{png}) unless $area;
+    return tinycv::needle_tile($self->{png}, $self->_rects('match'), $self->_rects('exclude'), @{$area}{qw(xpos ypos width height)});
 }
 
 sub has_tag ($self, $tag) {
@@ -250,10 +239,82 @@ sub TO_JSON ($self) {
     return \%hash;
 }
 
-sub wanted_ () {
-    return unless (m/.json$/);
-    my $needle = needle->new($File::Find::name);
-    $needles{$needle->{name}} = $needle if $needle;
+# identifies the version of a file, changes whenever it is modified or replaced
+sub _file_version ($file) {
+    my @stat = Time::HiRes::stat($file);
+    return @stat ? join(':', @stat[1, 7, 9]) : '';
+}
+
+# returns the needle for the JSON file from the index if neither the JSON file nor the PNG have
+# changed since it has been indexed; otherwise parses the JSON file and indexes the needle
+sub _load_indexed ($jsonfile, $new_index) {
+    my $json_version = _file_version($jsonfile);
+    my $entry = $index{$jsonfile};
+    if ($entry && $entry->{json} eq $json_version && $entry->{png} eq _file_version($entry->{needle}->{png})) {
+        $new_index->{$jsonfile} = $entry;
+        my $needle = bless dclone($entry->{needle}), 'needle';
+        $needle->register;
+        return $needle;
+    }
+    my $needle = needle->new($jsonfile) or return undef;
+    # copy the needle before anything adds data which can not be stored
+    $new_index->{$jsonfile} = {json => $json_version, png => _file_version($needle->{png}), needle => dclone({%$needle})};
+    return $needle;
+}
+
+sub index_dir () {
+    my $dir = $bmwqemu::vars{NEEDLE_INDEX_DIR};
+    unless (defined $dir) {
+        my $cache_home = $ENV{XDG_CACHE_HOME} || ($ENV{HOME} ? "$ENV{HOME}/.cache" : undef);
+        return undef unless $cache_home;
+        $dir = "$cache_home/os-autoinst";
+    }
+    return length $dir ? $dir : undef;
+}
+
+sub _read_index ($file) {
+    return {} unless $file && -f $file;
+    my $stored;
+    try { $stored = retrieve($file) }
+    catch ($e) { bmwqemu::diag("Ignoring unreadable needle index $file: $e") }
+    return {} unless ref $stored eq 'HASH' && ($stored->{version} // 0) == INDEX_VERSION;
+    return $stored->{needles};
+}
+
+sub _write_index ($file) {
+    return unless $file;
+    my $temporary_file = "$file.$$";
+    try {
+        make_path(dirname($file));
+        nstore({version => INDEX_VERSION, needles => \%index}, $temporary_file);
+        rename $temporary_file, $file;
+    }
+    catch ($e) {
+        unlink $temporary_file if -e $temporary_file;
+        bmwqemu::diag("Unable to write needle index $file: $e");
+    }
+}
+
+sub _load_needles () {
+    my $file = index_dir;
+    $file &&= "$file/needles-" . md5_hex(path($needles_dir)->to_abs) . '.index';
+    # keep the index in memory while the needle directory stays the same (e.g. on reloads)
+    if (($file // '') ne ($index_file // '')) {
+        %index = %{_read_index($file)};
+        $index_file = $file;
+    }
+
+    my %new_index;
+    my $wanted = sub {
+        return unless (m/.json$/);
+        my $needle = _load_indexed($File::Find::name, \%new_index);
+        $needles{$needle->{name}} = $needle if $needle;
+    };
+    find({no_chdir => 1, wanted => $wanted, follow => 1}, $needles_dir);
+
+    my $changed = keys %new_index != keys %index || grep { ($index{$_} // 0) != $new_index{$_} } keys %new_index;
+    %index = %new_index;
+    _write_index($file) if $changed;
 }
 
 sub default_needles_dir () { "$bmwqemu::vars{PRODUCTDIR}/needles" }
@@ -269,8 +330,14 @@ sub init ($init_needles_dir = $bmwqemu::vars{NEEDLES_DIR} // default_needles_dir
 
     %needles = ();
     %tags = ();
+    # drop tiles of needle images which might have been changed and apply the configured budget
+    if (defined &tinycv::trim_needle_cache) {
+        clean_image_cache();
+        tinycv::set_needle_cache_budget($bmwqemu::vars{NEEDLE_CACHE_SIZE} * 1024 * 1024) if $bmwqemu::vars{NEEDLE_CACHE_SIZE};
+        tinycv::set_needle_store_dir(store_dir);
+    }
     bmwqemu::diag("init needles from $needles_dir");
-    find({no_chdir => 1, wanted => \&wanted_, follow => 1}, $needles_dir);
+    _load_needles;
     bmwqemu::diag(sprintf 'loaded %d needles', scalar keys %needles);
 
     $cleanuphandler->() if $cleanuphandler;
@@ -0,0 +1,57 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Layout of the memfd-backed ring of raw BGR frames shared between the backend (tinycv) and
+// the video encoder.
+//
+// The backend copies a frame into the next free slot and sends "F <slot> <width> <height> <stride>"
+// over the command pipe. The video encoder references the slot until the next frame arrives and
+// then gives it back by incrementing `released`. Slots are therefore always released in the order
+// they were produced and the producer considers the ring full if `produced - released` reaches
+// the number of slots.
+//
+// Independently of the ring, the video encoder counts every processed frame command (including
+// PPM images and repeats) in `consumed` so the backend can tell how far the encoder lags behind.
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace frame_ring {
+
+constexpr uint32_t magic = 0x5246414f; // "OAFR"
+constexpr uint32_t version = 2;
+constexpr size_t header_size = 4096; // keep slots page-aligned
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint64_t slot_size;
+    std::atomic<uint64_t> produced;
+    std::atomic<uint64_t> released;
+    std::atomic<uint64_t> consumed;
+};
+
+static_assert(sizeof(Header) <= header_size, "frame ring header must fit into the reserved space");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "frame ring counters must be usable across processes");
+
+inline size_t mapping_size(uint32_t slot_count, uint64_t slot_size)
+{
+    return header_size + slot_count * slot_size;
+}
+
+inline unsigned char* slot_data(Header* header, uint32_t slot)
+{
+    return reinterpret_cast<unsigned char*>(header) + header_size + slot * header->slot_size;
+}
+
+}
+
+#endif // FRAME_RING_H
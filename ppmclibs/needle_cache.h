@@ -0,0 +1,58 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Tiles of needle images as kept by the needle cache (see tinycv_needle_cache.cc).
+//
+// A tile contains a searched area of the needle plus a border of one pixel (as far as available)
+// so blurring the area within the tile gives the same result as blurring it within the whole
+// needle. It remembers where it has been cut out so it can be searched in place of the whole
+// needle.
+
+#ifndef NEEDLE_CACHE_H
+#define NEEDLE_CACHE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace needle_cache {
+
+// enough for the tiles of thousands of typical needles and still for about 30 needles covering
+// whole 1080p screens
+constexpr size_t default_budget = 256 * 1024 * 1024;
+
+struct Tile {
+    cv::Rect area;
+    cv::Mat pixels;
+    // grayscale and blurred pixels of the whole tile like Image::prep computes them
+    cv::Mat preped;
+    cv::Point origin;
+    cv::Size full_size;
+    // keeps the pixels alive if they refer to a file of the shared store
+    std::shared_ptr<void> mapping;
+};
+
+// returns the rect of the tile for the area within the available rect (of the whole image)
+inline cv::Rect tile_rect(const cv::Rect& area, const cv::Rect& available)
+{
+    return cv::Rect(area.x - 1, area.y - 1, area.width + 2, area.height + 2) & available;
+}
+
+// looks up the tile of the area of the needle image (rects as x, y, width and height each),
+// loading the image and all the areas unless already cached; returns false on errors
+bool tile(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes, const cv::Rect& area, Tile& tile);
+
+// shared store of tiles on disk, see tinycv_needle_store.cc; disabled by an empty directory
+void set_store_dir(const std::string& dir);
+// returns the name of the tiles of the encoded needle image within the store or an empty string
+// if the store is disabled
+std::string store_name(const std::vector<unsigned char>& encoded, const std::vector<cv::Rect>& areas, const std::vector<cv::Rect>& excludes);
+bool store_lookup(const std::string& name, std::vector<Tile>& tiles);
+void store_publish(const std::string& name, const std::vector<Tile>& tiles);
+
+}
+
+#endif // NEEDLE_CACHE_H
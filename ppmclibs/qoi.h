@@ -0,0 +1,201 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Lossless "Quite OK Image" codec (https://qoiformat.org/qoi-specification.pdf) for 8-bit BGR
+// pixels as used by tinycv.
+//
+// Screenshots consist mostly of runs of equal pixels and of colours seen shortly before which QOI
+// encodes in one byte each, so they typically shrink by an order of magnitude compared to PPM
+// while encoding and decoding only take a single pass without any entropy coding. The output is
+// a standard QOI image with 3 channels so it can be viewed with common tools.
+
+#ifndef QOI_H
+#define QOI_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace qoi {
+
+constexpr size_t header_size = 14;
+constexpr unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+constexpr uint64_t max_pixels = 400000000; // limit of the reference implementation
+
+enum Op : unsigned char {
+    op_index = 0x00,
+    op_diff = 0x40,
+    op_luma = 0x80,
+    op_run = 0xc0,
+    op_rgb = 0xfe,
+    op_rgba = 0xff,
+    op_mask = 0xc0,
+};
+
+struct Pixel {
+    unsigned char r = 0, g = 0, b = 0, a = 255;
+
+    bool operator==(const Pixel& other) const { return r == other.r && g == other.g && b == other.b && a == other.a; }
+    unsigned int hash() const { return (r * 3u + g * 5u + b * 7u + a * 11u) % 64u; }
+};
+
+inline bool is_qoi(const unsigned char* data, size_t len)
+{
+    return len >= header_size + sizeof(end_marker) && !memcmp(data, "qoif", 4);
+}
+
+inline void put_u32(unsigned char* data, uint32_t value)
+{
+    data[0] = static_cast<unsigned char>(value >> 24);
+    data[1] = static_cast<unsigned char>(value >> 16);
+    data[2] = static_cast<unsigned char>(value >> 8);
+    data[3] = static_cast<unsigned char>(value);
+}
+
+inline uint32_t get_u32(const unsigned char* data)
+{
+    return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | uint32_t(data[3]);
+}
+
+/*
+ * encodes the BGR pixels (rows of `stride` bytes) and appends the QOI image to `out`
+ */
+inline void encode_bgr(const unsigned char* pixels, uint32_t width, uint32_t height, size_t stride, std::vector<unsigned char>& out)
+{
+    // allocate for the worst case (every pixel as op_rgb) and shrink to the actual size at the end
+    const auto start = out.size();
+    out.resize(start + header_size + static_cast<size_t>(width) * height * 4 + sizeof(end_marker));
+    unsigned char* dst = out.data() + start;
+    memcpy(dst, "qoif", 4);
+    put_u32(dst + 4, width);
+    put_u32(dst + 8, height);
+    dst[12] = 3; // channels
+    dst[13] = 0; // sRGB with linear alpha
+    dst += header_size;
+
+    Pixel index[64] = {};
+    Pixel previous;
+    unsigned int run = 0;
+    for (uint32_t y = 0; y < height; ++y) {
+        const unsigned char* src = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x, src += 3) {
+            Pixel pixel;
+            pixel.b = src[0];
+            pixel.g = src[1];
+            pixel.r = src[2];
+            if (pixel == previous) {
+                if (++run == 62) {
+                    *dst++ = static_cast<unsigned char>(op_run | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *dst++ = static_cast<unsigned char>(op_run | (run - 1));
+                run = 0;
+            }
+            const auto hash = pixel.hash();
+            if (index[hash] == pixel) {
+                *dst++ = static_cast<unsigned char>(op_index | hash);
+            } else {
+                index[hash] = pixel;
+                const auto vr = static_cast<signed char>(pixel.r - previous.r);
+                const auto vg = static_cast<signed char>(pixel.g - previous.g);
+                const auto vb = static_cast<signed char>(pixel.b - previous.b);
+                const auto vg_r = vr - vg, vg_b = vb - vg;
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    *dst++ = static_cast<unsigned char>(op_diff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    *dst++ = static_cast<unsigned char>(op_luma | (vg + 32));
+                    *dst++ = static_cast<unsigned char>((vg_r + 8) << 4 | (vg_b + 8));
+                } else {
+                    *dst++ = op_rgb;
+                    *dst++ = pixel.r;
+                    *dst++ = pixel.g;
+                    *dst++ = pixel.b;
+                }
+            }
+            previous = pixel;
+        }
+    }
+    if (run)
+        *dst++ = static_cast<unsigned char>(op_run | (run - 1));
+    memcpy(dst, end_marker, sizeof(end_marker));
+    dst += sizeof(end_marker);
+    out.resize(static_cast<size_t>(dst - out.data()));
+}
+
+/*
+ * reads the dimensions from the header; returns false if the data is no QOI image tinycv can decode
+ */
+inline bool read_header(const unsigned char* data, size_t len, uint32_t& width, uint32_t& height)
+{
+    if (!is_qoi(data, len))
+        return false;
+    width = get_u32(data + 4);
+    height = get_u32(data + 8);
+    const auto channels = data[12];
+    return width && height && static_cast<uint64_t>(width) * height <= max_pixels && (channels == 3 || channels == 4);
+}
+
+/*
+ * decodes the QOI image into BGR pixels (rows of `stride` bytes) dropping the alpha channel; the
+ * dimensions must have been obtained via read_header and pixels missing in truncated data repeat
+ * the last decoded one like the reference implementation does
+ */
+inline void decode_bgr(const unsigned char* data, size_t len, unsigned char* pixels, size_t stride)
+{
+    const auto width = get_u32(data + 4);
+    const auto height = get_u32(data + 8);
+    // chunks never exceed 5 bytes so reading from within the end marker stays in bounds
+    const unsigned char* src = data + header_size;
+    const unsigned char* const chunks_end = data + len - sizeof(end_marker);
+    Pixel index[64] = {};
+    Pixel pixel;
+    unsigned int run = 0;
+    for (uint32_t y = 0; y < height; ++y) {
+        unsigned char* dst = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x, dst += 3) {
+            if (run) {
+                --run;
+            } else if (src < chunks_end) {
+                const auto op = *src++;
+                if (op == op_rgb) {
+                    pixel.r = src[0];
+                    pixel.g = src[1];
+                    pixel.b = src[2];
+                    src += 3;
+                } else if (op == op_rgba) {
+                    pixel.r = src[0];
+                    pixel.g = src[1];
+                    pixel.b = src[2];
+                    pixel.a = src[3];
+                    src += 4;
+                } else if ((op & op_mask) == op_index) {
+                    pixel = index[op];
+                } else if ((op & op_mask) == op_diff) {
+                    pixel.r = static_cast<unsigned char>(pixel.r + ((op >> 4) & 3) - 2);
+                    pixel.g = static_cast<unsigned char>(pixel.g + ((op >> 2) & 3) - 2);
+                    pixel.b = static_cast<unsigned char>(pixel.b + (op & 3) - 2);
+                } else if ((op & op_mask) == op_luma) {
+                    const auto rb = *src++;
+                    const auto vg = (op & 0x3f) - 32;
+                    pixel.r = static_cast<unsigned char>(pixel.r + vg - 8 + ((rb >> 4) & 0x0f));
+                    pixel.g = static_cast<unsigned char>(pixel.g + vg);
+                    pixel.b = static_cast<unsigned char>(pixel.b + vg - 8 + (rb & 0x0f));
+                } else {
+                    run = op & 0x3f;
+                }
+                index[pixel.hash()] = pixel;
+            }
+            dst[0] = pixel.b;
+            dst[1] = pixel.g;
+            dst[2] = pixel.r;
+        }
+    }
+}
+
+}
+
+#endif // QOI_H
@@ -0,0 +1,663 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Spectrogram of the voice band of a sound recording as rendered by snd2png and compared
+// against audio needles by tinycv.
+//
+// The recording is downmixed to mono and split into windows of 10 ms. The magnitudes of the
+// frequencies up to 3200 Hz of each window become one column of a 1024x768 grayscale image
+// (dark means loud) starting with the first window which is not silent.
+//
+// The idea is from http://snd2fftw.sourceforge.net/, but the code doesn't have more similarity
+// to its grandfather than to a random fftw example.
+
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <fcntl.h>
+#include <fftw3.h>
+#include <math.h>
+#include <memory.h>
+#include <sndfile.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace spectrogram {
+
+inline double imabs(const fftw_complex cpx)
+{
+    return sqrt((cpx[0] * cpx[0]) + (cpx[1] * cpx[1]));
+}
+
+// boring linear interpolation
+inline double valueForFreq(const double* points, int bin, double ratio)
+{
+    if (bin == 0)
+        return points[0];
+
+    double next_value = points[bin];
+    double prev_value = points[bin - 1];
+
+    double value = ratio * prev_value + (1.0 - ratio) * next_value;
+    return value;
+}
+
+inline double max_row_value(const double* points, int count)
+{
+    double max_value = 0;
+    for (sf_count_t i = 0; i < count; i++) {
+        double value = points[i];
+        if (value > max_value)
+            max_value = value;
+    }
+    return max_value;
+}
+
+/*
+ * reads the recording downmixed to mono in chunks of one window; the samples of consecutive
+ * blocks of overlapping windows are provided contiguously so the DFT can read them in place
+ */
+class SampleStream {
+public:
+    SampleStream(SNDFILE* file, int channels, sf_count_t window_size, sf_count_t dft_size, int block_windows)
+        : file(file)
+        , channels(channels)
+        , window_size(window_size)
+        , overlap(dft_size - window_size)
+        , size((block_windows - 1) * window_size + dft_size)
+        , chunk(window_size * channels)
+        , samples(fftw_alloc_real(size))
+    {
+    }
+    ~SampleStream() { fftw_free(samples); }
+    SampleStream(const SampleStream&) = delete;
+    SampleStream& operator=(const SampleStream&) = delete;
+
+    bool allocated() const { return samples != nullptr; }
+
+    // starts reading from the beginning of the recording again
+    bool rewind()
+    {
+        started = false;
+        return sf_seek(file, 0, SEEK_SET) == 0;
+    }
+
+    // returns the samples of the next block of windows, keeping the part the blocks have in common
+    const double* next_block()
+    {
+        sf_count_t filled = 0;
+        if (started) {
+            memmove(samples, samples + size - overlap, sizeof(double) * overlap);
+            filled = overlap;
+        }
+        started = true;
+        while (filled < size)
+            filled += read_chunk(samples + filled, std::min(window_size, size - filled));
+        return samples;
+    }
+
+private:
+    sf_count_t read_chunk(double* out, sf_count_t count)
+    {
+        const sf_count_t frames = sf_readf_float(file, chunk.data(), count);
+        for (sf_count_t n = 0; n < count; n++) {
+            // average channels, missing frames of a truncated file are silence
+            float sample = 0;
+            if (n < frames) {
+                sample = chunk[n * channels];
+                for (int ch = 1; ch < channels; ch++)
+                    sample += chunk[n * channels + ch];
+                if (channels != 1)
+                    sample /= channels;
+            }
+            out[n] = sample;
+        }
+        return count;
+    }
+
+    SNDFILE* const file;
+    const int channels;
+    const sf_count_t window_size;
+    const sf_count_t overlap;
+    const sf_count_t size;
+    std::vector<float> chunk;
+    double* const samples;
+    bool started = false;
+};
+
+/*
+ * computes the magnitudes of the lower frequency bins for blocks of windows, each thread
+ * transforming a batch of consecutive windows
+ *
+ * With a wisdom file the batches are transformed by a single FFTW_MEASURE plan reading the
+ * windows in place. Otherwise every window is copied and transformed on its own by an
+ * FFTW_ESTIMATE plan as snd2png always did, so the output stays reproducible.
+ */
+class Spectrogram {
+public:
+    static constexpr int batch_windows = 64;
+
+    Spectrogram(int window_size, int dft_size, int last_bin, int threads, const char* wisdom_file)
+        : window_size(window_size)
+        , dft_size(dft_size)
+        , bins(dft_size / 2 + 1)
+        , last_bin(last_bin)
+        , threads(threads)
+        , magnitudes(static_cast<size_t>(threads) * batch_windows * last_bin)
+    {
+        measured = wisdom_file != nullptr;
+        for (int thread = 0; thread < threads; thread++) {
+            inputs.push_back(fftw_alloc_real(measured ? static_cast<size_t>(batch_windows - 1) * window_size + dft_size : dft_size));
+            outputs.push_back(fftw_alloc_complex(static_cast<size_t>(measured ? batch_windows : 1) * bins));
+            if (!inputs.back() || !outputs.back())
+                return;
+        }
+        allocated = true;
+        if (!measured) {
+            plan = fftw_plan_dft_r2c_1d(dft_size, inputs[0], outputs[0], FFTW_ESTIMATE);
+            return;
+        }
+
+        // windows overlap, so the plan must not touch its input; batches are not aligned
+        fftw_import_wisdom_from_filename(wisdom_file);
+        plan = fftw_plan_many_dft_r2c(1, &this->dft_size, batch_windows, inputs[0], nullptr, 1, window_size,
+            outputs[0], nullptr, 1, bins, FFTW_MEASURE | FFTW_PRESERVE_INPUT | FFTW_UNALIGNED);
+        const std::string temporary_file = std::string(wisdom_file) + "." + std::to_string(getpid());
+        if (plan && (!fftw_export_wisdom_to_filename(temporary_file.c_str()) || rename(temporary_file.c_str(), wisdom_file))) {
+            fprintf(stderr, "Unable to store FFTW wisdom in \"%s\".\n", wisdom_file);
+            unlink(temporary_file.c_str());
+        }
+    }
+
+    ~Spectrogram()
+    {
+        if (plan)
+            fftw_destroy_plan(plan);
+        for (auto input : inputs)
+            fftw_free(input);
+        for (auto output : outputs)
+            fftw_free(output);
+    }
+    Spectrogram(const Spectrogram&) = delete;
+    Spectrogram& operator=(const Spectrogram&) = delete;
+
+    bool valid() const { return plan != nullptr; }
+    bool allocated_buffers() const { return allocated; }
+    int block_windows() const { return threads * batch_windows; }
+
+    // transforms the first count windows of the block starting at the given samples
+    void transform(const double* samples, int count)
+    {
+        std::vector<std::thread> workers;
+        for (int thread = 1; thread < threads && thread * batch_windows < count; thread++)
+            workers.emplace_back(&Spectrogram::transform_batch, this, thread, samples, count);
+        transform_batch(0, samples, count);
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    const double* row(int index) const { return magnitudes.data() + static_cast<size_t>(index) * last_bin; }
+
+private:
+    void transform_batch(int thread, const double* samples, int count)
+    {
+        const int first = thread * batch_windows;
+        const int last = std::min(count, first + batch_windows);
+        double* const input = inputs[thread];
+        fftw_complex* const output = outputs[thread];
+        if (measured)
+            fftw_execute_dft_r2c(plan, const_cast<double*>(samples + first * window_size), output);
+        for (int window = first; window < last; window++) {
+            const fftw_complex* values = output + (window - first) * bins;
+            if (!measured) {
+                memcpy(input, samples + window * window_size, sizeof(double) * dft_size);
+                fftw_execute_dft_r2c(plan, input, output);
+                values = output;
+            }
+            double* const row_magnitudes = magnitudes.data() + static_cast<size_t>(window) * last_bin;
+            for (int i = 0; i < last_bin; i++)
+                row_magnitudes[i] = imabs(values[i]);
+        }
+    }
+
+    const int window_size;
+    int dft_size;
+    const int bins;
+    const int last_bin;
+    const int threads;
+    bool measured = false;
+    bool allocated = false;
+    fftw_plan plan = nullptr;
+    std::vector<double*> inputs;
+    std::vector<fftw_complex*> outputs;
+    std::vector<double> magnitudes;
+};
+
+/*
+ * derives the size of the windows and the frequency bins covering the voice band from the
+ * sample rate
+ */
+struct Geometry {
+    explicit Geometry(int samplerate)
+        // 10ms per chunk
+        : window_size(samplerate / (1000 / 10))
+        , overlap(window_size / 2)
+        , dft_size(window_size + overlap * 2)
+        , fft_max_freq(samplerate / 2.0)
+        , last_bin(std::min(int(1 + ceil(max_freq / fft_max_freq * (dft_size / 2.0))), int(1 + dft_size / 2.0)))
+        , fft_bw(fft_max_freq / (dft_size / 2.0))
+    {
+    }
+
+    // https://en.wikipedia.org/wiki/Voice_frequency
+    static constexpr double max_freq = 3200.;
+
+    const int window_size;
+    const sf_count_t overlap;
+    const sf_count_t dft_size;
+    const double fft_max_freq;
+    const int last_bin;
+    const double fft_bw;
+};
+
+// size of the image the windows are drawn into as columns
+constexpr int image_cols = 1024;
+constexpr int image_rows = 768;
+
+// creates the blank image the windows are drawn into as columns
+inline cv::Mat blank_image()
+{
+    return cv::Mat(image_rows, image_cols, CV_8U, cv::Scalar(255));
+}
+
+/*
+ * draws the magnitudes of the specified number of windows (starting with the first one which is
+ * not silent) as columns into the image, normalised by the maximum magnitude of the recording
+ */
+template <typename RowFunction>
+inline void draw(const RowFunction& row, int count, double max_value, const Geometry& geometry, cv::Mat& image)
+{
+    int scale_factor = 3;
+    int height = image.rows; // make sure it can be divided by the scale_factor
+
+    // we have to cover 3000 hz and 18 hz is the sitance between D4 and E4, so
+    // don't
+    // go too low with the number of frequencies to cover
+    int freqs = height / scale_factor;
+    for (int i = 1; i < freqs; ++i) {
+        double freq = i * Geometry::max_freq / freqs;
+        int bin = ceil(freq / geometry.fft_bw);
+        double ratio = bin - (freq / geometry.fft_bw);
+
+        for (int column = 0; column < count; column++) {
+            double value = valueForFreq(row(column), bin, ratio);
+
+            int scaled = 255 - static_cast<unsigned char>(255 * value / max_value);
+            for (int j = 0; j < scale_factor; j++) {
+                image.at<unsigned char>(height - 1 - i * scale_factor + j, column) = scaled;
+            }
+        }
+    }
+}
+
+/*
+ * renders the spectrogram of the sound file into the image; returns 0 on success, 1 if the file
+ * could not be read and 2 if the DFT could not be set up
+ *
+ * Progress is reported on the specified log stream if any, errors are always printed. FFTW
+ * plans are measured and cached within the wisdom directory if one is specified.
+ */
+inline int render(const char* path, cv::Mat& image, int threads, const char* wisdom_dir, FILE* log)
+{
+    SF_INFO info_in;
+    memset(&info_in, 0, sizeof(SF_INFO));
+    SNDFILE* fIn = sf_open(path, SFM_READ, &info_in);
+    if (!fIn) {
+        fprintf(stderr, "Unable to open input file \"%s\".\n", path);
+        sf_error(NULL);
+        return 1;
+    }
+
+    if (log)
+        fprintf(log, "snd2png: %d channels, samplerate %d Hz, %ld frames (%.2f seconds)\n", info_in.channels,
+            info_in.samplerate, info_in.frames, (float)(info_in.frames) / info_in.samplerate);
+
+    const Geometry geometry(info_in.samplerate);
+    const int window_size = geometry.window_size;
+    const int last_bin = geometry.last_bin;
+
+    if (log)
+        fprintf(log, "snd2png: %ld frequency bins\n", geometry.dft_size);
+
+    int times = info_in.frames / window_size - 1;
+    if (times * window_size + geometry.overlap > info_in.frames)
+        times--;
+
+    if (log)
+        fprintf(log, "spectogram samples: %d\n", times);
+
+    // plans are cached per sample rate and window size
+    std::string wisdom_file;
+    if (wisdom_dir)
+        wisdom_file = std::string(wisdom_dir) + "/snd2png-" + std::to_string(info_in.samplerate) + "-" + std::to_string(window_size) + ".wisdom";
+    Spectrogram spectrogram(window_size, static_cast<int>(geometry.dft_size), last_bin, threads, wisdom_dir ? wisdom_file.c_str() : nullptr);
+    SampleStream samples(fIn, info_in.channels, window_size, geometry.dft_size, spectrogram.block_windows());
+    if (!spectrogram.allocated_buffers() || !samples.allocated()) {
+        fputs("Unable to allocate memory.\n", stderr);
+        sf_close(fIn);
+        return 2;
+    }
+    if (!spectrogram.valid()) {
+        fprintf(stderr, "Fail to initialize FFTW plan.\n");
+        sf_close(fIn);
+        return 2;
+    }
+
+    // calls the function for each window (until it returns false) with the magnitudes of its frequency bins
+    const auto for_each_row = [&](const auto& function) {
+        for (int block = 0; block < times; block += spectrogram.block_windows()) {
+            const int count = std::min(spectrogram.block_windows(), times - block);
+            spectrogram.transform(samples.next_block(), count);
+            for (int i = 0; i < count; i++)
+                if (!function(block + i, spectrogram.row(i)))
+                    return;
+        }
+    };
+
+    // the first pass only determines the maximum for normalisation
+    double max_value = 0;
+    for_each_row([&](int, const double* values) {
+        const double value = max_row_value(values, last_bin);
+        if (max_value < value)
+            max_value = value;
+        return true;
+    });
+
+    if (log)
+        fprintf(log, "max amplitude: %lf\n", max_value / 2.0);
+
+    image = blank_image();
+
+    /*
+     * SILENCE, I'll kill you!
+     * The second pass skips the silence at the beginning and keeps the rows which fit into the
+     * image within a preallocated matrix. Afterwards it only needs to look for further sound
+     * until the image is known to be filled completely.
+     */
+    if (!samples.rewind()) {
+        fprintf(stderr, "Unable to seek within input file \"%s\".\n", path);
+        sf_close(fIn);
+        return 1;
+    }
+    std::vector<double> points(static_cast<size_t>(image.cols) * last_bin);
+    const auto row = [&](int index) { return points.data() + static_cast<size_t>(index) * last_bin; };
+    bool found_sound = false;
+    int first_non_silence = std::max(times, 0);
+    int last_non_silence = std::min(times - 1, 0);
+    for_each_row([&](int TimePos, const double* values) {
+        if (max_row_value(values, last_bin) > max_value * .1) {
+            if (!found_sound)
+                first_non_silence = TimePos;
+            found_sound = true;
+            last_non_silence = TimePos;
+        }
+        if (found_sound && TimePos - first_non_silence < image.cols)
+            memcpy(row(TimePos - first_non_silence), values, sizeof(double) * last_bin);
+        return !found_sound || last_non_silence - first_non_silence < image.cols;
+    });
+    sf_close(fIn);
+
+    if (last_non_silence - first_non_silence > image.cols)
+        last_non_silence = image.cols + first_non_silence;
+
+    if (log)
+        fprintf(log, "silences: %d %d\n", first_non_silence, last_non_silence);
+    draw(row, last_non_silence - first_non_silence, max_value, geometry, image);
+    return 0;
+}
+
+/*
+ * analyses a 16-bit PCM WAV file (as written by QEMU when capturing audio) while it is still
+ * growing
+ *
+ * Only the windows which became complete since the last update are transformed. Their magnitudes
+ * are kept starting from the first window which is not silent. The threshold for silence only
+ * rises with the maximum so windows before that are never needed again. At most as many windows
+ * as the image has columns are drawn so no windows are kept beyond that. The spectrogram of the
+ * recording so far is drawn like render() would draw it unless the first window which is not
+ * silent moves on after windows have been dropped that way; then fewer windows are drawn.
+ */
+class Live {
+public:
+    explicit Live(const char* path)
+        : fd(open(path, O_RDONLY | O_CLOEXEC))
+    {
+    }
+    ~Live()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+    Live(const Live&) = delete;
+    Live& operator=(const Live&) = delete;
+
+    bool valid() const { return fd >= 0; }
+
+    // reads the samples appended since the last update; returns the number of new windows or -1 on error
+    int update()
+    {
+        if (fd < 0)
+            return -1;
+        if (!geometry && !read_header())
+            return fd < 0 ? -1 : 0;
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat))
+            return -1;
+        const sf_count_t frames = (file_stat.st_size - data_offset) / (channels * 2);
+        if (frames > frames_read && !read_frames(frames))
+            return -1;
+        return transform_windows();
+    }
+
+    // returns the duration of the recording analysed so far in seconds
+    double seconds() const { return samplerate ? static_cast<double>(frames_read) / samplerate : 0; }
+
+    void draw_image(cv::Mat& image) const
+    {
+        image = blank_image();
+        if (!geometry)
+            return;
+
+        const auto threshold = max_value * .1;
+        auto count = static_cast<int>(row_max.size());
+        // a window which is not silent has been dropped after the kept ones
+        if (!(dropped_max > threshold))
+            while (count > 0 && !(row_max[count - 1] > threshold))
+                count--;
+        // the last window which is not silent is not drawn, just like in render()
+        count = std::min(count - 1, image.cols);
+        const auto last_bin = geometry->last_bin;
+        draw([&](int index) { return magnitudes.data() + static_cast<size_t>(index) * last_bin; }, count, max_value, *geometry, image);
+    }
+
+private:
+    // locates the samples within the file; returns false if the header has not been written completely yet
+    bool read_header()
+    {
+        unsigned char header[4096];
+        const auto size = pread(fd, header, sizeof(header), 0);
+        if (size < 12)
+            return false;
+        if (memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+            fail("not a WAV file");
+            return false;
+        }
+        const auto read_le = [&](ssize_t offset, int bytes) {
+            uint32_t value = 0;
+            for (int i = bytes - 1; i >= 0; i--)
+                value = value << 8 | header[offset + i];
+            return value;
+        };
+        for (ssize_t chunk = 12; chunk + 8 <= size; chunk += 8 + ((read_le(chunk + 4, 4) + 1) & ~1u)) {
+            if (!memcmp(header + chunk, "fmt ", 4) && chunk + 24 <= size) {
+                if (read_le(chunk + 8, 2) != 1 || read_le(chunk + 22, 2) != 16) {
+                    fail("only 16-bit PCM is supported");
+                    return false;
+                }
+                channels = static_cast<int>(read_le(chunk + 10, 2));
+                samplerate = static_cast<int>(read_le(chunk + 12, 4));
+            } else if (!memcmp(header + chunk, "data", 4)) {
+                if (!channels || samplerate < 100) {
+                    fail("invalid format");
+                    return false;
+                }
+                data_offset = chunk + 8;
+                geometry.reset(new Geometry(samplerate));
+                spectrogram.reset(new Spectrogram(geometry->window_size, static_cast<int>(geometry->dft_size), geometry->last_bin, 1, nullptr));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fail(const char* message)
+    {
+        fprintf(stderr, "Unable to analyse recording: %s\n", message);
+        close(fd);
+        fd = -1;
+    }
+
+    // presents the samples written so far as raw file to libsndfile so they are converted like in render()
+    struct RawView {
+        int fd;
+        sf_count_t offset;
+        sf_count_t length;
+        sf_count_t position;
+    };
+
+    bool read_frames(sf_count_t frames)
+    {
+        static SF_VIRTUAL_IO io = {
+            [](void* view) { return static_cast<RawView*>(view)->length; },
+            [](sf_count_t offset, int whence, void* user_data) {
+                auto view = static_cast<RawView*>(user_data);
+                view->position = offset + (whence == SEEK_CUR ? view->position : whence == SEEK_END ? view->length : 0);
+                return view->position;
+            },
+            [](void* buffer, sf_count_t count, void* user_data) {
+                auto view = static_cast<RawView*>(user_data);
+                count = std::min(count, view->length - view->position);
+                const auto size = count > 0 ? pread(view->fd, buffer, count, view->offset + view->position) : 0;
+                view->position += std::max<sf_count_t>(size, 0);
+                return static_cast<sf_count_t>(std::max<ssize_t>(size, 0));
+            },
+            [](const void*, sf_count_t, void*) { return sf_count_t(0); },
+            [](void* view) { return static_cast<RawView*>(view)->position; },
+        };
+        RawView view = { fd, data_offset, frames * channels * 2, 0 };
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.format = SF_FORMAT_RAW | SF_FORMAT_PCM_16 | SF_ENDIAN_LITTLE;
+        info.channels = channels;
+        info.samplerate = samplerate;
+        SNDFILE* file = sf_open_virtual(&io, SFM_READ, &info, &view);
+        if (!file || sf_seek(file, frames_read, SEEK_SET) != frames_read) {
+            if (file)
+                sf_close(file);
+            return false;
+        }
+        const auto window_size = geometry->window_size;
+        std::vector<float> chunk(static_cast<size_t>(window_size) * channels);
+        while (frames_read < frames) {
+            const auto count = sf_readf_float(file, chunk.data(), std::min<sf_count_t>(window_size, frames - frames_read));
+            if (count <= 0)
+                break;
+            for (sf_count_t n = 0; n < count; n++) {
+                // average channels like SampleStream does
+                float sample = chunk[n * channels];
+                for (int ch = 1; ch < channels; ch++)
+                    sample += chunk[n * channels + ch];
+                if (channels != 1)
+                    sample /= channels;
+                pending.push_back(sample);
+            }
+            frames_read += count;
+        }
+        sf_close(file);
+        return true;
+    }
+
+    // transforms all complete windows of the pending samples
+    int transform_windows()
+    {
+        const auto window_size = geometry->window_size;
+        const auto dft_size = static_cast<size_t>(geometry->dft_size);
+        const auto last_bin = geometry->last_bin;
+        int windows = pending.size() < dft_size ? 0 : static_cast<int>((pending.size() - dft_size) / window_size + 1);
+        for (int done = 0; done < windows;) {
+            const int count = std::min(spectrogram->block_windows(), windows - done);
+            spectrogram->transform(pending.data() + static_cast<size_t>(done) * window_size, count);
+            for (int i = 0; i < count; i++) {
+                const double* values = spectrogram->row(i);
+                const double value = max_row_value(values, last_bin);
+                max_value = std::max(max_value, value);
+                if (!dropping && row_max.size() == max_kept_windows)
+                    drop_silence();
+                // keep windows contiguous so stop keeping any once one has been dropped
+                dropping = dropping || row_max.size() == max_kept_windows;
+                if (dropping) {
+                    dropped_max = std::max(dropped_max, value);
+                    continue;
+                }
+                row_max.push_back(value);
+                magnitudes.insert(magnitudes.end(), values, values + last_bin);
+            }
+            done += count;
+        }
+        pending.erase(pending.begin(), pending.begin() + static_cast<ptrdiff_t>(windows) * window_size);
+        drop_silence();
+        return windows;
+    }
+
+    // drops the windows which are silent at the beginning
+    void drop_silence()
+    {
+        const auto last_bin = geometry->last_bin;
+        size_t silent = 0;
+        while (silent < row_max.size() && !(row_max[silent] > max_value * .1))
+            silent++;
+        row_max.erase(row_max.begin(), row_max.begin() + static_cast<ptrdiff_t>(silent));
+        magnitudes.erase(magnitudes.begin(), magnitudes.begin() + static_cast<ptrdiff_t>(silent * static_cast<size_t>(last_bin)));
+    }
+
+    // the columns of the image plus the last window which is not silent (and not drawn)
+    static constexpr size_t max_kept_windows = image_cols + 1;
+
+    int fd;
+    int channels = 0;
+    int samplerate = 0;
+    off_t data_offset = 0;
+    sf_count_t frames_read = 0;
+    std::unique_ptr<Geometry> geometry;
+    std::unique_ptr<Spectrogram> spectrogram;
+    std::vector<double> pending;
+    std::vector<double> magnitudes;
+    std::vector<double> row_max;
+    double max_value = 0;
+    bool dropping = false;
+    double dropped_max = 0;
+};
+} // namespace spectrogram
+
+#endif // SPECTROGRAM_H
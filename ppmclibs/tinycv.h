@@ -1,6 +1,7 @@
 // Copyright SUSE LLC
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -13,12 +14,47 @@ void image_destroy(Image* s);
 Image* image_new(long width, long height);
 Image* image_read(const char* filename);
 bool image_write(const Image* const s, const char* filename);
-// returns copy to static buffer
-std::vector<unsigned char>* image_ppm(Image* s);
+// writes the image and a thumbnail (skipped for height 0) in the background, see tinycv_writer.cc;
+// returns false if the file can not be written at all
+bool image_write_async(Image* s, const char* filename, const char* thumbnail_filename, long thumbnail_height);
+// waits until all images queued via image_write_async are written; returns the errors
+std::vector<std::string> image_write_flush();
+// sets the compression level (0-9, -1 for the default) of all PNG images written
+void set_png_compression(int level);
+enum class ImageFormat {
+    PPM,
+    PNG,
+    // lossless and much smaller than PPM but still fast, see qoi.h; only supported for BGR images
+    QOI,
+    Count
+};
+typedef std::shared_ptr<const std::vector<unsigned char>> EncodedImage;
+// encodes the image only once per format and modification, also if called from several threads;
+// empty if the format is not supported for the image
+EncodedImage image_encoded(Image* s, ImageFormat format);
+// QOI-encoded copy of an image for keeping many screenshots around (e.g. failed matches)
+struct CompactImage;
+CompactImage* image_compact(Image* s);
+void compact_image_destroy(CompactImage* c);
+const std::vector<unsigned char>& compact_image_qoi(CompactImage* c);
+long compact_image_xres(CompactImage* c);
+long compact_image_yres(CompactImage* c);
+// decodes the pixels only temporarily for the comparison
+double compact_image_similarity(CompactImage* c, Image* other);
+Image* compact_image_expand(CompactImage* c);
+// decodes QOI as well as any format supported by OpenCV (despite the name)
 Image* image_from_ppm(const unsigned char* data, size_t len);
+// copies the pixels into a sealed memfd to be passed to other processes; returns the fd or -1
+int image_export_fd(Image* s, std::string& header);
+// maps the pixels exported via image_export_fd without copying them
+Image* image_import_fd(int fd, const char* header);
+// renders the spectrogram of the sound file like snd2png, see spectrogram.h
+Image* image_read_sound(const char* filename, const char* wisdom_dir);
 
 std::vector<int> image_search(Image* s, Image* needle, long x, long y, long width, long height, long margin, double& similarity);
 // std::vector<int> image_search_fuzzy(Image *s, Image *needle);
+// searches the area of a spectrogram needle along the time axis of the recorded spectrogram
+std::vector<int> image_match_sound(Image* s, Image* needle, long x, long y, long width, long height, long margin, double& similarity);
 
 Image* image_copy(Image* s);
 
@@ -27,6 +63,8 @@ long image_yres(Image* s);
 
 void image_replacerect(Image* s, long x, long y, long width, long height);
 Image* image_copyrect(Image* s, long x, long y, long width, long height);
+// copies the range plus a small border into an image which can be searched in place of the whole one
+Image* image_tile(Image* s, long x, long y, long width, long height);
 void image_threshold(Image* s, int level);
 std::tuple<long, long, long> image_get_pixel(Image* a, long x, long y);
 std::vector<float> image_avgcolor(Image* s);
@@ -34,6 +72,8 @@ bool image_differ(Image* a, Image* b, unsigned char maxdiff);
 
 Image* image_scale(Image* a, int width, int height);
 double image_similarity(Image* a, Image* b);
+// returns a hex bitmap of the tiles differing between the images or an empty string if they are not comparable
+std::string image_changed_tiles(Image* a, Image* b, long tile_size);
 
 Image* image_absdiff(Image* a, Image* b);
 
@@ -69,3 +109,45 @@ void image_map_raw_data_uyvy(Image* a, const unsigned char* data);
 
 // copy the s image into a at x,y
 void image_blend_image(Image* a, Image* s, long x, long y);
+
+// memfd-backed ring of raw frames shared with the video encoder, see frame_ring.h
+struct FrameRing;
+FrameRing* frame_ring_new(unsigned int slots, long width, long height);
+void frame_ring_destroy(FrameRing* ring);
+int frame_ring_fd(FrameRing* ring);
+long frame_ring_stride(FrameRing* ring);
+long frame_ring_pending(FrameRing* ring);
+long frame_ring_consumed(FrameRing* ring);
+long frame_ring_put(FrameRing* ring, Image* s);
+
+// incremental spectrogram of a recording which is still growing, see spectrogram::Live
+struct SoundTail;
+SoundTail* sound_tail_new(const char* filename);
+void sound_tail_destroy(SoundTail* tail);
+// returns the number of windows analysed additionally or -1 on error
+long sound_tail_update(SoundTail* tail);
+double sound_tail_seconds(SoundTail* tail);
+Image* sound_tail_spectrogram(SoundTail* tail);
+
+// process-wide cache of the tiles of needle images limited by their size in bytes, see
+// tinycv_needle_cache.cc; rects are passed as x, y, width and height each
+void needle_cache_prefetch(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes);
+// returns the tile (see image_tile) of the area of the needle image painted with the excluded
+// rects; loads the image cutting out all areas unless cached, nullptr on errors
+Image* needle_cache_tile(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes, long x, long y, long width, long height);
+void needle_cache_set_budget(size_t bytes);
+// drops the least recently used needles until at most max_entries are left
+void needle_cache_trim(size_t max_entries);
+size_t needle_cache_entries();
+size_t needle_cache_bytes();
+// shares the tiles with other processes via files in the directory, disabled if empty; see
+// tinycv_needle_store.cc
+void needle_cache_set_store_dir(const char* dir);
+
+// searches patterns within a stream of bytes without looking at any byte twice, see
+// tinycv_stream_matcher.cc; nullptr if the patterns are not supported
+struct StreamMatcher;
+StreamMatcher* stream_matcher_new(const std::vector<std::string>& patterns, bool literal);
+void stream_matcher_destroy(StreamMatcher* matcher);
+// returns the offset after the first possible match within the data or -1
+long stream_matcher_feed(StreamMatcher* matcher, const unsigned char* data, size_t len);
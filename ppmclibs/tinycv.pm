@@ -18,6 +18,12 @@ our $VERSION = '1.0';
 
 bootstrap tinycv $VERSION;
 
+# waits until all images written via write_with_thumbnail are on disk
+sub flush_writes () {
+    my @errors = flush_writes_();
+    die join('', map { "$_\n" } @errors) if @errors;
+}
+
 package tinycv::Image;
 
 use Mojo::Base -strict, -signatures;
@@ -43,7 +49,7 @@ sub mean_square_error ($areas) {
 #     }
 #   ]
 # }
-sub search_ ($self, $needle, $threshold, $search_ratio, $stopwatch = undef) {
+sub search_ ($self, $needle, $threshold, $search_ratio, $stopwatch = undef, $matcher = 'search_needle') {
     $threshold ||= 0.0;
     $search_ratio ||= 0.0;
     my ($sim, $xmatch, $ymatch);
@@ -51,13 +57,6 @@ sub search_ ($self, $needle, $threshold, $search_ratio, $stopwatch = undef) {
 
     return undef unless $needle;
 
-    my $needle_image = $needle->get_image;
-    unless ($needle_image) {
-        bmwqemu::fctwarn("skipping $needle->{name}: missing PNG");
-        return undef;
-    }
-    $stopwatch->lap('**++ search__: get image') if $stopwatch;
-
     my $img = $self;
     for my $area (@{$needle->{area}}) {
         push @exclude, $area if $area->{type} eq 'exclude';
@@ -65,6 +64,18 @@ sub search_ ($self, $needle, $threshold, $search_ratio, $stopwatch = undef) {
         push @ocr, $area if $area->{type} eq 'ocr';
     }
 
+    # only the tiles of the match areas are needed (and cached) instead of the whole needle image
+    my @needle_images;
+    for my $area (@match) {
+        my $needle_image = $needle->get_image($area);
+        unless ($needle_image) {
+            bmwqemu::fctwarn("skipping $needle->{name}: missing PNG");
+            return undef;
+        }
+        push @needle_images, $needle_image;
+    }
+    $stopwatch->lap('**++ search__: get image') if $stopwatch;
+
     if (@exclude) {
         $img = $self->copy;
         for my $exclude_area (@exclude) {
@@ -75,11 +86,12 @@ sub search_ ($self, $needle, $threshold, $search_ratio, $stopwatch = undef) {
     }
     my $ret = {ok => 1, needle => $needle, area => []};
     for my $area (@match) {
+        my $needle_image = shift @needle_images;
         my $margin = int($area->{margin} + $search_ratio * (1024 - $area->{margin}));
 
-        ($sim, $xmatch, $ymatch) = $img->search_needle($needle_image, $area->{xpos}, $area->{ypos}, $area->{width}, $area->{height}, $margin);
+        ($sim, $xmatch, $ymatch) = $img->$matcher($needle_image, $area->{xpos}, $area->{ypos}, $area->{width}, $area->{height}, $margin);
 
-        $stopwatch->lap("**++ tinycv::search_needle $area->{width}x$area->{height} + $margin @ $area->{xpos}x$area->{ypos}") if $stopwatch;
+        $stopwatch->lap("**++ tinycv::$matcher $area->{width}x$area->{height} + $margin @ $area->{xpos}x$area->{ypos}") if $stopwatch;
         my $ma = {
             similarity => $sim,
             x => $xmatch,
@@ -139,7 +151,7 @@ sub cmp_by_error_type_ {    # no:style:signatures
 # in scalar context return found info or undef
 # in array context returns array with two elements. First element is best match
 # or undefined, second element are candidates that did not match.
-sub search ($self, $needle, $threshold = undef, $search_ratio = undef, $stopwatch = undef) {
+sub search ($self, $needle, $threshold = undef, $search_ratio = undef, $stopwatch = undef, $matcher = undef) {
     return undef unless $needle;
 
     $stopwatch->lap('Searching for needles') if $stopwatch;
@@ -148,7 +160,7 @@ sub search ($self, $needle, $threshold = undef, $search_ratio = undef, $stopwatc
         my @candidates;
         # try to match all needles and return the one with the highest similarity
         for my $n (@$needle) {
-            my $found = $self->search_($n, $threshold, $search_ratio, $stopwatch);
+            my $found = $self->search_($n, $threshold, $search_ratio, $stopwatch, $matcher // 'search_needle');
             push @candidates, $found if $found;
             $stopwatch->lap("** search_: $n->{name}") if $stopwatch;
         }
@@ -168,7 +180,7 @@ sub search ($self, $needle, $threshold = undef, $search_ratio = undef, $stopwatc
     }
 
     else {
-        my $found = $self->search_($needle, $threshold, $search_ratio, $stopwatch);
+        my $found = $self->search_($needle, $threshold, $search_ratio, $stopwatch, $matcher // 'search_needle');
         $stopwatch->lap("** search_: single needle: $needle->{name}") if $stopwatch;
         return undef unless $found;
         if (wantarray) {    ## no critic (Community::Wantarray)
@@ -180,15 +192,17 @@ sub search ($self, $needle, $threshold = undef, $search_ratio = undef, $stopwatc
     }
 }
 
-sub write_with_thumbnail ($self, $filename) {
-    $self->write($filename) or die "Unable to write '$filename'\n";
+# searches spectrogram needles within the spectrogram of a sound recording (see tinycv::read_sound)
+# only along the time axis, the similarity is the normalized cross-correlation of the areas
+sub search_sound ($self, $needle, $stopwatch = undef) { $self->search($needle, 0, 1, $stopwatch, 'match_sound') }
 
-    my $thumb = $self->scale($self->xres() * 45 / $self->yres(), 45);
+# writes the image and a thumbnail of it in the background, see tinycv::flush_writes
+sub write_with_thumbnail ($self, $filename) {
     my $dir = File::Basename::dirname($filename) . '/.thumbs';
     my $base = File::Basename::basename($filename);
 
     mkdir $dir;
-    $thumb->write("$dir/$base") or die "Unable to write '$dir/$base'\n";
+    $self->write_async($filename, "$dir/$base", 45) or die "Unable to write '$filename'\n";
 }
 
 1;
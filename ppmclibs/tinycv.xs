@@ -7,13 +7,19 @@
 #include "XSUB.h"
 #include "tinycv.h"
 
+#include <errno.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 typedef Image *tinycv__Image;
+typedef CompactImage *tinycv__CompactImage;
 typedef VNCInfo *tinycv__VNCInfo;
+typedef FrameRing *tinycv__FrameRing;
+typedef SoundTail *tinycv__SoundTail;
+typedef StreamMatcher *tinycv__StreamMatcher;
 typedef PerlIO* InOutStream;
 typedef int SysRet;
 
@@ -53,6 +59,61 @@ static SysRet clib_send_with_fd(int sk, char *buf, size_t len, int fd)
 	return sendmsg(sk, &msg, 0);
 }
 
+/* recv_with_fd(unix_socket, max_length)
+ *
+ * Receive a message sent via send_with_fd along with the file descriptor
+ * contained in its control section. The descriptor is -1 if the message
+ * did not contain one. The received descriptor has close-on-exec set.
+ * Further descriptors are closed. Nothing is returned if the control
+ * section has been truncated.
+ *
+ * Like send_with_fd this function does not take Perl's buffering into
+ * account.
+ */
+static SysRet clib_recv_with_fd(int sk, char *buf, size_t len, int *fd)
+{
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len
+	};
+	char cmsg_buf[CMSG_ALIGN(CMSG_SPACE(sizeof(*fd)))];
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg_buf;
+	msg.msg_controllen = sizeof(cmsg_buf);
+
+	*fd = -1;
+	const auto received = recvmsg(sk, &msg, MSG_CMSG_CLOEXEC);
+	if (received < 0)
+		return -1;
+	/* keep only the first descriptor and close any further ones so they do not leak */
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i) {
+			int received_fd;
+			memcpy(&received_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (*fd < 0)
+				*fd = received_fd;
+			else
+				close(received_fd);
+		}
+	}
+	/* descriptors which did not fit have been dropped so the message is not the one sent */
+	if (msg.msg_flags & MSG_CTRUNC) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return static_cast<SysRet>(received);
+}
+
 static SysRet clib_set_socket_timeout(int sockfd, time_t seconds, suseconds_t microseconds)
 {
     struct timeval tv;
@@ -63,6 +124,17 @@ static SysRet clib_set_socket_timeout(int sockfd, time_t seconds, suseconds_t mi
     return error1 ? error1 : error2;
 }
 
+/* converts a flat array of numbers, e.g. rects given as x, y, width and height each */
+static std::vector<long> longs_from_av(pTHX_ AV *values)
+{
+    std::vector<long> longs;
+    for (SSize_t i = 0; i <= av_len(values); ++i) {
+        SV **value = av_fetch(values, i, 0);
+        longs.push_back(value ? static_cast<long>(SvIV(*value)) : 0);
+    }
+    return longs;
+}
+
 MODULE = tinycv     PACKAGE = tinycv
 
 PROTOTYPES: ENABLE
@@ -74,6 +146,18 @@ CODE:
 OUTPUT:
        RETVAL
 
+void
+recv_with_fd(InOutStream sk, size_t len);
+PPCODE:
+       std::string buf(len, '\0');
+       int fd = -1;
+       const auto received = clib_recv_with_fd(PerlIO_fileno(sk), &buf[0], len, &fd);
+       if (received < 0)
+           XSRETURN_EMPTY;
+       EXTEND(SP, 2);
+       PUSHs(sv_2mortal(newSVpvn(buf.data(), static_cast<STRLEN>(received))));
+       PUSHs(sv_2mortal(newSViv(fd)));
+
 SysRet
 set_socket_timeout(int sockfd, time_t seconds)
 CODE:
@@ -93,6 +177,53 @@ create_threads(int thread_count = -1)
 CODE:
        create_opencv_threads(thread_count);
 
+void
+flush_writes_()
+PPCODE:
+       const auto errors = image_write_flush();
+       EXTEND(SP, SSize_t(errors.size()));
+       for (const auto& error : errors)
+           PUSHs(sv_2mortal(newSVpvn(error.data(), error.size())));
+
+void
+set_png_compression(int level)
+CODE:
+       set_png_compression(level);
+
+void
+prefetch_needle(const char *path, AV *areas, AV *excludes)
+CODE:
+       needle_cache_prefetch(path, longs_from_av(aTHX_ areas), longs_from_av(aTHX_ excludes));
+
+tinycv::Image
+needle_tile(const char *path, AV *areas, AV *excludes, long x, long y, long width, long height)
+CODE:
+       RETVAL = needle_cache_tile(path, longs_from_av(aTHX_ areas), longs_from_av(aTHX_ excludes), x, y, width, height);
+OUTPUT:
+       RETVAL
+
+void
+set_needle_cache_budget(size_t bytes)
+CODE:
+       needle_cache_set_budget(bytes);
+
+void
+trim_needle_cache(size_t max_entries)
+CODE:
+       needle_cache_trim(max_entries);
+
+void
+set_needle_store_dir(const char *dir)
+CODE:
+       needle_cache_set_store_dir(dir);
+
+void
+needle_cache_usage()
+PPCODE:
+       EXTEND(SP, 2);
+       PUSHs(sv_2mortal(newSVuv(needle_cache_entries())));
+       PUSHs(sv_2mortal(newSVuv(needle_cache_bytes())));
+
 tinycv::Image new(long width, long height)
   CODE:
     RETVAL = image_new(width, height);
@@ -107,6 +238,40 @@ tinycv::Image read(const char *file)
   OUTPUT:
     RETVAL
 
+tinycv::Image read_sound(const char *file, SV *wisdom_dir = NULL)
+  CODE:
+    RETVAL = image_read_sound(file, wisdom_dir && SvOK(wisdom_dir) ? SvPV_nolen(wisdom_dir) : nullptr);
+
+  OUTPUT:
+    RETVAL
+
+tinycv::SoundTail new_sound_tail(const char *file)
+  CODE:
+    RETVAL = sound_tail_new(file);
+
+  OUTPUT:
+    RETVAL
+
+tinycv::StreamMatcher new_stream_matcher(AV *patterns, bool literal = false)
+  CODE:
+    std::vector<std::string> strings;
+    for (SSize_t i = 0; i <= av_len(patterns); ++i) {
+      SV **pattern = av_fetch(patterns, i, 0);
+      if (!pattern || !SvOK(*pattern))
+        XSRETURN_UNDEF;
+      // the matcher works on bytes so patterns with wide characters are left to Perl
+      SV *bytes = sv_2mortal(newSVsv(*pattern));
+      if (!sv_utf8_downgrade(bytes, TRUE))
+        XSRETURN_UNDEF;
+      STRLEN len;
+      const char *buf = SvPV(bytes, len);
+      strings.emplace_back(buf, len);
+    }
+    RETVAL = stream_matcher_new(strings, literal);
+
+  OUTPUT:
+    RETVAL
+
 tinycv::Image from_ppm(SV *data)
   CODE:
     STRLEN len;
@@ -116,6 +281,13 @@ tinycv::Image from_ppm(SV *data)
   OUTPUT:
     RETVAL
 
+tinycv::Image import_fd(int fd, const char *header)
+  CODE:
+    RETVAL = image_import_fd(fd, header);
+
+  OUTPUT:
+    RETVAL
+
 tinycv::VNCInfo new_vncinfo(bool do_endian_conversion, bool true_color, unsigned int bytes_per_pixel, unsigned int red_mask, unsigned int red_shift, unsigned int green_mask, unsigned int green_shift, unsigned int blue_mask, unsigned int blue_shift)
    CODE:
      RETVAL = image_vncinfo(do_endian_conversion,
@@ -140,6 +312,13 @@ void set_colour(tinycv::VNCInfo info, unsigned int index, unsigned red, unsigned
    CODE:
      image_set_vnc_color(info, index, red, green, blue);
 
+tinycv::FrameRing new_frame_ring(unsigned int slots, long width, long height)
+  CODE:
+    RETVAL = frame_ring_new(slots, width, height);
+
+  OUTPUT:
+    RETVAL
+
 MODULE = tinycv     PACKAGE = tinycv::Image  PREFIX = Image
 
 bool write(tinycv::Image self, const char *file)
@@ -154,10 +333,55 @@ bool write(tinycv::Image self, const char *file)
   OUTPUT:
     RETVAL
 
+bool write_async(tinycv::Image self, const char *file, const char *thumbnail_file, long thumbnail_height)
+  CODE:
+    try {
+        RETVAL = image_write_async(self, file, thumbnail_file, thumbnail_height);
+    }
+    catch (const std::exception &e) {
+        croak("Could not write image '%s': %s", file, e.what());
+    }
+
+  OUTPUT:
+    RETVAL
+
 SV *ppm_data(tinycv::Image self)
   CODE:
-    std::vector<unsigned char> *buf = image_ppm(self);
-    RETVAL = newSVpv(reinterpret_cast<const char*>(buf->data()), buf->size());
+    const EncodedImage buf = image_encoded(self, ImageFormat::PPM);
+    RETVAL = newSVpvn(reinterpret_cast<const char*>(buf->data()), buf->size());
+
+  OUTPUT:
+    RETVAL
+
+SV *png_data(tinycv::Image self)
+  CODE:
+    const EncodedImage buf = image_encoded(self, ImageFormat::PNG);
+    RETVAL = newSVpvn(reinterpret_cast<const char*>(buf->data()), buf->size());
+
+  OUTPUT:
+    RETVAL
+
+void export_fd(tinycv::Image self)
+  PPCODE:
+    std::string header;
+    const int fd = image_export_fd(self, header);
+    if (fd < 0)
+      XSRETURN_EMPTY;
+    EXTEND(SP, 2);
+    PUSHs(sv_2mortal(newSViv(fd)));
+    PUSHs(sv_2mortal(newSVpvn(header.data(), header.size())));
+
+SV *qoi_data(tinycv::Image self)
+  CODE:
+    const EncodedImage buf = image_encoded(self, ImageFormat::QOI);
+    RETVAL = newSVpvn(reinterpret_cast<const char*>(buf->data()), buf->size());
+
+  OUTPUT:
+    RETVAL
+
+tinycv::CompactImage compact(tinycv::Image self)
+  CODE:
+    RETVAL = image_compact(self);
 
   OUTPUT:
     RETVAL
@@ -194,6 +418,13 @@ tinycv::Image copyrect(tinycv::Image self, long x, long y, long width, long heig
   OUTPUT:
     RETVAL
 
+tinycv::Image tile(tinycv::Image self, long x, long y, long width, long height)
+  CODE:
+    RETVAL = image_tile(self, x, y, width, height);
+
+  OUTPUT:
+    RETVAL
+
 void map_raw_data(tinycv::Image self, unsigned char *data, unsigned int x, unsigned int y, unsigned int w, unsigned h, tinycv::VNCInfo info)
   CODE:
     image_map_raw_data(self, data, x, y, w, h, info);
@@ -259,6 +490,16 @@ void search_needle(tinycv::Image self, tinycv::Image needle, long x, long y, lon
     }
 
 
+void match_sound(tinycv::Image self, tinycv::Image needle, long x, long y, long width, long height, long margin)
+  PPCODE:
+    double similarity = 0;
+    std::vector<int> ret = image_match_sound(self, needle, x, y, width, height, margin, similarity);
+    EXTEND(SP, SSize_t(ret.size() + 1));
+
+    PUSHs(sv_2mortal(newSVnv(similarity)));
+    for (const auto position : ret)
+      PUSHs(sv_2mortal(newSViv(position)));
+
 tinycv::Image scale(tinycv::Image self, long width, long height)
   CODE:
     RETVAL = image_scale(self, width, height);
@@ -273,6 +514,14 @@ double similarity(tinycv::Image self, tinycv::Image other)
   OUTPUT:
     RETVAL
 
+SV *changed_tiles(tinycv::Image self, tinycv::Image other, long tile_size)
+  CODE:
+    std::string tiles = image_changed_tiles(self, other, tile_size);
+    RETVAL = newSVpvn(tiles.data(), tiles.size());
+
+  OUTPUT:
+    RETVAL
+
 tinycv::Image absdiff(tinycv::Image self, tinycv::Image other)
   CODE:
     RETVAL = image_absdiff(self, other);
@@ -284,3 +533,134 @@ void DESTROY(tinycv::Image self)
   CODE:
     image_destroy(self);
 
+
+MODULE = tinycv     PACKAGE = tinycv::CompactImage  PREFIX = CompactImage
+
+SV *qoi_data(tinycv::CompactImage self)
+  CODE:
+    const std::vector<unsigned char>& buf = compact_image_qoi(self);
+    RETVAL = newSVpvn(reinterpret_cast<const char*>(buf.data()), buf.size());
+
+  OUTPUT:
+    RETVAL
+
+long xres(tinycv::CompactImage self)
+  CODE:
+    RETVAL = compact_image_xres(self);
+
+  OUTPUT:
+    RETVAL
+
+long yres(tinycv::CompactImage self)
+  CODE:
+    RETVAL = compact_image_yres(self);
+
+  OUTPUT:
+    RETVAL
+
+double similarity(tinycv::CompactImage self, tinycv::Image other)
+  CODE:
+    RETVAL = compact_image_similarity(self, other);
+
+  OUTPUT:
+    RETVAL
+
+tinycv::Image expand(tinycv::CompactImage self)
+  CODE:
+    RETVAL = compact_image_expand(self);
+
+  OUTPUT:
+    RETVAL
+
+void DESTROY(tinycv::CompactImage self)
+  CODE:
+    compact_image_destroy(self);
+
+MODULE = tinycv     PACKAGE = tinycv::FrameRing  PREFIX = FrameRing
+
+int fd(tinycv::FrameRing self)
+  CODE:
+    RETVAL = frame_ring_fd(self);
+
+  OUTPUT:
+    RETVAL
+
+long stride(tinycv::FrameRing self)
+  CODE:
+    RETVAL = frame_ring_stride(self);
+
+  OUTPUT:
+    RETVAL
+
+long pending(tinycv::FrameRing self)
+  CODE:
+    RETVAL = frame_ring_pending(self);
+
+  OUTPUT:
+    RETVAL
+
+long consumed(tinycv::FrameRing self)
+  CODE:
+    RETVAL = frame_ring_consumed(self);
+
+  OUTPUT:
+    RETVAL
+
+long put(tinycv::FrameRing self, tinycv::Image image)
+  CODE:
+    RETVAL = frame_ring_put(self, image);
+
+  OUTPUT:
+    RETVAL
+
+void DESTROY(tinycv::FrameRing self)
+  CODE:
+    frame_ring_destroy(self);
+
+MODULE = tinycv     PACKAGE = tinycv::SoundTail  PREFIX = SoundTail
+
+long update(tinycv::SoundTail self)
+  CODE:
+    RETVAL = sound_tail_update(self);
+
+  OUTPUT:
+    RETVAL
+
+double seconds(tinycv::SoundTail self)
+  CODE:
+    RETVAL = sound_tail_seconds(self);
+
+  OUTPUT:
+    RETVAL
+
+tinycv::Image spectrogram(tinycv::SoundTail self)
+  CODE:
+    RETVAL = sound_tail_spectrogram(self);
+
+  OUTPUT:
+    RETVAL
+
+void DESTROY(tinycv::SoundTail self)
+  CODE:
+    sound_tail_destroy(self);
+
+MODULE = tinycv     PACKAGE = tinycv::StreamMatcher  PREFIX = StreamMatcher
+
+long feed(tinycv::StreamMatcher self, SV *data)
+  CODE:
+    SV *bytes = sv_2mortal(newSVsv(data));
+    if (!sv_utf8_downgrade(bytes, TRUE)) {
+      // wide characters can not be fed as bytes so report a possible match at the start
+      RETVAL = 0;
+    } else {
+      STRLEN len;
+      const unsigned char *buf = (const unsigned char*)SvPV(bytes, len);
+      RETVAL = stream_matcher_feed(self, buf, len);
+    }
+
+  OUTPUT:
+    RETVAL
+
+void DESTROY(tinycv::StreamMatcher self)
+  CODE:
+    stream_matcher_destroy(self);
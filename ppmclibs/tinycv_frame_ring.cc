@@ -0,0 +1,110 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_ring.h"
+#include "tinycv.h"
+
+using namespace cv;
+
+struct FrameRing {
+    int fd = -1;
+    size_t size = 0;
+    frame_ring::Header* header = nullptr;
+
+    ~FrameRing()
+    {
+        if (header)
+            munmap(header, size);
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+FrameRing* frame_ring_new(unsigned int slots, long width, long height)
+{
+    if (!slots || width <= 0 || height <= 0)
+        return nullptr;
+
+    // align rows so the encoder can process them with aligned loads
+    const auto stride = (static_cast<uint32_t>(width) * 3 + 63) & ~63u;
+    const auto slot_size = (static_cast<uint64_t>(stride) * static_cast<uint64_t>(height) + 4095) & ~uint64_t(4095);
+
+    auto ring = new FrameRing;
+    ring->size = frame_ring::mapping_size(slots, slot_size);
+    ring->fd = memfd_create("os-autoinst-frame-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd < 0 || ftruncate(ring->fd, static_cast<off_t>(ring->size))) {
+        std::cerr << "Unable to create frame ring: " << strerror(errno) << std::endl;
+        delete ring;
+        return nullptr;
+    }
+    // the size is fixed from now on so the encoder can trust it after mapping
+    fcntl(ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    void* mapping = mmap(nullptr, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Unable to map frame ring: " << strerror(errno) << std::endl;
+        delete ring;
+        return nullptr;
+    }
+    ring->header = new (mapping) frame_ring::Header;
+    ring->header->magic = frame_ring::magic;
+    ring->header->version = frame_ring::version;
+    ring->header->slot_count = slots;
+    ring->header->width = static_cast<uint32_t>(width);
+    ring->header->height = static_cast<uint32_t>(height);
+    ring->header->stride = stride;
+    ring->header->slot_size = slot_size;
+    ring->header->produced.store(0);
+    ring->header->released.store(0);
+    ring->header->consumed.store(0);
+    return ring;
+}
+
+void frame_ring_destroy(FrameRing* ring) { delete ring; }
+
+int frame_ring_fd(FrameRing* ring) { return ring->fd; }
+
+long frame_ring_stride(FrameRing* ring) { return ring->header->stride; }
+
+long frame_ring_pending(FrameRing* ring)
+{
+    const auto header = ring->header;
+    return static_cast<long>(header->produced.load(std::memory_order_relaxed) - header->released.load(std::memory_order_acquire));
+}
+
+long frame_ring_consumed(FrameRing* ring)
+{
+    return static_cast<long>(ring->header->consumed.load(std::memory_order_relaxed));
+}
+
+/*
+ * copies the frame into the next free slot and returns the slot number; returns -1 if the
+ * encoder has not released enough slots yet or if the frame does not fit the ring geometry
+ */
+long frame_ring_put_mat(FrameRing* ring, const Mat& frame)
+{
+    const auto header = ring->header;
+    if (frame.type() != CV_8UC3 || static_cast<uint32_t>(frame.cols) != header->width || static_cast<uint32_t>(frame.rows) != header->height)
+        return -1;
+
+    const auto produced = header->produced.load(std::memory_order_relaxed);
+    if (produced - header->released.load(std::memory_order_acquire) >= header->slot_count)
+        return -1;
+
+    const auto slot = static_cast<uint32_t>(produced % header->slot_count);
+    unsigned char* dst = frame_ring::slot_data(header, slot);
+    const auto row_size = static_cast<size_t>(frame.cols) * 3;
+    for (int y = 0; y < frame.rows; y++, dst += header->stride)
+        memcpy(dst, frame.ptr<uchar>(y), row_size);
+
+    header->produced.store(produced + 1, std::memory_order_release);
+    return slot;
+}
@@ -5,13 +5,17 @@
 #include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include <algorithm> // std::min
+#include <array>
 #include <cmath> // std::isnan
 #include <vector>
 
@@ -20,6 +24,8 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "needle_cache.h"
+#include "qoi.h"
 #include "tinycv.h"
 
 #define DEBUG 0
@@ -32,8 +38,33 @@ using namespace cv;
 
 struct Image {
     Mat img;
+    // keeps the pixels alive if img refers to memory it does not own (e.g. a shared image)
+    std::shared_ptr<void> mapping;
     mutable Mat _preped;
     mutable Rect _prep_roi;
+    // encoded forms of the pixels (see image_encoded), computed on demand and shared between
+    // threads; they are dropped via pixels_changed() whenever the pixels are modified in place
+    mutable std::mutex encodings_mutex;
+    mutable std::array<EncodedImage, static_cast<size_t>(ImageFormat::Count)> encodings;
+    // position within and size of the image this one has been cut out of (see image_tile)
+    Point origin;
+    Size full_size;
+
+    Size size() const { return full_size.area() ? full_size : img.size(); }
+
+    // returns the range (in coordinates of the whole image) relative to img or an empty rect if
+    // it is not contained within img
+    Rect local(const Rect& range) const
+    {
+        const Rect available(origin, img.size());
+        return (range & available) == range ? Rect(range.tl() - origin, range.size()) : Rect();
+    }
+
+    void pixels_changed()
+    {
+        std::lock_guard<std::mutex> lock(encodings_mutex);
+        encodings.fill(nullptr);
+    }
 
     Mat prep(const Rect& roi) const
     {
@@ -187,8 +218,9 @@ std::vector<int> search_TEMPLATE(const Image* scene, const Image* object,
 
     // Optimization -- Search close to the original area working with ROI
     // Scale the possition if object and scene have different sizes
-    int scaled_x = x * scene->img.cols / object->img.cols;
-    int scaled_y = y * scene->img.rows / object->img.rows;
+    const Size object_size = object->size();
+    int scaled_x = x * scene->img.cols / object_size.width;
+    int scaled_y = y * scene->img.rows / object_size.height;
     int scene_x = std::max(0, int(scaled_x - margin));
     int scene_y = std::max(0, int(scaled_y - margin));
     int scene_bottom_x = std::min(scene->img.cols, int(scaled_x + width + margin));
@@ -196,11 +228,18 @@ std::vector<int> search_TEMPLATE(const Image* scene, const Image* object,
     int scene_width = scene_bottom_x - scene_x;
     int scene_height = scene_bottom_y - scene_y;
 
+    // the object might only be a tile of the needle containing the area (see image_tile)
+    const Rect object_rect = object->local(Rect(x, y, width, height));
+    if (object_rect.empty()) {
+        std::cerr << "ERROR - search: area not within needle tile" << std::endl;
+        return outvec;
+    }
+
     Mat scene_copy = scene->prep(Rect(scene_x, scene_y, scene_width, scene_height));
-    Mat object_copy = object->prep(Rect(x, y, width, height));
+    Mat object_copy = object->prep(object_rect);
 
     Mat scene_roi(scene_copy, Rect(scene_x, scene_y, scene_width, scene_height));
-    Mat object_roi(object_copy, Rect(x, y, width, height));
+    Mat object_roi(object_copy, object_rect);
 
     // Calculate size of result matrix and create it. If scene is W x H
     // and object is w x h, res is (W - w + 1) x ( H - h + 1)
@@ -399,28 +438,185 @@ Image* image_read(const char* filename)
     return image;
 }
 
+// implemented in tinycv_sound.cc
+bool sound_spectrogram_mat(const char* path, const char* wisdom_dir, Mat& image);
+double sound_match_mat(const Mat& recording, const Mat& needle_area, long x, long y, long margin, long& match_x);
+
+void sound_tail_spectrogram_mat(SoundTail* tail, Mat& image);
+
+Image* image_read_sound(const char* filename, const char* wisdom_dir)
+{
+    Image* image = new Image;
+    if (!sound_spectrogram_mat(filename, wisdom_dir, image->img)) {
+        delete image;
+        return nullptr;
+    }
+    return image;
+}
+
+Image* sound_tail_spectrogram(SoundTail* tail)
+{
+    Image* image = new Image;
+    sound_tail_spectrogram_mat(tail, image->img);
+    return image;
+}
+
+// implemented in tinycv_shared.cc
+int shared_mat_export(const Mat& image, std::string& header);
+std::shared_ptr<void> shared_mat_import(int fd, const char* header, Mat& image);
+
+int image_export_fd(Image* s, std::string& header) { return shared_mat_export(s->img, header); }
+
+Image* image_import_fd(int fd, const char* header)
+{
+    Image* image = new Image;
+    image->mapping = shared_mat_import(fd, header, image->img);
+    if (!image->mapping) {
+        delete image;
+        return nullptr;
+    }
+    return image;
+}
+
 Image* image_from_ppm(const unsigned char* data, size_t len)
 {
+    if (qoi::is_qoi(data, len)) {
+        uint32_t width = 0, height = 0;
+        if (!qoi::read_header(data, len, width, height)) {
+            std::cerr << "Invalid QOI image of " << len << " bytes" << std::endl;
+            return nullptr;
+        }
+        Image* image = new Image;
+        image->img.create(static_cast<int>(height), static_cast<int>(width), CV_8UC3);
+        qoi::decode_bgr(data, len, image->img.data, image->img.step);
+        return image;
+    }
     std::vector<uchar> buf(data, data + len);
     Image* image = new Image;
     image->img = imdecode(buf, cv::IMREAD_COLOR);
     return image;
 }
 
+// implemented in tinycv_writer.cc
+std::vector<int> mat_write_params();
+void write_mat_async(const Mat& image, const std::string& filename, const std::string& thumbnail_filename, long thumbnail_height);
+std::vector<std::string> write_mat_flush();
+
 bool image_write(const Image* const s, const char* filename)
 {
     if (s->img.empty()) {
         CV_Error(0, "image is empty");
     }
-    return imwrite(filename, s->img);
+    return imwrite(filename, s->img, mat_write_params());
+}
+
+bool image_write_async(Image* s, const char* filename, const char* thumbnail_filename, long thumbnail_height)
+{
+    if (s->img.empty()) {
+        CV_Error(0, "image is empty");
+    }
+    if (!haveImageWriter(filename)) {
+        CV_Error(0, "no writer found for the specified extension");
+    }
+    // fail early on obvious errors; others are only reported when flushing
+    const std::string path(filename);
+    const auto slash = path.rfind('/');
+    const auto dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+    if (access(dir.c_str(), W_OK))
+        return false;
+    // copy the pixels as the image might be modified in place while the write is pending
+    write_mat_async(s->img.clone(), filename, thumbnail_filename, thumbnail_height);
+    return true;
+}
+
+std::vector<std::string> image_write_flush() { return write_mat_flush(); }
+
+static std::vector<uchar> encode_mat(const Mat& img, ImageFormat format)
+{
+    std::vector<uchar> buf;
+    switch (format) {
+    case ImageFormat::PPM:
+        imencode(".ppm", img, buf);
+        break;
+    case ImageFormat::PNG:
+        imencode(".png", img, buf);
+        break;
+    case ImageFormat::QOI:
+        if (img.type() == CV_8UC3 && !img.empty()) {
+            qoi::encode_bgr(img.data, static_cast<uint32_t>(img.cols), static_cast<uint32_t>(img.rows), img.step, buf);
+            // the encoder reserves space for the worst case
+            buf.shrink_to_fit();
+        }
+        break;
+    case ImageFormat::Count:
+        break;
+    }
+    return buf;
+}
+
+EncodedImage image_encoded(Image* s, ImageFormat format)
+{
+    auto& slot = s->encodings.at(static_cast<size_t>(format));
+    {
+        std::lock_guard<std::mutex> lock(s->encodings_mutex);
+        if (slot)
+            return slot;
+    }
+    // encode without holding the lock so other formats can be requested meanwhile; if another
+    // thread has been faster its result is used so all callers share the same buffer
+    auto encoded = std::make_shared<const std::vector<uchar>>(encode_mat(s->img, format));
+    std::lock_guard<std::mutex> lock(s->encodings_mutex);
+    if (!slot)
+        slot = std::move(encoded);
+    return slot;
+}
+
+struct CompactImage {
+    std::vector<uchar> qoi;
+    int cols = 0;
+    int rows = 0;
+
+    Mat decode() const
+    {
+        Mat pixels(rows, cols, CV_8UC3);
+        qoi::decode_bgr(qoi.data(), qoi.size(), pixels.data, pixels.step);
+        return pixels;
+    }
+};
+
+CompactImage* image_compact(Image* s)
+{
+    const auto encoded = image_encoded(s, ImageFormat::QOI);
+    if (encoded->empty())
+        return nullptr;
+    auto compact = new CompactImage;
+    compact->qoi = *encoded;
+    compact->cols = s->img.cols;
+    compact->rows = s->img.rows;
+    return compact;
 }
 
-std::vector<uchar>* image_ppm(Image* s)
+void compact_image_destroy(CompactImage* c) { delete c; }
+
+const std::vector<uchar>& compact_image_qoi(CompactImage* c) { return c->qoi; }
+
+long compact_image_xres(CompactImage* c) { return c->cols; }
+
+long compact_image_yres(CompactImage* c) { return c->rows; }
+
+double compact_image_similarity(CompactImage* c, Image* other)
 {
-    // reuse memory
-    static std::vector<uchar> buf;
-    imencode(".ppm", s->img, buf);
-    return &buf;
+    if (c->rows != other->img.rows || c->cols != other->img.cols)
+        return VERY_DIFF;
+
+    return getPSNR(c->decode(), other->img);
+}
+
+Image* compact_image_expand(CompactImage* c)
+{
+    Image* image = new Image;
+    image->img = c->decode();
+    return image;
 }
 
 Image* image_copy(Image* s)
@@ -439,6 +635,7 @@ long image_yres(Image* s) { return s->img.rows; }
  */
 void image_replacerect(Image* s, long x, long y, long width, long height)
 {
+    s->pixels_changed();
     // avoid an exception
     if (x < 0 || y < 0 || y + height > s->img.rows || x + width > s->img.cols) {
         std::cerr << "ERROR - replacerect: out of range\n"
@@ -465,9 +662,49 @@ Image* image_copyrect(Image* s, long x, long y, long width, long height)
     return n;
 }
 
+/*
+ * copies the given range extended by a border of one pixel (as far as available) into a new
+ * image which can be used in place of the whole image when searching for that range, see
+ * needle_cache.h
+ */
+Image* image_tile(Image* s, long x, long y, long width, long height)
+{
+    const Rect range(x, y, width, height);
+    if (width <= 0 || height <= 0 || s->local(range).empty()) {
+        std::cerr << "ERROR - tile: out of range" << std::endl;
+        return nullptr;
+    }
+
+    const Rect tile = needle_cache::tile_rect(range, Rect(s->origin, s->img.size()));
+    Image* n = new Image;
+    n->img = s->img(s->local(tile)).clone();
+    n->origin = tile.tl();
+    n->full_size = s->size();
+    return n;
+}
+
+Image* needle_cache_tile(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes, long x, long y, long width, long height)
+{
+    needle_cache::Tile tile;
+    if (!needle_cache::tile(path, areas, excludes, Rect(x, y, width, height), tile))
+        return nullptr;
+
+    // the pixels are shared with the cache; as the whole tile is already preprocessed searching
+    // does not modify them
+    Image* n = new Image;
+    n->img = tile.pixels;
+    n->_preped = tile.preped;
+    n->_prep_roi = Rect(Point(0, 0), tile.pixels.size());
+    n->origin = tile.origin;
+    n->full_size = tile.full_size;
+    n->mapping = tile.mapping;
+    return n;
+}
+
 // in-place op: change all values to 0 (if below threshold) or 255 otherwise
 void image_threshold(Image* a, int level)
 {
+    a->pixels_changed();
     for (int y = 0; y < a->img.rows; y++) {
         for (int x = 0; x < a->img.cols; x++) {
             Vec3b farbe = a->img.at<Vec3b>(y, x);
@@ -505,6 +742,21 @@ std::vector<int> image_search(Image* s, Image* needle, long x, long y,
     return search_TEMPLATE(s, needle, x, y, width, height, margin, similarity);
 }
 
+std::vector<int> image_match_sound(Image* s, Image* needle, long x, long y,
+    long width, long height, long margin,
+    double& similarity)
+{
+    long match_x = x;
+    const Rect needle_rect = width > 0 && height > 0 ? needle->local(Rect(x, y, width, height)) : Rect();
+    if (needle_rect.empty()) {
+        std::cerr << "ERROR - match_sound: out of range" << std::endl;
+        similarity = 0;
+        return { static_cast<int>(match_x), static_cast<int>(y) };
+    }
+    similarity = sound_match_mat(s->img, needle->img(needle_rect), x, y, margin, match_x);
+    return { static_cast<int>(match_x), static_cast<int>(y) };
+}
+
 Image* image_scale(Image* a, int width, int height)
 {
     Image* n = new Image;
@@ -534,6 +786,42 @@ double image_similarity(Image* a, Image* b)
     return getPSNR(a->img, b->img);
 }
 
+/*
+ * compares the images in tiles of tile_size x tile_size pixels (row by row); the bit of tile i
+ * is bit i % 8 of byte i / 8 of the returned bitmap which is encoded as hex string
+ */
+std::string image_changed_tiles(Image* a, Image* b, long tile_size)
+{
+    if (tile_size <= 0 || a->img.size() != b->img.size() || a->img.type() != b->img.type())
+        return std::string();
+
+    const long tiles_x = (a->img.cols + tile_size - 1) / tile_size;
+    const long tiles_y = (a->img.rows + tile_size - 1) / tile_size;
+    std::vector<unsigned char> bitmap(static_cast<size_t>(tiles_x * tiles_y + 7) / 8);
+    const size_t pixel_size = a->img.elemSize();
+    for (int y = 0; y < a->img.rows; y++) {
+        const uchar* row_a = a->img.ptr<uchar>(y);
+        const uchar* row_b = b->img.ptr<uchar>(y);
+        for (long tx = 0, tile = y / tile_size * tiles_x; tx < tiles_x; tx++, tile++) {
+            if (bitmap[tile / 8] & (1 << (tile % 8)))
+                continue;
+            const long x = tx * tile_size;
+            const size_t offset = x * pixel_size;
+            if (memcmp(row_a + offset, row_b + offset, std::min(tile_size, a->img.cols - x) * pixel_size))
+                bitmap[tile / 8] |= 1 << (tile % 8);
+        }
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bitmap.size() * 2);
+    for (const auto byte : bitmap) {
+        hex += digits[byte >> 4];
+        hex += digits[byte & 15];
+    }
+    return hex;
+}
+
 Image* image_absdiff(Image* a, Image* b)
 {
     Image* n = new Image;
@@ -630,6 +918,7 @@ VNCInfo* image_vncinfo(bool do_endian_conversion, bool true_colour,
 void image_fill_pixel(Image* a, const unsigned char* data, VNCInfo* info,
     long x, long y, long width, long height)
 {
+    a->pixels_changed();
     size_t offset = 0;
     Vec3b pixel = info->read_pixel(data, offset);
 
@@ -651,11 +940,13 @@ void decode_ast2100(Mat* img, const unsigned char* data, size_t len);
 void image_map_raw_data_ast2100(Image* a, const unsigned char* data,
     size_t len)
 {
+    a->pixels_changed();
     decode_ast2100(&a->img, data, len);
 }
 
 void image_map_raw_data_rgb555(Image* a, const unsigned char* data)
 {
+    a->pixels_changed();
     for (int y = 0; y < a->img.rows; y++) {
         for (int x = 0; x < a->img.cols; x++) {
             long pixel = *data++;
@@ -675,6 +966,7 @@ void image_map_raw_data_rgb555(Image* a, const unsigned char* data)
 
 void image_map_raw_data_uyvy(Image* a, const unsigned char* data)
 {
+    a->pixels_changed();
     for (int y = 0; y < a->img.rows; y++) {
         for (int x = 0; x < a->img.cols; x += 2) {
             int offset = (y * a->img.cols + x) * 2;
@@ -762,6 +1054,7 @@ void image_map_raw_data(Image* a, const unsigned char* data, unsigned int ox,
     unsigned int oy, unsigned int width,
     unsigned int height, VNCInfo* info)
 {
+    a->pixels_changed();
     size_t offset = 0;
     for (unsigned int y = 0; y < height; y++) {
         for (unsigned int x = 0; x < width; x++) {
@@ -771,9 +1064,18 @@ void image_map_raw_data(Image* a, const unsigned char* data, unsigned int ox,
     }
 }
 
+// implemented in tinycv_frame_ring.cc
+long frame_ring_put_mat(FrameRing* ring, const Mat& frame);
+
+long frame_ring_put(FrameRing* ring, Image* s)
+{
+    return frame_ring_put_mat(ring, s->img);
+}
+
 // copy the s image into a at x,y
 void image_blend_image(Image* a, Image* s, long x, long y)
 {
+    a->pixels_changed();
     Rect roi(Point(x, y), s->img.size());
     if (s->img.rows == 0 || s->img.cols == 0)
         return;
@@ -808,6 +1110,7 @@ Vec3b VNCInfo::read_cpixel(const unsigned char* data, size_t& offset)
 long image_map_raw_data_zrle(Image* a, long x, long y, long w, long h,
     VNCInfo* info, unsigned char* data, size_t bytes)
 {
+    a->pixels_changed();
     /* ZRLE implementation is described pretty straight forward in the RFB 3.8
      * protocol */
 
@@ -0,0 +1,364 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Keeps the tiles of needle images (see needle_cache.h) limited by the number of bytes they take
+// and evicts the least recently used needles first. Needles can be prefetched on a pool of
+// background threads so they are already decoded when they are searched for the first time. If
+// enabled, tiles are taken from the shared store (see tinycv_needle_store.cc) instead of decoding
+// the needle again.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "needle_cache.h"
+#include "tinycv.h"
+#include "worker_threads.h"
+
+using namespace cv;
+
+namespace {
+
+constexpr unsigned int max_loader_threads = 4;
+
+typedef std::shared_ptr<const std::vector<needle_cache::Tile>> Tiles;
+
+struct Request {
+    std::string path;
+    std::vector<Rect> areas;
+    std::vector<Rect> excludes;
+};
+
+std::vector<Rect> to_rects(const std::vector<long>& values)
+{
+    std::vector<Rect> rects;
+    for (size_t i = 0; i + 3 < values.size(); i += 4)
+        rects.emplace_back(static_cast<int>(values[i]), static_cast<int>(values[i + 1]), static_cast<int>(values[i + 2]), static_cast<int>(values[i + 3]));
+    return rects;
+}
+
+Request to_request(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes)
+{
+    return { path, to_rects(areas), to_rects(excludes) };
+}
+
+// needles sharing the image but excluding different areas need different tiles
+std::string to_key(const Request& request)
+{
+    std::string key = request.path;
+    for (const auto& rect : request.excludes)
+        key += '\n' + std::to_string(rect.x) + ',' + std::to_string(rect.y) + ',' + std::to_string(rect.width) + ',' + std::to_string(rect.height);
+    return key;
+}
+
+bool read_file(const std::string& path, std::vector<unsigned char>& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+// decodes the image like needle::_read_image does and cuts out the areas unless they can be
+// taken from the shared store; nullptr on errors
+Tiles load(const Request& request)
+{
+    std::vector<unsigned char> encoded;
+    if (!read_file(request.path, encoded)) {
+        std::cerr << "Could not open image " << request.path << std::endl;
+        return nullptr;
+    }
+    auto tiles = std::make_shared<std::vector<needle_cache::Tile>>();
+    const auto name = needle_cache::store_name(encoded, request.areas, request.excludes);
+    if (!name.empty() && needle_cache::store_lookup(name, *tiles))
+        return tiles;
+
+    Mat image = encoded.empty() ? Mat() : imdecode(Mat(1, static_cast<int>(encoded.size()), CV_8UC1, encoded.data()), cv::IMREAD_COLOR);
+    if (!image.data) {
+        std::cerr << "Could not open image " << request.path << std::endl;
+        return nullptr;
+    }
+
+    const Rect available(Point(0, 0), image.size());
+    for (const auto& exclude : request.excludes) {
+        if ((exclude & available) != exclude) {
+            std::cerr << "ERROR - replacerect: out of range\n"
+                      << std::endl;
+            continue;
+        }
+        rectangle(image, exclude, CV_RGB(0, 255, 0), cv::FILLED);
+    }
+
+    for (const auto& area : request.areas) {
+        if (area.width <= 0 || area.height <= 0 || (area & available) != area) {
+            std::cerr << "ERROR - tile: out of range" << std::endl;
+            continue;
+        }
+        needle_cache::Tile tile;
+        const auto rect = needle_cache::tile_rect(area, available);
+        tile.area = area;
+        tile.pixels = image(rect).clone();
+        tile.origin = rect.tl();
+        tile.full_size = image.size();
+        // preprocess the whole tile so searching never needs to write into the shared pixels
+        cvtColor(tile.pixels, tile.preped, cv::COLOR_BGR2GRAY);
+        GaussianBlur(tile.preped, tile.preped, Size(3, 3), 0, 0);
+        tiles->push_back(std::move(tile));
+    }
+
+    // use the published tiles right away so also this process shares their pages
+    if (!name.empty()) {
+        needle_cache::store_publish(name, *tiles);
+        needle_cache::store_lookup(name, *tiles);
+    }
+    return tiles;
+}
+
+size_t tiles_bytes(const Tiles& tiles)
+{
+    size_t bytes = 0;
+    for (const auto& tile : *tiles)
+        bytes += tile.pixels.total() * tile.pixels.elemSize() + tile.preped.total() * tile.preped.elemSize();
+    return bytes;
+}
+
+bool find_tile(const Tiles& tiles, const Rect& area, needle_cache::Tile& result)
+{
+    for (const auto& tile : *tiles) {
+        if (tile.area == area) {
+            result = tile;
+            return true;
+        }
+    }
+    return false;
+}
+
+class NeedleCache {
+public:
+    static NeedleCache& instance()
+    {
+        static NeedleCache cache;
+        return cache;
+    }
+
+    ~NeedleCache()
+    {
+        // abandon prefetches which have not been started yet
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        work_available.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    void prefetch(Request request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto key = to_key(request);
+            auto& entry = entries[key];
+            entry.last_use = ++tick;
+            if (entry.tiles || entry.loading)
+                return;
+            entry.loading = true;
+            entry.request = std::move(request);
+            queue.push_back(std::move(key));
+            if (worker_threads::needed(workers, queue.size() + busy, max_loader_threads))
+                worker_threads::start(workers, [this] { work(); });
+        }
+        work_available.notify_one();
+    }
+
+    bool tile(Request request, const Rect& area, needle_cache::Tile& result)
+    {
+        const auto key = to_key(request);
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.loading) {
+            // load the needle right away if its prefetch has not been started yet, otherwise wait
+            const auto queued = std::find(queue.begin(), queue.end(), key);
+            if (queued != queue.end()) {
+                queue.erase(queued);
+                entries.erase(it);
+            } else {
+                loaded.wait(lock, [this, &key] {
+                    const auto entry = entries.find(key);
+                    return entry == entries.end() || !entry->second.loading;
+                });
+            }
+            it = entries.find(key);
+        }
+        if (it != entries.end() && it->second.tiles && find_tile(it->second.tiles, area, result)) {
+            it->second.last_use = ++tick;
+            return true;
+        }
+        lock.unlock();
+
+        // load the needle if it is not cached (anymore) or the area has not been cut out before
+        if (std::find(request.areas.begin(), request.areas.end(), area) == request.areas.end())
+            request.areas.push_back(area);
+        const auto tiles = load(request);
+        if (!tiles)
+            return false;
+        lock.lock();
+        store(key, tiles);
+        return find_tile(tiles, area, result);
+    }
+
+    void set_budget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict_while([this](size_t) { return total_bytes > budget; });
+    }
+
+    void trim(size_t max_entries)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        evict_while([max_entries](size_t count) { return count > max_entries; });
+    }
+
+    size_t count()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cached_entries();
+    }
+
+    size_t bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_bytes;
+    }
+
+private:
+    struct Entry {
+        Request request;
+        Tiles tiles;
+        size_t bytes = 0;
+        uint64_t last_use = 0;
+        bool loading = false;
+    };
+
+    NeedleCache() = default;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            work_available.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            const auto key = std::move(queue.front());
+            queue.pop_front();
+            // skip needles which have been loaded in the meantime via tile()
+            const auto entry = entries.find(key);
+            if (entry == entries.end() || !entry->second.loading)
+                continue;
+            const auto request = entry->second.request;
+            ++busy;
+            lock.unlock();
+            const auto tiles = load(request);
+            lock.lock();
+            --busy;
+            const auto it = entries.find(key);
+            if (it != entries.end() && it->second.loading) {
+                if (tiles) {
+                    store(key, tiles);
+                } else {
+                    entries.erase(it);
+                    loaded.notify_all();
+                }
+            }
+        }
+    }
+
+    // called with the mutex locked
+    void store(const std::string& key, const Tiles& tiles)
+    {
+        auto& entry = entries[key];
+        total_bytes -= entry.bytes;
+        entry.request = Request();
+        entry.tiles = tiles;
+        entry.bytes = tiles_bytes(tiles);
+        entry.last_use = ++tick;
+        entry.loading = false;
+        total_bytes += entry.bytes;
+        // keep the needle which has just been loaded even if it exceeds the budget on its own
+        evict_while([this](size_t count) { return count > 1 && total_bytes > budget; });
+        loaded.notify_all();
+    }
+
+    // called with the mutex locked
+    size_t cached_entries() const
+    {
+        return static_cast<size_t>(std::count_if(entries.begin(), entries.end(), [](const auto& entry) { return entry.second.tiles != nullptr; }));
+    }
+
+    // evicts the least recently used needles (except those being loaded) while the condition
+    // (called with the number of cached needles) holds; called with the mutex locked
+    template <typename Condition>
+    void evict_while(Condition condition)
+    {
+        auto count = cached_entries();
+        while (count && condition(count)) {
+            auto oldest = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->second.tiles && !it->second.loading && (oldest == entries.end() || it->second.last_use < oldest->second.last_use))
+                    oldest = it;
+            }
+            total_bytes -= oldest->second.bytes;
+            entries.erase(oldest);
+            --count;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable loaded;
+    std::unordered_map<std::string, Entry> entries;
+    std::deque<std::string> queue;
+    std::vector<std::thread> workers;
+    size_t budget = needle_cache::default_budget;
+    size_t total_bytes = 0;
+    size_t busy = 0;
+    uint64_t tick = 0;
+    bool stopping = false;
+};
+
+}
+
+bool needle_cache::tile(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes, const Rect& area, Tile& tile)
+{
+    return NeedleCache::instance().tile(to_request(path, areas, excludes), area, tile);
+}
+
+void needle_cache_prefetch(const char* path, const std::vector<long>& areas, const std::vector<long>& excludes)
+{
+    NeedleCache::instance().prefetch(to_request(path, areas, excludes));
+}
+
+void needle_cache_set_budget(size_t bytes) { NeedleCache::instance().set_budget(bytes); }
+
+void needle_cache_trim(size_t max_entries) { NeedleCache::instance().trim(max_entries); }
+
+size_t needle_cache_entries() { return NeedleCache::instance().count(); }
+
+size_t needle_cache_bytes() { return NeedleCache::instance().bytes(); }
@@ -0,0 +1,253 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Store of needle tiles on disk which can be shared by all processes on a host (e.g. the jobs of
+// a worker running tests of the same product) so each needle only needs to be decoded once.
+//
+// Files are addressed by a hash of the encoded needle image and of the areas cut out of it so
+// they never change once written. They are published by renaming a completely written temporary
+// file so readers never see partial files and need no locking. Readers map the files privately
+// and use the pixels in place so all processes share the same pages of the page cache.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "needle_cache.h"
+#include "tinycv.h"
+
+using namespace cv;
+
+namespace {
+
+constexpr char store_magic[4] = { 'O', 'A', 'N', 'S' };
+// bump when the layout of the files or the preprocessing of the tiles changes
+constexpr uint32_t store_version = 1;
+constexpr size_t store_alignment = 64;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t tile_count;
+    uint32_t reserved;
+};
+
+struct FileTile {
+    int32_t area[4];
+    int32_t origin[2];
+    int32_t full_size[2];
+    int32_t cols;
+    int32_t rows;
+    uint64_t pixels_offset;
+    uint64_t preped_offset;
+};
+
+std::mutex store_mutex;
+std::string store_dir;
+
+std::string current_store_dir()
+{
+    std::lock_guard<std::mutex> lock(store_mutex);
+    return store_dir;
+}
+
+// FNV-1a is good enough to tell needles apart and does not need another library
+class Hash {
+public:
+    void add(const void* data, size_t len)
+    {
+        const auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i)
+            value = (value ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    void add(const std::vector<Rect>& rects)
+    {
+        const auto count = static_cast<uint32_t>(rects.size());
+        add(&count, sizeof(count));
+        for (const auto& rect : rects) {
+            const int32_t values[4] = { rect.x, rect.y, rect.width, rect.height };
+            add(values, sizeof(values));
+        }
+    }
+
+    std::string hex() const
+    {
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+
+private:
+    uint64_t value = 0xcbf29ce484222325ull;
+};
+
+size_t align(size_t offset) { return (offset + store_alignment - 1) / store_alignment * store_alignment; }
+
+size_t mat_bytes(const Mat& mat) { return mat.total() * mat.elemSize(); }
+
+// copies the rows of the matrix to the buffer without any padding between them
+void put_mat(std::vector<unsigned char>& buffer, size_t offset, const Mat& mat)
+{
+    const auto row_bytes = static_cast<size_t>(mat.cols) * mat.elemSize();
+    for (int y = 0; y < mat.rows; ++y)
+        memcpy(buffer.data() + offset + static_cast<size_t>(y) * row_bytes, mat.ptr(y), row_bytes);
+}
+
+bool write_all(int fd, const std::vector<unsigned char>& buffer)
+{
+    for (size_t written = 0; written < buffer.size();) {
+        const auto res = write(fd, buffer.data() + written, buffer.size() - written);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        written += static_cast<size_t>(res);
+    }
+    return true;
+}
+
+}
+
+void needle_cache::set_store_dir(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lock(store_mutex);
+    store_dir = dir;
+}
+
+std::string needle_cache::store_name(const std::vector<unsigned char>& encoded, const std::vector<Rect>& areas, const std::vector<Rect>& excludes)
+{
+    if (current_store_dir().empty())
+        return std::string();
+    Hash hash;
+    hash.add(&store_version, sizeof(store_version));
+    hash.add(encoded.data(), encoded.size());
+    hash.add(areas);
+    hash.add(excludes);
+    return hash.hex() + ".tiles";
+}
+
+/*
+ * maps the tiles stored under the name; returns false if they have not been stored yet or the
+ * file is not valid
+ *
+ * The mapping is private so in-place modifications of the tiles only copy the affected pages
+ * like for shared images (see shared_mat_import).
+ */
+bool needle_cache::store_lookup(const std::string& name, std::vector<Tile>& tiles)
+{
+    const auto path = current_store_dir() + '/' + name;
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        return false;
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "Unable to map stored needle " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    const std::shared_ptr<void> mapping(data, [size](void* mapped) { munmap(mapped, size); });
+    const auto bytes = static_cast<unsigned char*>(data);
+
+    FileHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, store_magic, sizeof(store_magic)) || header.version != store_version
+        || header.tile_count > (size - sizeof(FileHeader)) / sizeof(FileTile)) {
+        std::cerr << "Ignoring invalid stored needle " << path << std::endl;
+        return false;
+    }
+    std::vector<Tile> result;
+    for (uint32_t i = 0; i < header.tile_count; ++i) {
+        FileTile file_tile;
+        memcpy(&file_tile, bytes + sizeof(FileHeader) + i * sizeof(FileTile), sizeof(file_tile));
+        const auto pixels = static_cast<uint64_t>(file_tile.cols) * static_cast<uint64_t>(file_tile.rows);
+        if (file_tile.cols <= 0 || file_tile.rows <= 0 || file_tile.pixels_offset % store_alignment || file_tile.preped_offset % store_alignment
+            || file_tile.pixels_offset > size || size - file_tile.pixels_offset < pixels * 3
+            || file_tile.preped_offset > size || size - file_tile.preped_offset < pixels) {
+            std::cerr << "Ignoring invalid stored needle " << path << std::endl;
+            return false;
+        }
+        Tile tile;
+        tile.area = Rect(file_tile.area[0], file_tile.area[1], file_tile.area[2], file_tile.area[3]);
+        tile.pixels = Mat(file_tile.rows, file_tile.cols, CV_8UC3, bytes + file_tile.pixels_offset);
+        tile.preped = Mat(file_tile.rows, file_tile.cols, CV_8UC1, bytes + file_tile.preped_offset);
+        tile.origin = Point(file_tile.origin[0], file_tile.origin[1]);
+        tile.full_size = Size(file_tile.full_size[0], file_tile.full_size[1]);
+        tile.mapping = mapping;
+        result.push_back(std::move(tile));
+    }
+    tiles.swap(result);
+    return true;
+}
+
+// writes the tiles under the name unless another process has been faster; errors are only logged
+// as the tiles can still be used
+void needle_cache::store_publish(const std::string& name, const std::vector<Tile>& tiles)
+{
+    const auto dir = current_store_dir();
+    if (dir.empty() || name.empty())
+        return;
+
+    auto offset = align(sizeof(FileHeader) + tiles.size() * sizeof(FileTile));
+    std::vector<FileTile> file_tiles;
+    for (const auto& tile : tiles) {
+        if (tile.pixels.type() != CV_8UC3 || tile.preped.type() != CV_8UC1 || tile.pixels.size() != tile.preped.size())
+            return;
+        FileTile file_tile = {
+            { tile.area.x, tile.area.y, tile.area.width, tile.area.height },
+            { tile.origin.x, tile.origin.y },
+            { tile.full_size.width, tile.full_size.height },
+            tile.pixels.cols,
+            tile.pixels.rows,
+            offset,
+            0,
+        };
+        offset = align(offset + mat_bytes(tile.pixels));
+        file_tile.preped_offset = offset;
+        offset = align(offset + mat_bytes(tile.preped));
+        file_tiles.push_back(file_tile);
+    }
+
+    std::vector<unsigned char> buffer(offset);
+    FileHeader header = { { store_magic[0], store_magic[1], store_magic[2], store_magic[3] }, store_version, static_cast<uint32_t>(tiles.size()), 0 };
+    memcpy(buffer.data(), &header, sizeof(header));
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        memcpy(buffer.data() + sizeof(FileHeader) + i * sizeof(FileTile), &file_tiles[i], sizeof(FileTile));
+        put_mat(buffer, file_tiles[i].pixels_offset, tiles[i].pixels);
+        put_mat(buffer, file_tiles[i].preped_offset, tiles[i].preped);
+    }
+
+    const auto path = dir + '/' + name;
+    std::string temporary_path = dir + "/." + name + ".XXXXXX";
+    const int fd = mkostemp(&temporary_path[0], O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Unable to store needle in " << dir << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    const bool written = write_all(fd, buffer) && !fchmod(fd, 0444);
+    const auto error = errno;
+    if (close(fd) || !written || rename(temporary_path.c_str(), path.c_str())) {
+        std::cerr << "Unable to store needle " << path << ": " << strerror(written ? errno : error) << std::endl;
+        unlink(temporary_path.c_str());
+    }
+}
+
+void needle_cache_set_store_dir(const char* dir) { needle_cache::set_store_dir(dir); }
@@ -0,0 +1,96 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+// seals guaranteeing that the pixels of an exported image can not change anymore
+constexpr int image_seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+/*
+ * copies the pixels of the image into a new memfd and seals it so other processes can map it
+ * without having to fear modifications; returns the memfd (owned by the caller) or -1 and
+ * describes the layout in the header as "<width> <height> <type> <stride>"
+ */
+int shared_mat_export(const Mat& image, std::string& header)
+{
+    if (image.empty())
+        return -1;
+
+    const Mat pixels = image.isContinuous() ? image : image.clone();
+    const auto stride = static_cast<size_t>(pixels.cols) * pixels.elemSize();
+    const auto size = stride * static_cast<size_t>(pixels.rows);
+    const int fd = memfd_create("os-autoinst-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        std::cerr << "Unable to create memfd for image: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    const auto data = reinterpret_cast<const char*>(pixels.data);
+    for (size_t written = 0; written < size;) {
+        const auto res = write(fd, data + written, size - written);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            std::cerr << "Unable to write image to memfd: " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        written += static_cast<size_t>(res);
+    }
+    if (fcntl(fd, F_ADD_SEALS, image_seals | F_SEAL_SEAL)) {
+        std::cerr << "Unable to seal memfd of image: " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    header = std::to_string(pixels.cols) + ' ' + std::to_string(pixels.rows) + ' ' + std::to_string(pixels.type()) + ' ' + std::to_string(stride);
+    return fd;
+}
+
+/*
+ * maps the pixels of an image exported via shared_mat_export and lets the image refer to them
+ * without copying; returns the mapping which needs to be kept as long as the image is used or
+ * nullptr if the memfd does not match the header or is not sealed
+ *
+ * The mapping is private so in-place modifications of the image are possible but only copy the
+ * affected pages. The memfd itself is sealed and therefore stays read-only for everybody.
+ */
+std::shared_ptr<void> shared_mat_import(int fd, const char* header, Mat& image)
+{
+    int width = 0, height = 0, type = -1;
+    size_t stride = 0;
+    if (sscanf(header, "%d %d %d %zu", &width, &height, &type, &stride) != 4 || width <= 0 || height <= 0
+        || type < 0 || CV_MAT_TYPE(type) != type || stride < static_cast<size_t>(width) * CV_ELEM_SIZE(type)) {
+        std::cerr << "Invalid header of shared image: " << header << std::endl;
+        return nullptr;
+    }
+    const auto seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & image_seals) != image_seals) {
+        std::cerr << "Refusing to import shared image from memfd which is not sealed" << std::endl;
+        return nullptr;
+    }
+    const auto size = stride * static_cast<size_t>(height);
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < size) {
+        std::cerr << "Shared image is smaller than announced by its header: " << header << std::endl;
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Unable to map shared image: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    image = Mat(height, width, type, mapping, stride);
+    return std::shared_ptr<void>(mapping, [size](void* data) { munmap(data, size); });
+}
@@ -0,0 +1,109 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "spectrogram.h"
+#include "tinycv.h"
+
+using namespace cv;
+
+/*
+ * renders the spectrogram of the sound file exactly like snd2png but as BGR image so it can be
+ * treated like any other image (e.g. written into the test results)
+ */
+bool sound_spectrogram_mat(const char* path, const char* wisdom_dir, Mat& image)
+{
+    Mat grayscale;
+    if (spectrogram::render(path, grayscale, 1, wisdom_dir, nullptr)) {
+        std::cerr << "Could not compute spectrogram of " << path << std::endl;
+        return false;
+    }
+    cvtColor(grayscale, image, cv::COLOR_GRAY2BGR);
+    return true;
+}
+
+/*
+ * searches the area of the needle (located at x/y within the needle) within the recording only
+ * along the time axis and returns the normalized cross-correlation of the best match (clamped to 0-1) and its column
+ *
+ * Unlike the search for image needles no blur is applied as the spectrogram is not subject to
+ * anti-aliasing. Areas without any variation (e.g. expected silence) can not be correlated so
+ * they are compared by their root-mean-square error instead.
+ */
+double sound_match_mat(const Mat& recording, const Mat& needle_area, long x, long y, long margin, long& match_x)
+{
+    match_x = x;
+    const long width = needle_area.cols, height = needle_area.rows;
+    if (width <= 0 || height <= 0 || x < 0 || y < 0 || y + height > recording.rows || x + width > recording.cols) {
+        std::cerr << "ERROR - match_sound: out of range" << std::endl;
+        return 0;
+    }
+
+    const int scene_x = std::max(0, static_cast<int>(x - margin));
+    const int scene_end = std::min(recording.cols, static_cast<int>(x + width + margin));
+    Mat scene, object;
+    cvtColor(recording(Rect(scene_x, y, scene_end - scene_x, height)), scene, cv::COLOR_BGR2GRAY);
+    cvtColor(needle_area, object, cv::COLOR_BGR2GRAY);
+    scene.convertTo(scene, CV_32F);
+    object.convertTo(object, CV_32F);
+
+    Scalar mean, deviation;
+    meanStdDev(object, mean, deviation);
+    const bool correlate = deviation[0] >= 1.0;
+
+    Mat result;
+    matchTemplate(scene, object, result, correlate ? cv::TM_CCOEFF_NORMED : cv::TM_SQDIFF);
+    double min_value = 0, max_value = 0;
+    Point min_location, max_location;
+    minMaxLoc(result, &min_value, &max_value, &min_location, &max_location);
+
+    double similarity = 0;
+    if (correlate) {
+        match_x = scene_x + max_location.x;
+        similarity = max_value;
+    } else {
+        match_x = scene_x + min_location.x;
+        similarity = 1.0 - std::sqrt(min_value / static_cast<double>(width * height)) / 255.0;
+    }
+    if (!std::isfinite(similarity))
+        return 0;
+    return std::min(1.0, std::max(0.0, similarity));
+}
+
+struct SoundTail {
+    explicit SoundTail(const char* path)
+        : live(path)
+    {
+    }
+    spectrogram::Live live;
+};
+
+SoundTail* sound_tail_new(const char* path)
+{
+    auto tail = new SoundTail(path);
+    if (!tail->live.valid()) {
+        std::cerr << "Could not open recording " << path << std::endl;
+        delete tail;
+        return nullptr;
+    }
+    return tail;
+}
+
+void sound_tail_destroy(SoundTail* tail) { delete tail; }
+
+long sound_tail_update(SoundTail* tail) { return tail->live.update(); }
+
+double sound_tail_seconds(SoundTail* tail) { return tail->live.seconds(); }
+
+void sound_tail_spectrogram_mat(SoundTail* tail, Mat& image)
+{
+    Mat grayscale;
+    tail->live.draw_image(grayscale);
+    cvtColor(grayscale, image, cv::COLOR_GRAY2BGR);
+}
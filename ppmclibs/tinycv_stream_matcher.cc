@@ -0,0 +1,835 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Incremental search for patterns within a stream of bytes (e.g. the output of a serial console)
+// which looks at every byte only once, no matter how the stream is split into chunks.
+//
+// The patterns are compiled into one NFA (Thompson construction) which is turned into a DFA
+// lazily while the stream is consumed. For literal patterns that DFA is the Aho-Corasick
+// automaton of the patterns. Regular expressions are supported as far as they can be expressed
+// as DFA. Constructs which can not (e.g. backreferences or lookarounds) make the compilation
+// fail so the caller needs to fall back to Perl's regex engine.
+//
+// For simplicity the automaton may find more matches than Perl: zero-width assertions (e.g. ^,
+// $ or \b) are ignored and all bytes outside of ASCII are considered to be part of classes like
+// \w or [[:alpha:]] which depend on the character set rules of Perl. So a match found here only
+// means that Perl might find one and the caller is supposed to run the actual regex to confirm
+// it and to determine its exact boundaries. No match found here however means that Perl would
+// not find one either. Therefore case-insensitive patterns are not supported if Perl might
+// match them via a fold to several characters (e.g. "ss" and "\xDF").
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tinycv.h"
+
+using ByteSet = std::bitset<256>;
+
+constexpr size_t max_nfa_states = 50000;
+constexpr size_t max_dfa_states = 2000;
+constexpr int max_repetitions = 1000;
+
+static ByteSet high_bytes()
+{
+    ByteSet set;
+    for (size_t c = 128; c < 256; ++c)
+        set.set(c);
+    return set;
+}
+
+static ByteSet ascii_class(int (*predicate)(int))
+{
+    ByteSet set;
+    for (size_t c = 0; c < 128; ++c)
+        if (predicate(static_cast<int>(c)))
+            set.set(c);
+    return set;
+}
+
+static int is_word(int c) { return isalnum(c) || c == '_'; }
+static int is_perl_space(int c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+static int is_horizontal_space(int c) { return c == ' ' || c == '\t'; }
+static int is_vertical_space(int c) { return c >= '\n' && c <= '\r'; }
+
+class NfaBuilder {
+public:
+    struct State {
+        ByteSet bytes; // consumes one of these bytes unless epsilon
+        bool epsilon = false;
+        bool match = false;
+        int out = -1;
+        int out1 = -1; // second epsilon transition
+    };
+
+    explicit NfaBuilder(std::vector<State>& states)
+        : states(states)
+    {
+    }
+
+    // compiles the regex and returns its start state or -1 if it is not supported
+    int compile_regex(const std::string& pattern)
+    {
+        this->pattern = pattern;
+        pos = 0;
+        failed = false;
+        auto fragment = parse_alternation(false);
+        if (failed || pos != pattern.size())
+            return -1;
+        patch(fragment, add_match());
+        return failed ? -1 : fragment.start;
+    }
+
+    int compile_literal(const std::string& literal)
+    {
+        Fragment fragment = epsilon_fragment();
+        for (const auto c : literal) {
+            ByteSet set;
+            set.set(static_cast<unsigned char>(c));
+            fragment = concat(fragment, byte_fragment(set));
+        }
+        patch(fragment, add_match());
+        return failed ? -1 : fragment.start;
+    }
+
+private:
+    // a partially built automaton; holes are the unset transitions (state * 2 + 1 for out1)
+    struct Fragment {
+        int start;
+        std::vector<int> holes;
+    };
+
+    int add_state(State state)
+    {
+        if (states.size() >= max_nfa_states) {
+            failed = true;
+            return 0;
+        }
+        states.push_back(state);
+        return static_cast<int>(states.size() - 1);
+    }
+
+    int add_match()
+    {
+        State state;
+        state.epsilon = true;
+        state.match = true;
+        return add_state(state);
+    }
+
+    void patch(const Fragment& fragment, int target)
+    {
+        if (failed)
+            return;
+        for (const auto hole : fragment.holes)
+            (hole % 2 ? states[static_cast<size_t>(hole / 2)].out1 : states[static_cast<size_t>(hole / 2)].out) = target;
+    }
+
+    Fragment epsilon_fragment()
+    {
+        State state;
+        state.epsilon = true;
+        const auto index = add_state(state);
+        return { index, { index * 2 } };
+    }
+
+    Fragment byte_fragment(const ByteSet& bytes)
+    {
+        State state;
+        state.bytes = bytes;
+        const auto index = add_state(state);
+        return { index, { index * 2 } };
+    }
+
+    Fragment concat(const Fragment& first, const Fragment& second)
+    {
+        patch(first, second.start);
+        return { first.start, second.holes };
+    }
+
+    Fragment alternate(const Fragment& first, const Fragment& second)
+    {
+        State state;
+        state.epsilon = true;
+        state.out = first.start;
+        state.out1 = second.start;
+        Fragment fragment { add_state(state), first.holes };
+        fragment.holes.insert(fragment.holes.end(), second.holes.begin(), second.holes.end());
+        return fragment;
+    }
+
+    Fragment optional(const Fragment& fragment)
+    {
+        State state;
+        state.epsilon = true;
+        state.out = fragment.start;
+        const auto index = add_state(state);
+        Fragment result { index, fragment.holes };
+        result.holes.push_back(index * 2 + 1);
+        return result;
+    }
+
+    Fragment star(const Fragment& fragment)
+    {
+        State state;
+        state.epsilon = true;
+        state.out = fragment.start;
+        const auto index = add_state(state);
+        patch(fragment, index);
+        return { index, { index * 2 + 1 } };
+    }
+
+    bool at_end() const { return pos >= pattern.size(); }
+    unsigned char peek() const { return static_cast<unsigned char>(pattern[pos]); }
+
+    ByteSet fold(ByteSet set) const
+    {
+        if (!case_insensitive)
+            return set;
+        for (size_t c = 'a'; c <= 'z'; ++c) {
+            const auto upper = static_cast<size_t>(toupper(static_cast<int>(c)));
+            if (set.test(c) || set.test(upper))
+                set.set(c).set(upper);
+        }
+        if ((set & high_bytes()).any())
+            set |= high_bytes();
+        return set;
+    }
+
+    // Perl matches "ss" and the sharp s ("\xDF") against each other if case-insensitive (and
+    // more high bytes against several characters) which a single byte can not express
+    bool multi_char_fold(const ByteSet& set) const
+    {
+        return case_insensitive && (set.test('s') || set.test('S') || (set & high_bytes()).any());
+    }
+
+    Fragment parse_alternation(bool in_group)
+    {
+        auto fragment = parse_sequence(in_group);
+        while (!failed && !at_end() && peek() == '|') {
+            ++pos;
+            fragment = alternate(fragment, parse_sequence(in_group));
+        }
+        return fragment;
+    }
+
+    Fragment parse_sequence(bool in_group)
+    {
+        auto fragment = epsilon_fragment();
+        while (!failed && !at_end() && peek() != '|' && !(in_group && peek() == ')')) {
+            const auto atom_start = pos;
+            auto atom = parse_atom();
+            if (failed)
+                break;
+            fragment = concat(fragment, parse_quantifier(atom, atom_start));
+        }
+        return fragment;
+    }
+
+    // parses "{n}", "{n,}" or "{n,m}"; returns false (leaving pos) if the brace is a literal
+    bool parse_braces(int& min, int& max)
+    {
+        const auto end = pattern.find('}', pos);
+        if (end == std::string::npos)
+            return false;
+        const auto inner = pattern.substr(pos + 1, end - pos - 1);
+        const auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+        const auto digits = [&](const std::string& s) { return !s.empty() && s.size() < 5 && std::all_of(s.begin(), s.end(), is_digit); };
+        const auto comma = inner.find(',');
+        const auto lower = inner.substr(0, comma);
+        const auto upper = comma == std::string::npos ? lower : inner.substr(comma + 1);
+        if (!digits(lower) || (!upper.empty() && !digits(upper))) {
+            // forms like "{,n}" or "{ n }" are only quantifiers for newer versions of Perl
+            if (!inner.empty() && std::all_of(inner.begin(), inner.end(), [&](char c) { return is_digit(c) || c == ',' || c == ' '; }))
+                failed = true;
+            return false;
+        }
+        min = std::stoi(lower);
+        max = upper.empty() ? -1 : std::stoi(upper);
+        pos = end + 1;
+        return true;
+    }
+
+    // parses the atom starting at the specified position again to repeat it
+    Fragment reparse_atom(size_t atom_start)
+    {
+        const auto saved_pos = pos;
+        const auto saved_flags = case_insensitive;
+        pos = atom_start;
+        auto atom = parse_atom();
+        pos = saved_pos;
+        case_insensitive = saved_flags;
+        return atom;
+    }
+
+    Fragment parse_quantifier(Fragment atom, size_t atom_start)
+    {
+        if (at_end())
+            return atom;
+        int min = 0, max = 0;
+        switch (peek()) {
+        case '*':
+            ++pos;
+            min = 0, max = -1;
+            break;
+        case '+':
+            ++pos;
+            min = 1, max = -1;
+            break;
+        case '?':
+            ++pos;
+            min = 0, max = 1;
+            break;
+        case '{':
+            if (!parse_braces(min, max))
+                return atom;
+            break;
+        default:
+            return atom;
+        }
+        // non-greedy and possessive quantifiers match the same strings
+        if (!at_end() && (peek() == '?' || peek() == '+'))
+            ++pos;
+        if (min > max_repetitions || max > max_repetitions || (max >= 0 && max < min)) {
+            failed = true;
+            return atom;
+        }
+
+        const auto after_quantifier = pos;
+        auto copy = [&](int index) { return index ? reparse_atom(atom_start) : atom; };
+        auto fragment = epsilon_fragment();
+        int copies = 0;
+        for (; copies < min && !failed; ++copies)
+            fragment = concat(fragment, copy(copies));
+        if (max < 0) {
+            fragment = concat(fragment, star(copy(copies)));
+        } else {
+            for (; copies < max && !failed; ++copies)
+                fragment = concat(fragment, optional(copy(copies)));
+        }
+        pos = after_quantifier;
+        return fragment;
+    }
+
+    // parses modifiers like "^i", "i-s" and returns false if they are not supported
+    bool parse_modifiers()
+    {
+        bool value = true;
+        if (!at_end() && peek() == '^') {
+            case_insensitive = false;
+            ++pos;
+        }
+        for (; !at_end(); ++pos) {
+            switch (peek()) {
+            case 'i':
+                case_insensitive = value;
+                break;
+            case '-':
+                value = false;
+                break;
+            case 'm':
+            case 's':
+            case 'n':
+            case 'p':
+            case 'a':
+            case 'u':
+            case 'l':
+            case 'd':
+                break;
+            default:
+                return peek() == ':' || peek() == ')';
+            }
+        }
+        return false;
+    }
+
+    Fragment parse_group()
+    {
+        const auto flags = case_insensitive;
+        if (!at_end() && peek() == '?') {
+            ++pos;
+            if (at_end()) {
+                failed = true;
+                return epsilon_fragment();
+            }
+            const auto kind = peek();
+            if (kind == '#') {
+                const auto end = pattern.find(')', pos);
+                if (end == std::string::npos)
+                    failed = true;
+                pos = end + 1;
+                return epsilon_fragment();
+            } else if (kind == ':' || kind == '>' || kind == '|') {
+                ++pos;
+            } else if (kind == '<' && pos + 1 < pattern.size() && pattern[pos + 1] != '=' && pattern[pos + 1] != '!') {
+                // named group
+                pos = pattern.find('>', pos);
+                if (pos == std::string::npos)
+                    failed = true;
+                ++pos;
+            } else if (kind == 'P' && pos + 1 < pattern.size() && pattern[pos + 1] == '<') {
+                pos = pattern.find('>', pos);
+                if (pos == std::string::npos)
+                    failed = true;
+                ++pos;
+            } else if (kind == '^' || kind == '-' || isalpha(kind)) {
+                if (!parse_modifiers()) {
+                    failed = true;
+                    return epsilon_fragment();
+                }
+                if (peek() == ')') {
+                    // modifiers apply to the rest of the enclosing group, see parse_sequence
+                    ++pos;
+                    return epsilon_fragment();
+                }
+                ++pos;
+            } else {
+                // lookarounds, conditionals, recursion and embedded code
+                failed = true;
+                return epsilon_fragment();
+            }
+        }
+        if (failed)
+            return epsilon_fragment();
+        auto fragment = parse_alternation(true);
+        if (at_end() || peek() != ')')
+            failed = true;
+        ++pos;
+        case_insensitive = flags;
+        return fragment;
+    }
+
+    // parses a character or an escape sequence within a character class; returns false for
+    // classes like \d in which case the set contains them already
+    bool parse_class_member(ByteSet& set, int& value)
+    {
+        auto c = peek();
+        ++pos;
+        if (c != '\\') {
+            value = c;
+            set.set(c);
+            return true;
+        }
+        if (at_end()) {
+            failed = true;
+            return false;
+        }
+        c = peek();
+        ++pos;
+        if (c == 'b') {
+            value = '\b';
+            set.set(static_cast<size_t>(value));
+            return true;
+        }
+        if (c >= '1' && c <= '7') {
+            --pos;
+            value = parse_octal();
+            set.set(static_cast<size_t>(value));
+            return true;
+        }
+        return parse_escape(c, set, value);
+    }
+
+    int parse_octal()
+    {
+        int value = 0;
+        for (int digits = 0; digits < 3 && !at_end() && peek() >= '0' && peek() <= '7'; ++digits, ++pos)
+            value = value * 8 + (peek() - '0');
+        if (value > 255)
+            failed = true;
+        return value & 0xff;
+    }
+
+    int parse_hex(size_t max_digits)
+    {
+        int value = 0;
+        size_t digits = 0;
+        for (; digits < max_digits && !at_end() && isxdigit(peek()); ++digits, ++pos) {
+            value = value * 16 + (isdigit(peek()) ? peek() - '0' : tolower(peek()) - 'a' + 10);
+            if (value > 255)
+                failed = true;
+        }
+        return value & 0xff;
+    }
+
+    // handles the escape sequence "\c" common to classes and atoms; sets value to -1 for sets
+    bool parse_escape(unsigned char c, ByteSet& set, int& value)
+    {
+        value = -1;
+        switch (c) {
+        case 'd':
+        case 'D':
+        case 'w':
+        case 'W':
+        case 's':
+        case 'S':
+        case 'h':
+        case 'H':
+        case 'v':
+        case 'V': {
+            const auto lower = static_cast<unsigned char>(tolower(c));
+            auto ascii = ascii_class(lower == 'd' ? isdigit : lower == 'w' ? is_word : lower == 's' ? is_perl_space : lower == 'h' ? is_horizontal_space : is_vertical_space);
+            if (isupper(c))
+                ascii = ~ascii & ~high_bytes();
+            set |= ascii | high_bytes();
+            return false;
+        }
+        case 'N':
+            if (!at_end() && peek() == '{') {
+                failed = true; // named characters
+                return false;
+            }
+            set |= ~ByteSet().set('\n');
+            return false;
+        case 'p':
+        case 'P':
+            // Unicode properties, just accept all bytes
+            if (!at_end() && peek() == '{') {
+                pos = pattern.find('}', pos);
+                if (pos == std::string::npos)
+                    failed = true;
+            }
+            ++pos;
+            set.set();
+            return false;
+        case 't':
+            value = '\t';
+            break;
+        case 'n':
+            value = '\n';
+            break;
+        case 'r':
+            value = '\r';
+            break;
+        case 'f':
+            value = '\f';
+            break;
+        case 'e':
+            value = 0x1b;
+            break;
+        case 'a':
+            value = 0x07;
+            break;
+        case '0':
+            --pos;
+            value = parse_octal();
+            break;
+        case 'o':
+            if (at_end() || peek() != '{') {
+                failed = true;
+                return false;
+            }
+            ++pos;
+            value = parse_octal();
+            if (at_end() || peek() != '}')
+                failed = true;
+            ++pos;
+            break;
+        case 'x':
+            if (!at_end() && peek() == '{') {
+                ++pos;
+                value = parse_hex(8);
+                if (at_end() || peek() != '}')
+                    failed = true;
+                ++pos;
+            } else {
+                value = parse_hex(2);
+            }
+            break;
+        case 'c':
+            if (at_end()) {
+                failed = true;
+                return false;
+            }
+            value = toupper(peek()) ^ 64;
+            ++pos;
+            break;
+        default:
+            // other letters and digits have special meanings (e.g. backreferences or \X)
+            if (isalnum(c)) {
+                failed = true;
+                return false;
+            }
+            value = c;
+        }
+        set.set(static_cast<unsigned char>(value));
+        return true;
+    }
+
+    bool parse_posix_class(ByteSet& set)
+    {
+        const auto end = pattern.find(":]", pos);
+        if (end == std::string::npos)
+            return false;
+        auto name = pattern.substr(pos + 2, end - pos - 2);
+        const bool negated = !name.empty() && name[0] == '^';
+        if (negated)
+            name.erase(0, 1);
+        static const std::map<std::string, int (*)(int)> classes = {
+            { "alpha", isalpha },
+            { "digit", isdigit },
+            { "alnum", isalnum },
+            { "space", is_perl_space },
+            { "upper", isupper },
+            { "lower", islower },
+            { "punct", ispunct },
+            { "xdigit", isxdigit },
+            { "word", is_word },
+            { "blank", is_horizontal_space },
+            { "cntrl", iscntrl },
+            { "print", isprint },
+            { "graph", isgraph },
+        };
+        const auto it = classes.find(name);
+        if (it == classes.end()) {
+            failed = true;
+            return true;
+        }
+        auto ascii = ascii_class(it->second);
+        if (negated)
+            ascii = ~ascii & ~high_bytes();
+        set |= ascii | high_bytes();
+        pos = end + 2;
+        return true;
+    }
+
+    Fragment parse_class()
+    {
+        ByteSet set;
+        const bool negated = !at_end() && peek() == '^';
+        if (negated)
+            ++pos;
+        bool first = true;
+        bool exact = true;
+        while (!failed && !at_end() && (first || peek() != ']')) {
+            first = false;
+            if (peek() == '[' && pos + 1 < pattern.size() && pattern[pos + 1] == ':' && parse_posix_class(set)) {
+                exact = false;
+                continue;
+            }
+            int from = 0;
+            if (!parse_class_member(set, from)) {
+                exact = false;
+                continue;
+            }
+            if (pos + 1 < pattern.size() && peek() == '-' && pattern[pos + 1] != ']') {
+                ++pos;
+                int to = 0;
+                ByteSet ignored;
+                if (!parse_class_member(ignored, to)) {
+                    set |= ignored.set('-');
+                    exact = false;
+                    continue;
+                }
+                if (to < from)
+                    failed = true;
+                for (int c = from; c <= to && !failed; ++c)
+                    set.set(static_cast<size_t>(c));
+            }
+        }
+        if (at_end())
+            failed = true;
+        ++pos;
+        if (exact && !negated && multi_char_fold(set))
+            failed = true;
+        if (case_insensitive && (set & high_bytes()).any())
+            exact = false;
+        set = fold(set);
+        if (negated)
+            set = ~set;
+        // only the ASCII part of classes like \w is exact, see the comment at the top
+        return byte_fragment(exact ? set : (set & ~high_bytes()) | high_bytes());
+    }
+
+    Fragment parse_atom()
+    {
+        const auto c = peek();
+        ++pos;
+        switch (c) {
+        case '(':
+            return parse_group();
+        case '[':
+            return parse_class();
+        case '.':
+            return byte_fragment(ByteSet().set());
+        case '^':
+        case '$':
+            return epsilon_fragment();
+        case '*':
+        case '+':
+        case '?':
+        case ')':
+            failed = true;
+            return epsilon_fragment();
+        case '\\': {
+            if (at_end()) {
+                failed = true;
+                return epsilon_fragment();
+            }
+            const auto escaped = peek();
+            ++pos;
+            // zero-width assertions
+            if (escaped == 'b' || escaped == 'B' || escaped == 'A' || escaped == 'z' || escaped == 'Z' || escaped == 'G' || escaped == 'K') {
+                if (escaped == 'b' && !at_end() && peek() == '{') {
+                    pos = pattern.find('}', pos);
+                    if (pos == std::string::npos)
+                        failed = true;
+                    ++pos;
+                }
+                return epsilon_fragment();
+            }
+            ByteSet set;
+            int value = 0;
+            if (parse_escape(escaped, set, value) && multi_char_fold(set))
+                failed = true;
+            return byte_fragment(fold(set));
+        }
+        default:
+            if (multi_char_fold(ByteSet().set(c)))
+                failed = true;
+            return byte_fragment(fold(ByteSet().set(c)));
+        }
+    }
+
+    std::vector<State>& states;
+    std::string pattern;
+    size_t pos = 0;
+    // modifiers like (?i) apply until the end of the enclosing group, see parse_group
+    bool case_insensitive = false;
+    bool failed = false;
+};
+
+struct StreamMatcher {
+    std::vector<NfaBuilder::State> nfa;
+    int start = -1;
+
+    // lazily built DFA; each DFA state is the set of NFA states reached so far
+    std::map<std::vector<int>, size_t> dfa_ids;
+    std::vector<std::vector<int>> dfa_sets;
+    std::vector<std::array<int, 256>> transitions;
+    std::vector<bool> dfa_matches;
+    std::vector<int> initial;
+    size_t current = 0;
+    bool fed = false;
+
+    // adds the state and all states reachable from it via epsilon transitions
+    void add_closure(int index, std::vector<bool>& seen, std::vector<int>& set) const
+    {
+        std::vector<int> stack { index };
+        while (!stack.empty()) {
+            const auto s = stack.back();
+            stack.pop_back();
+            if (s < 0 || seen[static_cast<size_t>(s)])
+                continue;
+            seen[static_cast<size_t>(s)] = true;
+            set.push_back(s);
+            const auto& state = nfa[static_cast<size_t>(s)];
+            if (state.epsilon) {
+                stack.push_back(state.out1);
+                stack.push_back(state.out);
+            }
+        }
+    }
+
+    size_t dfa_state(std::vector<int> set)
+    {
+        std::sort(set.begin(), set.end());
+        const auto it = dfa_ids.find(set);
+        if (it != dfa_ids.end())
+            return it->second;
+        const auto id = dfa_sets.size();
+        dfa_matches.push_back(std::any_of(set.begin(), set.end(), [this](int s) { return nfa[static_cast<size_t>(s)].match; }));
+        dfa_ids.emplace(set, id);
+        dfa_sets.push_back(std::move(set));
+        std::array<int, 256> unknown;
+        unknown.fill(-1);
+        transitions.push_back(unknown);
+        return id;
+    }
+
+    size_t step(size_t state, unsigned char byte)
+    {
+        // the search is unanchored so a match can start at every byte
+        std::vector<bool> seen(nfa.size());
+        std::vector<int> next;
+        add_closure(start, seen, next);
+        for (const auto s : dfa_sets[state]) {
+            const auto& nfa_state = nfa[static_cast<size_t>(s)];
+            if (!nfa_state.epsilon && nfa_state.bytes.test(byte))
+                add_closure(nfa_state.out, seen, next);
+        }
+
+        if (dfa_sets.size() >= max_dfa_states) {
+            // start over instead of using more and more memory for rarely needed states
+            const auto current_set = dfa_sets[state];
+            dfa_ids.clear();
+            dfa_sets.clear();
+            transitions.clear();
+            dfa_matches.clear();
+            dfa_state(initial);
+            state = dfa_state(current_set);
+        }
+        const auto id = dfa_state(std::move(next));
+        transitions[state][byte] = static_cast<int>(id);
+        return id;
+    }
+
+    void reset()
+    {
+        std::vector<bool> seen(nfa.size());
+        initial.clear();
+        add_closure(start, seen, initial);
+        current = dfa_state(initial);
+    }
+
+    long feed(const unsigned char* data, size_t len)
+    {
+        // patterns matching the empty string match before anything has been consumed
+        long match_end = !fed && dfa_matches[current] ? 0 : -1;
+        fed = true;
+        for (size_t i = 0; i < len; ++i) {
+            const auto next = transitions[current][data[i]];
+            current = next < 0 ? step(current, data[i]) : static_cast<size_t>(next);
+            if (match_end < 0 && dfa_matches[current])
+                match_end = static_cast<long>(i + 1);
+        }
+        return match_end;
+    }
+};
+
+StreamMatcher* stream_matcher_new(const std::vector<std::string>& patterns, bool literal)
+{
+    auto matcher = new StreamMatcher;
+    NfaBuilder builder(matcher->nfa);
+    for (const auto& pattern : patterns) {
+        const auto start = literal ? builder.compile_literal(pattern) : builder.compile_regex(pattern);
+        if (start < 0) {
+            delete matcher;
+            return nullptr;
+        }
+        if (matcher->start < 0) {
+            matcher->start = start;
+            continue;
+        }
+        NfaBuilder::State split;
+        split.epsilon = true;
+        split.out = matcher->start;
+        split.out1 = start;
+        matcher->nfa.push_back(split);
+        matcher->start = static_cast<int>(matcher->nfa.size() - 1);
+    }
+    if (matcher->start < 0) {
+        delete matcher;
+        return nullptr;
+    }
+    matcher->reset();
+    return matcher;
+}
+
+void stream_matcher_destroy(StreamMatcher* matcher) { delete matcher; }
+
+long stream_matcher_feed(StreamMatcher* matcher, const unsigned char* data, size_t len) { return matcher->feed(data, len); }
@@ -0,0 +1,146 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Writes images into files on a pool of background threads so callers (e.g. the test process
+// saving screenshots for the results) do not have to wait for the PNG compression.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "worker_threads.h"
+
+using namespace cv;
+
+constexpr unsigned int max_writer_threads = 4;
+
+// -1 means the default of OpenCV
+static std::atomic<int> png_compression(-1);
+
+std::vector<int> mat_write_params()
+{
+    const auto level = png_compression.load();
+    if (level < 0)
+        return std::vector<int>();
+    return { IMWRITE_PNG_COMPRESSION, level };
+}
+
+void set_png_compression(int level) { png_compression = std::min(level, 9); }
+
+// writes the image and returns an error message if that is not possible
+static std::string write_mat(const std::string& filename, const Mat& image)
+{
+    try {
+        if (!imwrite(filename, image, mat_write_params()))
+            return "Unable to write '" + filename + "'";
+    } catch (const std::exception& e) {
+        return "Could not write image '" + filename + "': " + e.what();
+    }
+    return std::string();
+}
+
+class ImageWriter {
+public:
+    static ImageWriter& instance()
+    {
+        static ImageWriter writer;
+        return writer;
+    }
+
+    ~ImageWriter()
+    {
+        // write what has been queued before the process exits normally
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    void enqueue(std::function<std::string()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+            if (worker_threads::needed(workers, tasks.size() + busy, max_writer_threads))
+                worker_threads::start(workers, [this] { work(); });
+        }
+        work_available.notify_one();
+    }
+
+    std::vector<std::string> flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [this] { return tasks.empty() && !busy; });
+        std::vector<std::string> result;
+        result.swap(errors);
+        return result;
+    }
+
+private:
+    ImageWriter() = default;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            work_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            ++busy;
+            lock.unlock();
+            auto error = task();
+            lock.lock();
+            --busy;
+            if (!error.empty())
+                errors.push_back(std::move(error));
+            if (tasks.empty() && !busy)
+                work_done.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    std::deque<std::function<std::string()>> tasks;
+    std::vector<std::thread> workers;
+    std::vector<std::string> errors;
+    size_t busy = 0;
+    bool stopping = false;
+};
+
+/*
+ * queues writing the image and a thumbnail of it scaled to the specified height (skipped if
+ * thumbnail_height is 0); both are encoded in parallel
+ *
+ * The pixels are shared so the caller needs to pass a copy if it modifies the image in place.
+ */
+void write_mat_async(const Mat& image, const std::string& filename, const std::string& thumbnail_filename, long thumbnail_height)
+{
+    auto& writer = ImageWriter::instance();
+    writer.enqueue([image, filename] { return write_mat(filename, image); });
+    if (thumbnail_height <= 0 || image.empty())
+        return;
+    writer.enqueue([image, thumbnail_filename, thumbnail_height] {
+        const auto height = static_cast<int>(thumbnail_height);
+        Mat thumbnail;
+        resize(image, thumbnail, Size(std::max(1, static_cast<int>(image.cols * thumbnail_height / image.rows)), height));
+        return write_mat(thumbnail_filename, thumbnail);
+    });
+}
+
+std::vector<std::string> write_mat_flush() { return ImageWriter::instance().flush(); }
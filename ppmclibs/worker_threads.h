@@ -0,0 +1,46 @@
+// Copyright SUSE LLC
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Helpers for the pools of background threads used by tinycv (see tinycv_writer.cc and
+// tinycv_needle_cache.cc). Workers are only started once there is more work than running workers,
+// up to a limit and the number of CPUs. They run with all signals blocked so signals are still
+// handled by the (Perl) main thread.
+
+#ifndef WORKER_THREADS_H
+#define WORKER_THREADS_H
+
+#include <algorithm>
+#include <csignal>
+#include <cstddef>
+#include <pthread.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace worker_threads {
+
+// returns whether another worker should be started for the specified number of queued and running tasks
+inline bool needed(const std::vector<std::thread>& workers, size_t tasks, unsigned int max_threads)
+{
+    return workers.size() < std::min(max_threads, std::max(1u, std::thread::hardware_concurrency())) && workers.size() < tasks;
+}
+
+// starts a worker running the specified function with all signals blocked
+template <typename Function>
+void start(std::vector<std::thread>& workers, Function&& function)
+{
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    try {
+        workers.emplace_back(std::forward<Function>(function));
+    } catch (...) {
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        throw;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+}
+
+#endif
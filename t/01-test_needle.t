@@ -12,10 +12,14 @@ use File::Basename;
 use File::Path 'make_path';
 use File::Temp qw(tempdir);
 use Mojo::File qw(path);
+use Mojo::JSON qw(decode_json encode_json);
+use Digest::MD5 'md5_hex';
+use Test::MockModule;
 
 BEGIN {
     $bmwqemu::vars{DISTRI} = 'unicorn';
     $bmwqemu::vars{CASEDIR} = '/var/lib/empty';
+    $bmwqemu::vars{NEEDLE_INDEX_DIR} = '';
 }
 
 use needle;
@@ -329,27 +333,76 @@ subtest 'similarity and image cache' => sub {
 
     my $needle = needle->new('other-desktop-dvd-20140904.json');
     $needle->{png} = $data_dir . 'other-desktop-dvd-20140904.test.png';
-    my $cached_img = $needle->get_image;
+    my $area = $needle->{area}->[0];
+    my $cached_img = $needle->get_image($area);
     ok defined $cached_img, 'image returned';
     is needle::image_cache_size, 1, 'cache size increased';
-    is $needle->get_image, $cached_img, 'cached image returned on next call';
-
-    my $img_area = $needle->get_image($needle->{area}->[0]);
-    ok $img_area != $cached_img, 'different image returned when get_image with area';
+    my $tile_bytes = ($area->{width} + 2) * ($area->{height} + 2) * 4;
+    is_deeply [tinycv::needle_cache_usage()], [1, $tile_bytes], 'only tile of area with border cached (with grayscale)';
+    is $cached_img->xres, $area->{width} + 2, 'tile of area with border returned (x)';
+    is $cached_img->yres, $area->{height} + 2, 'tile of area with border returned (y)';
+    ok $needle->get_image($area)->similarity($cached_img) > 50, 'cached image returned on next call';
+    is needle::image_cache_size, 1, 'cache size not increased on next call';
+
+    my $whole_img = $needle->get_image;
+    ok $whole_img != $cached_img, 'different image returned when get_image without area';
+    is $whole_img->xres, 1024, 'whole image returned without area';
+    is needle::image_cache_size, 1, 'whole image not cached';
 
     my $json_hash = $needle->TO_JSON;
     is $json_hash->{name}, 'other-desktop-dvd-20140904', 'TO_JSON serialization';
 
     my $other_needle = needle->new('xorg_vt-Xorg-20140729.json');
     $other_needle->{png} = $data_dir . 'xorg_vt-Xorg-20140729.test.png';
-    my $other_img = $other_needle->get_image;
-    ok $other_img != $cached_img, 'different image returned for other needle instance';
+    my $other_area = $other_needle->{area}->[0];
+    my $other_img = $other_needle->get_image($other_area);
+    is $other_img->xres, $other_area->{width} + 2, 'tile for area of other needle returned';
     is needle::image_cache_size, 2, 'cache size increased to 2';
 
     needle::clean_image_cache(1);
     is needle::image_cache_size, 1, 'cleaning cache to keep 1 image';
-    is $other_needle->get_image, $other_img, 'most recently used cached image still exists';
-    ok $needle->get_image != $cached_img, 'old cached image was deleted';
+    ok $other_needle->get_image($other_area), 'most recently used cached image still exists';
+    is needle::image_cache_size, 1, 'most recently used image not loaded again';
+    ok $needle->get_image($area), 'old cached image loaded again';
+    is needle::image_cache_size, 2, 'old cached image was deleted';
+
+    subtest 'budget' => sub {
+        tinycv::set_needle_cache_budget($tile_bytes);
+        is needle::image_cache_size, 1, 'least recently used image dropped to stay within budget';
+        ok $other_needle->get_image($other_area), 'image exceeding budget on its own still returned';
+        is needle::image_cache_size, 1, 'only most recently used image kept';
+        tinycv::set_needle_cache_budget(256 * 1024 * 1024);
+    };
+
+    subtest 'prefetch' => sub {
+        needle::clean_image_cache;
+        is needle::image_cache_size, 0, 'image cache completely cleaned by default';
+        needle::prefetch_images([$needle, $other_needle]);
+        ok $needle->get_image($area), 'prefetched image returned';
+        ok $other_needle->get_image($other_area), 'other prefetched image returned';
+        is needle::image_cache_size, 2, 'both images cached';
+    };
+
+    subtest 'shared needle store' => sub {
+        my $store_dir = tempdir(CLEANUP => 1);
+        local $bmwqemu::vars{NEEDLE_STORE_DIR} = "$store_dir/needles";
+        tinycv::set_needle_store_dir(needle::store_dir);
+        needle::clean_image_cache;
+        my $tile = $needle->get_image($area);
+        my @stored = glob "$store_dir/needles/*";
+        is scalar @stored, 1, 'tiles of needle published to store' or always_explain \@stored;
+        like $stored[0], qr{/[0-9a-f]{16}\.tiles$}, 'tiles stored under content address';
+        is((stat $stored[0])[2] & 0222, 0, 'stored tiles are read-only');
+
+        needle::clean_image_cache;
+        my $stored_tile = $needle->get_image($area);
+        is $stored_tile->xres, $tile->xres, 'tile taken from store has same size';
+        ok $stored_tile->similarity($tile) > 50, 'tile taken from store has same pixels';
+        my $res = tinycv::read($needle->{png})->search($needle);
+        ok $res->{ok}, 'needle found via tiles taken from store';
+        is scalar(() = glob "$store_dir/needles/*"), 1, 'no further files stored';
+        tinycv::set_needle_store_dir('');
+    };
 };
 
 subtest 'initialization variants' => sub {
@@ -386,6 +439,51 @@ subtest 'initialization variants' => sub {
         local $bmwqemu::vars{PRODUCTDIR} = 'boo/products/boo';
         throws_ok { needle::init } qr/Can't init needles from boo\/products\/boo\/needles;.*\/tmp\/foo\/boo\/products\/boo\/needles/, 'combine CASEDIR when the default needles directory is a relative path';
     };
+
+    subtest 'needle index' => sub {
+        my $index_dir = tempdir(CLEANUP => 1);
+        my $needles_dir = tempdir(CLEANUP => 1);
+        for my $name (qw(click-point test_tag1)) {
+            path($misc_needles_dir, "$name.$_")->copy_to("$needles_dir/$name.$_") for qw(json png);
+        }
+        local $bmwqemu::vars{NEEDLES_DIR} = $needles_dir;
+        local $bmwqemu::vars{NEEDLE_INDEX_DIR} = $index_dir;
+        my $parsed = 0;
+        my $needle_mock = Test::MockModule->new('needle');
+        $needle_mock->redefine(new => sub (@args) { $parsed++; $needle_mock->original('new')->(@args) });
+
+        needle_init;
+        is $parsed, 2, 'all needles parsed initially';
+        my $index_file = "$index_dir/needles-" . md5_hex($needles_dir) . '.index';
+        ok -f $index_file, 'index written';
+        $parsed = 0;
+        needle_init;
+        is $parsed, 0, 'no needles parsed again';
+        is_deeply [sort keys %needle::needles], [qw(click-point test_tag1)], 'needles loaded from index';
+        is_deeply needle::tags('tag2'), [$needle::needles{test_tag1}], 'needles from index registered';
+        is $needle::needles{'click-point'}->{png}, "$needles_dir/click-point.png", 'image path loaded from index';
+
+        my $json = path($needles_dir, 'test_tag1.json');
+        my $data = decode_json($json->slurp);
+        push @{$data->{tags}}, 'tag4';
+        $json->spew(encode_json($data));
+        needle_init;
+        is $parsed, 1, 'only changed needle parsed';
+        ok $needle::needles{test_tag1}->has_tag('tag4'), 'change of needle taken into account';
+
+        $parsed = 0;
+        unlink "$needles_dir/click-point.json";
+        needle_init;
+        is $parsed, 0, 'no needles parsed after removal';
+        is_deeply [keys %needle::needles], ['test_tag1'], 'removed needle not loaded from index';
+
+        my $other_index_dir = tempdir(CLEANUP => 1);
+        path($other_index_dir, basename $index_file)->spew('garbage');
+        local $bmwqemu::vars{NEEDLE_INDEX_DIR} = $other_index_dir;
+        needle_init;
+        is $parsed, 1, 'needles parsed if index is not readable';
+        is_deeply [keys %{Storable::retrieve("$other_index_dir/" . basename $index_file)->{needles}}], ["$needles_dir/test_tag1.json"], 'broken index replaced';
+    };
 };
 
 subtest 'click point' => sub {
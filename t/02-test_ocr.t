@@ -15,6 +15,7 @@ BEGIN {
     $bmwqemu::vars{DISTRI} = 'unicorn';
     $bmwqemu::vars{CASEDIR} = '/var/lib/empty';
     $bmwqemu::vars{NEEDLES_DIR} = dirname(__FILE__) . '/data';
+    $bmwqemu::vars{NEEDLE_INDEX_DIR} = '';
 }
 
 use needle;
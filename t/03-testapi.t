@@ -45,6 +45,7 @@ my $fake_timeout = 0;
 my $fake_similarity = 42;
 my $fake_is_configured_to_pause_on_timeout = 0;
 my @fake_extra_responses;
+my $fake_audio_checks = 0;
 
 # define 'write_with_thumbnail' to fake image
 sub write_with_thumbnail (@) { }
@@ -108,6 +109,10 @@ sub fake_read_json ($fd) {
     elsif ($cmd eq 'backend_start_audiocapture') {
         return {ret => 0};
     }
+    elsif ($cmd eq 'backend_check_audiocapture') {
+        return {ret => {}} if ++$fake_audio_checks < 3;
+        return {ret => {found => {needle => 'foo', similarity => 0.98, seconds => 1.5}}};
+    }
     elsif ($cmd eq 'is_configured_to_pause_on_timeout') {
         return {ret => $fake_is_configured_to_pause_on_timeout};
     }
@@ -454,6 +459,7 @@ is match_has_tag('foo'), undef, 'match_has_tag returns undef if no needle has ma
 my $dummy_image = b64_encode(path("$Bin/data/frame2.ppm")->slurp);
 
 subtest 'handle found needle' => sub {
+    local $bmwqemu::vars{NEEDLE_INDEX_DIR} = '';    # avoid writing the needle index into the real cache
     needle::init("$Bin/data");
     my %needle = (name => 'frame2', area => [{}], tags => ['foo']);
     my %match = (similarity => 1, x => 0, y => 5, w => 10, h => 20, result => 'ok');
@@ -1390,15 +1396,43 @@ lives_ok { reset_consoles } 'reset_consoles can be called';
 
 subtest 'assert/check recorded sound' => sub {
     $cmds = [];
+    local $bmwqemu::vars{SND2PNG_WISDOM_DIR} = '';
     lives_ok { start_audiocapture } 'start_audiocapture can be called';
     like $cmds->[0]->{filename}, qr/captured\.wav/, 'audiocapture started with expected args' or always_explain $cmds;
-    my $mock_testapi = Test::MockModule->new('testapi');
-    $mock_testapi->noop('_snd2png');
-    $mock_basetest->noop('verify_sound_image');
+    my @verify_args;
+    $mock_basetest->redefine(verify_sound_image => sub ($self, @args) { @verify_args = @args; 1 });
     ok assert_recorded_sound('foo'), 'assert_recorded_sound can be called';
     dies_ok { check_record_sound('foo') } 'second evaluation of the same recording is rejected';
     lives_ok { start_audiocapture } 'start_audiocapture can be called for a second recording';
     ok check_recorded_sound('foo'), 'check_recorded_sound can be called';
+    like $verify_args[3], qr/captured\.wav$/, 'recording passed to compute its spectrogram natively' or always_explain \@verify_args;
+    is $fake_audio_checks, 0, 'recording not analysed while recording without timeout';
+
+    my $mock_testapi = Test::MockModule->new('testapi');
+    my @sleeps;
+    $mock_testapi->redefine(sleep => sub ($seconds) { push @sleeps, $seconds });
+    lives_ok { start_audiocapture } 'start_audiocapture can be called for a recording checked while recording';
+    $cmds = [];
+    ok assert_recorded_sound('foo', timeout => 10), 'assert_recorded_sound can be called with timeout';
+    is $fake_audio_checks, 3, 'recording analysed until sound found';
+    is_deeply \@sleeps, [0.5, 0.5], 'waited between the checks';
+    is_deeply [map { $_->{cmd} } @$cmds], [(qw(backend_check_audiocapture) x 3), qw(backend_stop_audiocapture)], 'capture stopped after sound found' or always_explain $cmds;
+    $fake_audio_checks = -100;
+    @sleeps = ();
+    lives_ok { start_audiocapture } 'start_audiocapture can be called again';
+    ok check_recorded_sound('foo', timeout => 2), 'check_recorded_sound checks recording after timeout';
+    is $fake_audio_checks, -95, 'recording only analysed until timeout';
+    is scalar @sleeps, 5, 'waited until timeout';
+    $mock_testapi->unmock('sleep');
+
+    my $cache_dir = File::Temp->newdir;
+    local $ENV{XDG_CACHE_HOME} = "$cache_dir";
+    is testapi::_snd2png_wisdom_dir, "$cache_dir/os-autoinst", 'FFTW wisdom is cached within XDG_CACHE_HOME by default';
+    ok -d "$cache_dir/os-autoinst", 'directory for FFTW wisdom created';
+    local $bmwqemu::vars{SND2PNG_WISDOM_DIR} = "$cache_dir/wisdom";
+    is testapi::_snd2png_wisdom_dir, "$cache_dir/wisdom", 'directory for FFTW wisdom configurable';
+    $bmwqemu::vars{SND2PNG_WISDOM_DIR} = '';
+    is testapi::_snd2png_wisdom_dir, undef, 'caching FFTW wisdom can be disabled';
 };
 
 lives_ok { power('on') } 'power can be called';
@@ -82,10 +82,12 @@ $mock_bmwqemu->redefine(stop_vm => sub { $vm_stopped = 1 });
 subtest 'load_test && run_all' => sub {
     my $mock_autotest = Test::MockModule->new('autotest', no_auto => 1);
     $mock_autotest->noop('_terminate');
-    my ($died, $completed);
+    my ($died, $completed, $flushed_before_done);
+    local *tinycv::flush_writes = sub () { $flushed_before_done = !grep { ref $_ eq 'HASH' && $_->{cmd} eq 'tests_done' } @sent };
     like warning {
         stderr_like { autotest::run_all } qr/Sending tests_done/, 'tests_done sent';
     }, qr/ERROR: no tests loaded/, 'run_all outputs status on stderr';
+    ok $flushed_before_done, 'pending screenshots written before tests_done is sent';
 
     ($died, $completed) = get_tests_done;
     is $died, 1, 'run_all with no tests should catch runalltests dying';
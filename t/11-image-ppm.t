@@ -8,6 +8,7 @@ use Test::Warnings ':report_warnings';
 
 use File::Basename;
 use File::Path qw(make_path remove_tree);
+use File::Temp 'tempdir';
 use Cwd;
 use OpenQA::Benchmark::Stopwatch;
 use cv;
@@ -27,6 +28,52 @@ my $img2 = tinycv::from_ppm($ppm);
 
 is 1_000_000, $img1->similarity($img2);
 
+subtest 'lossless QOI encoding' => sub {
+    my $qoi = $img1->qoi_data;
+    is substr($qoi, 0, 4), 'qoif', 'is a QOI image';
+    ok length($qoi) < length($ppm) / 5, 'QOI is much smaller than PPM' or diag length $qoi;
+    my $decoded = tinycv::from_ppm($qoi);
+    is $decoded->xres, 1024, 'width preserved';
+    is $decoded->similarity($img1), 1_000_000, 'decoded image equals original';
+    my $photo = tinycv::read($data_dir . 'bootmenu.test.png');
+    is tinycv::from_ppm($photo->qoi_data)->similarity($photo), 1_000_000, 'image with gradients preserved';
+    is tinycv::from_ppm('qoif' . "\0" x 20), undef, 'invalid QOI header refused';
+};
+
+subtest 'encodings are kept until the image changes' => sub {
+    my $img = $img1->copy;
+    my $qoi = $img->qoi_data;
+    is $img->qoi_data, $qoi, 'same encoding returned again';
+    is $img->ppm_data, $ppm, 'PPM encoding available as well';
+    like $img->png_data, qr/^\x89PNG/, 'PNG encoding available as well';
+    $img->replacerect(0, 0, 10, 10);
+    isnt $img->qoi_data, $qoi, 'encoding updated after modification in place';
+    is tinycv::from_ppm($img->qoi_data)->similarity($img), 1_000_000, 'updated encoding matches modified image';
+    is $img1->qoi_data, $qoi, 'encoding of original image not affected';
+};
+
+subtest 'compact images' => sub {
+    my $compact = $img1->compact;
+    is ref $compact, 'tinycv::CompactImage', 'compact image created';
+    is $compact->qoi_data, $img1->qoi_data, 'QOI data available without encoding again';
+    is $compact->xres, 1024, 'width preserved';
+    is $compact->similarity($img1), 1_000_000, 'compared to full image';
+    is $compact->similarity($img1->scale(512, 384)), 0, 'image of different size not similar';
+    is $compact->expand->similarity($img1), 1_000_000, 'expanded image equals original';
+};
+
+subtest 'write in background' => sub {
+    my $dir = tempdir(CLEANUP => 1);
+    $img1->write_with_thumbnail("$dir/test-$_.png") for 1 .. 3;
+    lives_ok { tinycv::flush_writes() } 'writes flushed';
+    is tinycv::read("$dir/test-$_.png")->similarity($img1), 1_000_000, "image $_ written" for 1 .. 3;
+    is tinycv::read("$dir/.thumbs/test-3.png")->yres, 45, 'thumbnail written';
+    tinycv::set_png_compression(0);
+    $img1->write("$dir/uncompressed.png");
+    tinycv::set_png_compression(-1);
+    ok -s "$dir/uncompressed.png" > -s "$dir/test-1.png", 'compression level configurable';
+};
+
 throws_ok { $img1->write_with_thumbnail('/tmp/does-not-exist/test.png') } qr/Unable to write.*test\.png/, 'dies when image cannot be written';
 
 throws_ok { $img1->write_with_thumbnail('/tmp/does-not-exist/test') } qr/Could not write.*test/, 'dies when OpenCV error occurs';
@@ -35,6 +35,9 @@ $ENV{OS_AUTOINST_GIT_RETRY_COUNT} = 0;
 
 $ENV{OS_AUTOINST_STORAGE_KEEP_FREE_RATIO} = 0;
 
+# keep the needle index and other caches within the temporary directory
+$ENV{XDG_CACHE_HOME} = "$dir/cache";
+
 sub isotovideo (%args) {
     $args{default_opts} //= 'backend=null';
     $args{opts} //= '';
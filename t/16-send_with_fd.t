@@ -56,6 +56,30 @@ POSIX::close($afd);
 wait;
 ok 0 == $?, 'Child process exited cleanly';
 
+subtest 'pass image via sealed memfd' => sub {
+    my $image = tinycv::read("$Bin/data/bootmenu.test.png");
+    my ($fd, $header) = $image->export_fd;
+    ok defined $fd, 'image exported' or return;
+    is $header, join(' ', $image->xres, $image->yres, 16, $image->xres * 3), 'header describes layout';
+
+    socketpair(my $sender, my $receiver, AF_UNIX, SOCK_STREAM, AF_UNSPEC) || die "Could not make socket pair: $!";
+    ok 0 < tinycv::send_with_fd($sender, $header, $fd), 'memfd sent';
+    POSIX::close($fd);
+    my ($received_header, $received_fd) = tinycv::recv_with_fd($receiver, 64);
+    is $received_header, $header, 'header received';
+    ok $received_fd >= 0, 'memfd received';
+
+    my $imported = tinycv::import_fd($received_fd, $received_header);
+    ok $imported, 'image imported' or return POSIX::close($received_fd);
+    is $imported->similarity($image), 1_000_000, 'imported image equals exported one';
+    $imported->replacerect(0, 0, 10, 10);
+    isnt $imported->similarity($image), 1_000_000, 'imported image modified';
+    my $unchanged = tinycv::import_fd($received_fd, $received_header);
+    POSIX::close($received_fd);
+    is $unchanged->similarity($image), 1_000_000, 'modifying imported image does not affect the shared pixels';
+    is tinycv::import_fd(0, '1 1 16 3'), undef, 'importing from file which is not a sealed memfd refused';
+};
+
 done_testing();
 
 1;
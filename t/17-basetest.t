@@ -524,6 +524,10 @@ subtest verify_sound_image => sub {
     $res = $test->verify_sound_image("$FindBin::Bin/data/frame1.ppm", "$FindBin::Bin/data/frame2.ppm", 0);
     is $details->{result}, 'fail', 'no needle match: status fail' or always_explain $details;
     is $details->{overall}, 'fail', 'no needle match: overall fail' or always_explain $details;
+    ok !exists $cmds->[-1]->{wavfile}, 'no recording passed to backend by default' or always_explain $cmds->[-1];
+    $test->verify_sound_image('captured.wav.png', 'foo', 1, '/results/captured.wav', '/cache');
+    my %expected = (wavfile => '/results/captured.wav', wisdom_dir => '/cache');
+    is_deeply {map { $_ => $cmds->[-1]->{$_} } keys %expected}, \%expected, 'recording passed to backend to compute spectrogram' or always_explain $cmds->[-1];
 };
 
 $mock_bmwqemu->noop('diag', 'modstate');
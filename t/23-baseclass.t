@@ -13,7 +13,6 @@ use Test::Warnings qw(:all :report_warnings);
 use Net::SSH2 'LIBSSH2_ERROR_EAGAIN';
 use Mojo::File qw(path tempfile);
 use Mojo::JSON 'decode_json';
-use MIME::Base64 'decode_base64';
 use Digest::SHA 'sha256_hex';
 use backend::baseclass;
 use POSIX qw(tzset pause _exit);
@@ -328,6 +327,11 @@ subtest 'SSH utilities' => sub {
         stdout_is { $exit_value = $baseclass->check_ssh_serial($ssh->sock()) } $expect_output, 'Serial output is printed to STDOUT';
         is path($baseclass->{serialfile})->slurp(), $expect_output, 'Serial output is written to serial file';
         is $exit_value, 1, 'Check return value on success';
+        my $serial_log = $baseclass->{serial_log};
+        $channel_read_string = 'BAR';
+        stdout_is { $baseclass->check_ssh_serial($ssh->sock()) } 'BAR', 'further serial output is printed to STDOUT';
+        is path($baseclass->{serialfile})->slurp(), $expect_output . 'BAR', 'further serial output is appended to serial file';
+        is $baseclass->{serial_log}, $serial_log, 'serial file is kept open';
 
         $channel_read_string = undef;
         @net_ssh2_error = (LIBSSH2_ERROR_EAGAIN, 'EAGAIN', 'Try later');
@@ -436,6 +440,7 @@ subtest '_write_buffered_data_to_file_handle offset writes' => sub {
     is $fh->{written}, $first_buffer . $second_buffer, 'full byte stream reassembled in order, losslessly, across multiple calls';
     is_deeply $baseclass->{select_read}->{removed}, [$fh], 'file handle removed from select_read once queue drained';
     is_deeply $baseclass->{select_write}->{removed}, [$fh], 'file handle removed from select_write once queue drained';
+    is $baseclass->{video_frame_data_bytes}, 0, 'writes of other queues not accounted to queued video frame data';
 };
 
 subtest 'video-encoder' => sub {
@@ -749,6 +754,7 @@ subtest 'corner cases of do_capture/run_capture_loop' => sub {
 };
 
 subtest 'auto-detection of external video encoder' => sub {
+    $baseclass_mock->redefine(_built_in_video_codecs => sub () { qw(theora) });
     ok defined backend::baseclass::_ffmpeg_banner, 'ffmpeg banner is always defined (might be an empty string, though)';
     $baseclass_mock->redefine(_ffmpeg_banner => "--enable-encoder='libsvtav1,libvpx_vp9'");    # not supposed to match
     ok !$baseclass->_start_external_video_encoder_if_configured, 'external video encoder not used if SVT-AV1/VP9 not available';
@@ -756,6 +762,15 @@ subtest 'auto-detection of external video encoder' => sub {
     like $baseclass->_auto_detect_external_video_encoder, qr/^ffmpeg.*ppm.*yuv420p.*libsvtav1/, 'SVT-AV1 preferably used if available';
     $baseclass_mock->redefine(_ffmpeg_banner => '--enable-libvpx');
     like $baseclass->_auto_detect_external_video_encoder, qr/^ffmpeg.*ppm.*yuv420p.*libvpx-vp9/, 'VP9 used as 2nd option if available';
+
+    $baseclass_mock->redefine(_built_in_video_codecs => sub () { qw(theora vp9 av1) });
+    $baseclass->{video_encoders} = {};
+    is $baseclass->_start_external_video_encoder_if_configured, 'av1', 'built-in AV1 encoder preferred over ffmpeg';
+    is $baseclass->{built_in_webm_codec}, 'av1', 'codec for built-in video encoder remembered';
+    is_deeply $baseclass->{video_encoders}, {}, 'no external video encoder started';
+    $baseclass_mock->redefine(_built_in_video_codecs => sub () { qw(theora vp9) });
+    is $baseclass->_start_external_video_encoder_if_configured, 'vp9', 'built-in VP9 encoder used as 2nd option';
+    $baseclass_mock->unmock('_built_in_video_codecs');
 };
 
 subtest 'starting external video encoder and enqueuing screenshot data for it' => sub {
@@ -799,6 +814,92 @@ subtest 'starting external video encoder and enqueuing screenshot data for it' =
     is scalar @$image_data, 2, 'further image data enqueued for external encoder';
 };
 
+subtest 'enqueuing screenshots via frame ring' => sub {
+    my $baseclass = backend::baseclass->new();
+    $baseclass->{select_read} = OpenQA::NamedIOSelect->new;
+    $baseclass->{select_write} = OpenQA::NamedIOSelect->new;
+    pipe my $encoder_pipe_r, $baseclass->{encoder_pipe};
+    open $baseclass->{vtt_caption_file}, '>', tempfile;
+    my $frame_ring = $baseclass->{video_frame_ring} = tinycv::new_frame_ring(2, 1024, 768);
+    ok $frame_ring, 'frame ring created' or return;
+    is $frame_ring->stride, 1024 * 3, 'rows of 1024 pixels need no padding';
+
+    my @images = map { tinycv::read("$Bin/data/$_") } qw(bootmenu.test.png console.test.png);
+    $baseclass->enqueue_screenshot($images[$_ % 2]) for 0 .. 1;
+    my $frames = $baseclass->{video_frame_data};
+    is $frames->[0], "F 0 1024 768 3072\n", 'first frame passed via ring slot, fully converted';
+    like $frames->[1], qr/^F 1 1024 768 3072 32:[0-9a-f]{192}\n\z/, 'further frame passed via ring slot with changed tiles';
+    unlike $frames->[1], qr/ 32:0+\n/, 'changed tiles marked';
+    is $frame_ring->pending, 2, 'both slots pending until released by the encoder';
+
+    $baseclass->enqueue_screenshot($images[0]);
+    like $frames->[-2], qr/^E \d+ 32:[0-9a-f]{192}\n\z/, 'image passed if the ring is full, with changed tiles';
+    is substr($frames->[-1], 0, 4), 'qoif', 'image passed as QOI';
+    is $frame_ring->pending, 2, 'no further slot taken';
+    is $frame_ring->put(tinycv::new(2, 2)), -1, 'frame of wrong size rejected';
+
+    is $images[0]->changed_tiles($images[0]->copy, 32), '0' x 192, 'no tiles changed between equal images';
+    is $images[0]->changed_tiles(tinycv::new(2, 2), 32), '', 'images of different size not compared';
+    my $changed = tinycv::new(40, 40);
+    $changed->replacerect(35, 0, 2, 2);
+    is tinycv::new(40, 40)->changed_tiles($changed, 32), '02', 'change within the 2nd tile of the 1st row marked';
+};
+
+subtest 'merging queued frames if the video encoder falls behind' => sub {
+    my $baseclass = backend::baseclass->new();
+    my $image_data = 'P6' . ('x' x (400 * 1024));
+    my $queue_image = sub { $baseclass->_queue_video_frame_data('E ' . length($image_data) . "\n", $image_data) };
+    $baseclass->{encoder_pipe} = my $encoder_pipe = FakeShortWriteFh->new(3);
+    $baseclass->{select_read} = RecordingSelect->new;
+    $baseclass->{select_write} = RecordingSelect->new;
+    $baseclass->{video_frame_number} = 10;
+    local $bmwqemu::vars{VIDEO_ENCODER_QUEUE_LIMIT} = 1;
+
+    $queue_image->();
+    $baseclass->_queue_video_frame_data("R\n");
+    $queue_image->();
+    is $baseclass->_limit_video_frame_data, 0, 'nothing merged below the limit';
+    $baseclass->_write_buffered_data_to_file_handle('Encoder', $baseclass->{video_frame_data}, $encoder_pipe);
+    $queue_image->();
+    $baseclass->_queue_video_frame_data("F 0 1024 768 3072 32:ff\n");
+    $queue_image->();
+
+    combined_like { is $baseclass->_limit_video_frame_data, 2, 'two frames merged' } qr/Video encoder is not keeping up, merged 2/, 'warning logged';
+    my @commands = map { substr $_, 0, 2 } @{$baseclass->{video_frame_data}};
+    is_deeply \@commands, ['E ', 'P6', "R\n", "R\n", "R\n", 'F ', 'E ', 'P6'], 'partially written frame kept, all but newest PPM image replaced by repeats'
+      or always_explain \@commands;
+    is $baseclass->{video_frame_data}->[5], "F 0 1024 768 3072\n", 'changed tiles dropped after merged frames';
+    is $baseclass->{video_frame_data_bytes}, 2 * (length($image_data) + 9) + 3 * 2 + 18 - 3, 'queued bytes updated';
+
+    $baseclass->{video_frame_ring} = tinycv::new_frame_ring(1, 1024, 768);
+    $queue_image->() for 1 .. 2;
+    combined_like { $baseclass->_limit_video_frame_data } qr/\(10 frames behind\), merged 2/, 'lag of encoder logged';
+    local $bmwqemu::vars{VIDEO_ENCODER_QUEUE_LIMIT} = 0;
+    $queue_image->() for 1 .. 4;
+    is $baseclass->_limit_video_frame_data, 0, 'nothing merged if limit disabled';
+};
+
+subtest 'reading statistics of the video encoder' => sub {
+    my $baseclass = backend::baseclass->new();
+    is $baseclass->_read_video_encoder_stats, 0, 'nothing read without statistics pipe';
+    pipe $baseclass->{video_encoder_stats_pipe}, my $stats_writer;
+    $baseclass->{video_encoder_stats_pipe}->blocking(0);
+    $stats_writer->autoflush(1);
+
+    my $stats = '{"frames_in":5,"frames_out":4,"repeats":7,"pipe_bytes":12,"ring_pending":2,"convert":{"count":5,"p50":1.5,"p90":2,"p99":3,"max":3},"encode":{"count":0}}';
+    print $stats_writer "$stats\nno json\n{\"frames_in\":";
+    my $count;
+    combined_like { $count = $baseclass->_read_video_encoder_stats } qr/Video encoder statistics: \{"frames_in":5.*Unable to parse statistics of video encoder: no json/s, 'statistics logged, invalid line reported';
+    is $count, 1, 'one complete line read';
+    is $baseclass->{video_encoder_stats}->{repeats}, 7, 'latest statistics kept';
+    print $stats_writer "6}\n";
+    combined_like { $count = $baseclass->_read_video_encoder_stats } qr/statistics: \{"frames_in":6\}/, 'incomplete line completed';
+    is $count, 1, 'line read once complete';
+
+    is backend::baseclass::_format_video_encoder_stats(decode_json($stats)),
+      'frames in/out/repeated: 5/4/7, pending: 12 bytes and 2 ring slots, convert p50/p90/max: 1.5/2.0/3.0 ms', 'statistics summarized';
+};
+
 subtest 'adjusting pipe size for external video encoder ' => sub {
     my $cleanup_res = scope_guard sub {
         $bmwqemu::vars{XRES} = undef;
@@ -882,29 +983,26 @@ subtest 'bouncer functions' => sub {
 };
 
 subtest 'reduce to biggest changes' => sub {
-    my $dummy_img = tinycv::new(1, 1);
+    my $dummy_img = tinycv::new(1, 1)->compact;
     my @imglist = (
-        # image, failed candidates (not used by this function so we just assign string), test time, similarity, frame (also not used)
-        [$dummy_img, 'img 1', 5, 500, $dummy_img],
-        [$dummy_img, 'img 2', 6, 900, $dummy_img],
-        [$dummy_img, 'img 3', 7, 800, $dummy_img],
-        [$dummy_img, 'img 4', 8, 950, $dummy_img],
-        [$dummy_img, 'img 5', 1, 700, $dummy_img],
-        [$dummy_img, 'img 6', 2, 950, $dummy_img],
-        [$dummy_img, 'img 7', 3, 850, $dummy_img],
+        # image, failed candidates (not used by this function so we just assign string), test time, similarity to previous image, frame (also not used)
+        [$dummy_img, 'img 1', 8, 29, $dummy_img],
+        [$dummy_img, 'img 2', 7, 40, $dummy_img],
+        [$dummy_img, 'img 3', 6, 20, $dummy_img],
+        [$dummy_img, 'img 4', 5, 35, $dummy_img],
+        [$dummy_img, 'img 5', 4, 25, $dummy_img],
+        [$dummy_img, 'img 6', 3, 1_000_000, $dummy_img],
+        [$dummy_img, 'img 7', 2, 10, $dummy_img],
     );
-    my @expected = (
-        [$dummy_img, 'img 4', 8, 950, $dummy_img],    # images sorted by test time and similarity (as 2nd criteria) in descending order
-        [$dummy_img, 'img 3', 7, 1_000_000, $dummy_img],    # similarity of images (after the top one) recomputes (so we just get 1000000 for our dummies)
-        [$dummy_img, 'img 2', 6, 1_000_000, $dummy_img],
-        [$dummy_img, 'img 1', 5, 1_000_000, $dummy_img],    # first image preserved despite lowest similarity (so 2nd lowest is removed instead)
-        [$dummy_img, 'img 7', 3, 1_000_000, $dummy_img],
-        [$dummy_img, 'img 6', 2, 1_000_000, $dummy_img],
-    );
-    backend::baseclass::_reduce_to_biggest_changes(\@imglist, 5);    # pass limit of 5, we actually keep 6 images as the first one doesn't count
-    is_deeply \@imglist, \@expected, 'images reduced as expected' or always_explain \@imglist;
-
-    # note: This test has been added retrospectively assuming the implementation was correct at this point.
+    backend::baseclass::_reduce_to_biggest_changes(\@imglist, 4);    # pass limit of 4, we actually keep 5 images as the first one doesn't count
+    is_deeply [map { $_->[1] } @imglist], ['img 1', 'img 2', 'img 4', 'img 5', 'img 6'], 'images with the lowest similarity removed, first image preserved'
+      or always_explain \@imglist;
+    is_deeply [map { $_->[3] } @imglist[0, 1, 3, 4]], [29, 40, 25, 1_000_000], 'similarity of images following a kept image unchanged';
+    is sprintf('%.2f', $imglist[2]->[3]), '18.58', 'similarity of image following a removed image estimated from both similarities';
+
+    is backend::baseclass::_combined_similarity(1_000_000, 30), 30, 'equal images do not change the estimation';
+    is backend::baseclass::_combined_similarity(1_000_000), 1_000_000, 'only equal images stay equal';
+    is backend::baseclass::_combined_similarity(0, 30), 0, 'incomparable images stay incomparable';
 };
 
 subtest 'stub functions' => sub {
@@ -922,6 +1020,37 @@ subtest 'verifying image' => sub {
     my $tinycv_mock = Test::MockModule->new('tinycv')->redefine(read => $fake_image);
     my $ok_res = $baseclass->verify_image({imgpath => "$Bin/imgsearch/kde-logo.png", mustmatch => 0});
     is_deeply $ok_res, {found => 1, candidates => [qw(foo bar)]}, 'image found (mocked search)' or always_explain $ok_res;
+
+    my (@written, @sound_args);
+    $fake_image->mock(write => sub ($self, $path) { push @written, $path; 1 });
+    $fake_image->mock(search_sound => sub ($self, $needles) { (undef, [qw(baz)]) });
+    $tinycv_mock->redefine(read_sound => sub (@args) { @sound_args = @args; $fake_image });
+    my $sound_res = $baseclass->verify_image({imgpath => 'captured.wav.png', mustmatch => 0, wavfile => 'captured.wav', wisdom_dir => '/cache'});
+    is_deeply $sound_res, {candidates => [qw(baz)]}, 'spectrogram of recording searched (mocked search)' or always_explain $sound_res;
+    is_deeply \@sound_args, [qw(captured.wav /cache)], 'spectrogram computed from recording' or always_explain \@sound_args;
+    is_deeply \@written, [qw(captured.wav.png)], 'spectrogram written for the results' or always_explain \@written;
+    $tinycv_mock->redefine(read_sound => undef);
+    throws_ok { $baseclass->verify_image({imgpath => 'x.png', mustmatch => 0, wavfile => 'captured.wav'}) } qr/Unable to compute spectrogram/, 'error if spectrogram can not be computed';
+};
+
+subtest 'checking audio capture while recording' => sub {
+    is_deeply $baseclass->check_audiocapture({mustmatch => 'foo'}), {}, 'nothing found without audio capture';
+
+    my $windows = 0;
+    my $found;
+    my $fake_spectrogram = Test::MockObject->new->mock(search_sound => sub ($self, $needles) { $found });
+    my $fake_tail = Test::MockObject->new->mock(update => sub ($self) { $windows })->mock(seconds => sub ($self) { 1.5 });
+    $fake_tail->mock(spectrogram => sub ($self) { $fake_spectrogram });
+    my $tinycv_mock = Test::MockModule->new('tinycv')->redefine(new_sound_tail => $fake_tail);
+    local $baseclass->{audiocapture_file} = 'captured.wav';
+    is_deeply $baseclass->check_audiocapture({mustmatch => 'foo'}), {}, 'nothing found without new samples';
+    is $baseclass->{audiocapture_tail}, $fake_tail, 'recording analysed incrementally';
+    $windows = 10;
+    is_deeply $baseclass->check_audiocapture({mustmatch => 'foo'}), {}, 'nothing found without matching needle';
+    $found = {needle => {name => 'sound'}, area => [{similarity => 0.98}]};
+    my $res = $baseclass->check_audiocapture({mustmatch => 'foo'});
+    is_deeply $res, {found => {needle => 'sound', similarity => 0.98, seconds => 1.5}}, 'needle found' or always_explain $res;
+    delete $baseclass->{audiocapture_tail};
 };
 
 subtest 'retrying assert screen' => sub {
@@ -949,6 +1078,7 @@ subtest 'special cases when checking socket' => sub {
 };
 
 subtest 'special cases of set_tags_to_assert' => sub {
+    local $bmwqemu::vars{NEEDLE_INDEX_DIR} = '';    # avoid writing the needle index into the real cache
     combined_like { needle::init("$Bin/data") } qr/loaded \d+ needles/, 'needles loaded';
 
     subtest 'invalid tags passed' => sub {
@@ -982,7 +1112,7 @@ subtest 'serialize failed screens according to screen-check mode' => sub {
     sub image ($index, $similarity = 49) {
         return Test::MockObject->new
           ->set_always(similarity => $similarity)
-          ->set_always(ppm_data => "image-$index");
+          ->set_always(qoi_data => "image-$index");
     }
 
     for my $check (0, 1) {
@@ -993,7 +1123,7 @@ subtest 'serialize failed screens according to screen-check mode' => sub {
         $baseclass->assert_screen_fails([[image(1), 'candidates-1', 0, 1000, 1]]);
         my $single = $baseclass->_failed_screens_to_json;
         is scalar @{$single->{failed_screens}}, 1, "single failure preserved for check=$check";
-        is decode_base64($single->{failed_screens}->[0]->{image}), 'image-1', "single image preserved for check=$check";
+        is myjsonrpc::attachment_data($single->{failed_screens}->[0]->{image}), 'image-1', "single image preserved for check=$check";
         is_deeply $baseclass->assert_screen_fails, [], "failure images released for check=$check";
     }
 
@@ -1008,14 +1138,14 @@ subtest 'serialize failed screens according to screen-check mode' => sub {
     is_deeply [map { $_->{frame} } @{$assert_response->{failed_screens}}], \@expected_frames, 'assert mode retains failure ordering';
     is_deeply [map { $_->{candidates} } @{$assert_response->{failed_screens}}],
       [map { "candidates-$_" } @expected_frames], 'assert mode retains candidates';
-    is_deeply [map { sha256_hex(decode_base64($_->{image})) } @{$assert_response->{failed_screens}}],
+    is_deeply [map { sha256_hex(myjsonrpc::attachment_data($_->{image})) } @{$assert_response->{failed_screens}}],
       [map { sha256_hex("image-$_") } @expected_frames], 'assert mode retains screenshot contents';
 
     $baseclass->assert_screen_check(1);
     $baseclass->assert_screen_fails([map { [@$_] } @failures]);
     my $check_response = $baseclass->_failed_screens_to_json;
     is_deeply $check_response->{failed_screens}, [$assert_response->{failed_screens}->[-1]], 'check mode retains the post-reduction final mismatch only';
-    is_deeply [map { sha256_hex(decode_base64($_->{image})) } @{$check_response->{failed_screens}}],
+    is_deeply [map { sha256_hex(myjsonrpc::attachment_data($_->{image})) } @{$check_response->{failed_screens}}],
       [sha256_hex('image-23')], 'retained check screenshot has the expected content';
     is_deeply $baseclass->assert_screen_fails, [], 'reduced failure images released after serialization';
 
@@ -1040,8 +1170,8 @@ subtest 'serialize failed screens according to screen-check mode' => sub {
 subtest 'timeout response metadata and images' => sub {
     local $log::logger = Mojo::Log->new(level => 'error');
     my $timeout_backend = backend::baseclass->new;
-    my $previous = Test::MockObject->new->set_always(ppm_data => 'previous-image')->set_always(similarity => 49);
-    my $timeout_image = Test::MockObject->new->set_list(search => undef, [])->set_always(ppm_data => 'timeout-image');
+    my $previous = Test::MockObject->new->set_always(qoi_data => 'previous-image')->set_always(similarity => 49);
+    my $timeout_image = Test::MockObject->new->set_list(search => undef, [])->set_always(qoi_data => 'timeout-image');
     $baseclass_mock->redefine(_time_to_assert_screen_deadline => -1);
     $timeout_backend->last_image($timeout_image);
     my $mock_needle = Test::MockObject->new;
@@ -1057,9 +1187,9 @@ subtest 'timeout response metadata and images' => sub {
         $timeout_backend->stall_detected(1);
         my $response = $timeout_backend->check_asserted_screen({});
         is $response->{stall}, 1, "stall metadata preserved for check=$check";
-        is decode_base64($response->{image}), 'timeout-image', "top-level timeout image preserved for check=$check";
+        is myjsonrpc::attachment_data($response->{image}), 'timeout-image', "top-level timeout image preserved for check=$check";
         is scalar @{$response->{failed_screens}}, $check ? 1 : 2, "mode-appropriate failure evidence returned for check=$check";
-        is decode_base64($response->{failed_screens}->[-1]->{image}), 'timeout-image', "final mismatch preserved for check=$check";
+        is myjsonrpc::attachment_data($response->{failed_screens}->[-1]->{image}), 'timeout-image', "final mismatch preserved for check=$check";
         is $response->{failed_screens}->[-1]->{frame}, 42, "final frame preserved for check=$check";
     }
     $baseclass_mock->redefine(_time_to_assert_screen_deadline => 2 * backend::baseclass::FULL_UPDATE_REQUEST_FREQUENCY);
@@ -1070,7 +1200,7 @@ subtest 'check_asserted_screen takes too long' => sub {
             splice @$failed_screens, $limit;
     });
     $baseclass->assert_screen_last_check(undef);
-    $baseclass->assert_screen_fails([1 .. 60, [tinycv::new(1, 1), 'img 1', 5, 500, tinycv::new(1, 1)]]);
+    $baseclass->assert_screen_fails([1 .. 60, [tinycv::new(1, 1)->compact, 'img 1', 5, 500, 42]]);
     combined_like { $baseclass->check_asserted_screen({}) } qr/check_asserted_screen took .* seconds for 2 candidate needles - make your needles more specific/, 'warning logged if check_asserted_screen takes too long';
     is ref $baseclass->assert_screen_last_check->[0], 'tinycv::Image', 'assert_screen_last_check assigned';
     is scalar @{$baseclass->assert_screen_fails}, 20, 'assert screen fails cleaned up';
@@ -1099,6 +1229,25 @@ subtest 'do_capture timeout corner cases' => sub {
     is $ret_timed_out, 0, 'do_capture returns 0 when timed out';
 };
 
+subtest 'do_capture stops when the serial file is written to' => sub {
+    pipe my $watch, my $writer or die "Unable to create pipe: $!";
+    syswrite $writer, 'x';
+    my $drained = 0;
+    my $tail_mock = Test::MockModule->new('OpenQA::FileTail');
+    $tail_mock->redefine(drain => sub ($self) { $drained++ });
+    my $now = Time::HiRes::gettimeofday;
+    local $baseclass->{cmdpipe} = 1;
+    local $baseclass->{_wait_screen_change};
+    local $baseclass->{serial_watch} = $watch;
+    local $baseclass->{select_read} = OpenQA::NamedIOSelect->new;
+    local $baseclass->{select_write} = OpenQA::NamedIOSelect->new;
+    $baseclass->{select_read}->add($watch, 'baseclass::serial_watch');
+    $baseclass->last_screenshot($now);
+    $baseclass->last_update_request($now);
+    is $baseclass->do_capture({}, 10, $now), 0, 'capture loop stopped';
+    is $drained, 1, 'modification events consumed';
+};
+
 subtest 'bouncer methods forwarding' => sub {
     my $mock_screen = Test::MockObject->new;
     $mock_screen->set_always(send_key => 'key_sent');
@@ -1186,7 +1335,7 @@ subtest '_time_to_assert_screen_deadline' => sub {
 subtest 'check_asserted_screen when needle is found' => sub {
     my $mock_image = Test::MockObject->new();
     $mock_image->mock(search => sub { return ('found_needle_obj', ['failed_candidate']) });
-    $mock_image->mock(ppm_data => sub { return 'fake_ppm_data' });
+    $mock_image->mock(qoi_data => sub { return 'fake_qoi_data' });
 
     $baseclass->last_image($mock_image);
     $baseclass->assert_screen_needles([]);
@@ -1201,7 +1350,7 @@ subtest 'check_asserted_screen when needle is found' => sub {
     my $res = $baseclass->check_asserted_screen({});
     ok $reset_called, '_reset_asserted_screen_check_variables called';
     is_deeply $res, {
-        image => MIME::Base64::encode_base64('fake_ppm_data'),
+        image => myjsonrpc::attachment('fake_qoi_data'),
         found => 'found_needle_obj',
         candidates => ['failed_candidate'],
         frame => undef,
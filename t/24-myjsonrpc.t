@@ -104,6 +104,46 @@ subtest 'handling interleaved commands' => sub {
     close $sub_isotovideo;
 };
 
+subtest 'binary attachments' => sub {
+    my ($sub_child, $sub_isotovideo);
+    socketpair $sub_child, $sub_isotovideo, AF_UNIX, SOCK_STREAM, PF_UNSPEC;
+    $sub_child->autoflush(1);
+    $sub_isotovideo->autoflush(1);
+
+    my $binary = join('', map { chr } 0 .. 255) x 16 . "\n";
+    my $msg = {image => myjsonrpc::attachment($binary), list => [myjsonrpc::attachment(''), 'text'], json_cmd_token => 'token-A'};
+
+    ok !myjsonrpc::peer_accepts_attachments($sub_isotovideo), 'attachments not used before peer announced support';
+    myjsonrpc::send_json($sub_isotovideo, $msg);
+    my $read = myjsonrpc::read_json($sub_child);
+    is ref $read->{image}, '', 'attachment sent as base64 string to peer not known to support attachments';
+    is myjsonrpc::attachment_data($read->{image}), $binary, 'data of base64 string returned';
+    ok !exists $read->{json_accepts_attachments}, 'announcement not returned as part of the message';
+
+    ok myjsonrpc::peer_accepts_attachments($sub_child), 'support announced by peer';
+    myjsonrpc::send_json($sub_child, {cmd => 'request'});
+    myjsonrpc::read_json($sub_isotovideo);
+    ok myjsonrpc::peer_accepts_attachments($sub_isotovideo), 'support announced by other peer';
+    myjsonrpc::send_json($sub_isotovideo, $msg);
+    myjsonrpc::send_json($sub_isotovideo, $send2);
+    $read = myjsonrpc::read_json($sub_child, 'token-A');
+    isa_ok $read->{image}, 'myjsonrpc::Attachment', 'attachment received';
+    is myjsonrpc::attachment_data($read->{image}), $binary, 'binary data of attachment preserved';
+    is myjsonrpc::attachment_data($read->{list}->[0]), '', 'empty attachment preserved';
+    is $read->{list}->[1], 'text', 'other data preserved';
+    is_deeply myjsonrpc::read_json($sub_child), $send2, 'subsequent message read after attachments';
+
+    my ($in, $out);
+    socketpair $in, $out, AF_UNIX, SOCK_STREAM, PF_UNSPEC;
+    myjsonrpc::pair_channels($sub_child, $out);
+    ok myjsonrpc::peer_accepts_attachments($out), 'support applies to paired channel';
+
+    close $_ for $in, $out, $sub_child, $sub_isotovideo;
+    socketpair $sub_child, $sub_isotovideo, AF_UNIX, SOCK_STREAM, PF_UNSPEC;
+    ok !myjsonrpc::peer_accepts_attachments($sub_child), 'support not assumed for new peer reusing the file descriptor';
+    close $_ for $sub_child, $sub_isotovideo;
+};
+
 my $io_select_mock = Test::MockModule->new('IO::Select');
 $io_select_mock->redefine(can_read => undef);
 throws_ok { myjsonrpc::read_json($isotovideo) } qr/Illegal seek/, 'error exception raised when reading is aborted';
@@ -8,6 +8,11 @@ use FindBin '$Bin';
 use lib "$Bin/../external/os-autoinst-common/lib";
 use OpenQA::Test::TimeLimit '5';
 use consoles::serial_screen;
+use bmwqemu ();
+use cv;
+
+cv::init();
+require tinycv;
 
 my $screen = consoles::serial_screen->new('read', 'write');
 is $screen->{fd_write}, 'write', 'Check if channel was set for write fd';
@@ -24,4 +29,50 @@ dies_ok { $screen->send_key({key => 'space'}) } 'send_key dies for most keys';
 is $screen->current_screen, 0, 'no current screen';
 is $screen->request_screen_update, undef, 'can call request_screen_update';
 
+subtest 'streaming matcher' => sub {
+    my $matcher = tinycv::new_stream_matcher(['(?^:log(in|out): $)']);
+    is $matcher->feed('Welcome to '), -1, 'no match yet';
+    is $matcher->feed('the system. lo'), -1, 'no match for incomplete pattern';
+    is $matcher->feed('gin: and more'), 5, 'offset after match spanning chunks returned';
+    is $matcher->feed('nothing'), -1, 'no further match';
+
+    $matcher = tinycv::new_stream_matcher(['(?^i:error|fail(ed|ure)?)']);
+    is $matcher->feed('all good, '), -1, 'no match for case-insensitive alternatives';
+    is $matcher->feed('FAILED'), 4, 'first possible match end reported';
+
+    $matcher = tinycv::new_stream_matcher(['$ ', '# '], 1);
+    is $matcher->feed('foo$'), -1, 'no match for literals';
+    is $matcher->feed(' # '), 1, 'literal found';
+
+    $matcher = tinycv::new_stream_matcher(['(?^:^foo$)']);
+    is $matcher->feed("bar foo\n"), 7, 'anchors are treated as possible match, confirmed by Perl';
+
+    is tinycv::new_stream_matcher(['(?^:(a)\1)']), undef, 'back references are not supported';
+    is tinycv::new_stream_matcher(['(?^:(?<=a)b)']), undef, 'lookarounds are not supported';
+    is tinycv::new_stream_matcher(['(?^ui:ss)']), undef, 'case-insensitive patterns which might match a sharp s are not supported';
+    is tinycv::new_stream_matcher(['(?^ui:\xDF)']), undef, 'case-insensitive patterns with high bytes are not supported';
+};
+
+subtest 'read_until with streaming matcher' => sub {
+    pipe my $read, my $write or die "Unable to create pipe: $!";
+    $write->autoflush(1);
+    my $screen = consoles::serial_screen->new($read, $write);
+    print $write "booting\nlogin: ";
+    is_deeply $screen->read_until(qr/login: $/, 1), {matched => 1, string => "booting\nlogin: "}, 'match found';
+    print $write "foo\n# bar";
+    is $screen->read_until('# ', 1, no_regex => 1, exclude_match => 1), "foo\n", 'literal found';
+    is $screen->{carry_buffer}, 'bar', 'remaining data carried over';
+    print $write "x" x 5000;
+    my $res = $screen->read_until(qr/bar/, 1, buffer_size => 1024);
+    ok $res->{matched}, 'match found in carry buffer';
+    is $screen->{carry_buffer}, '', 'carry buffer consumed';
+    $res = $screen->read_until(qr/^x{10}$/, 0.1, buffer_size => 1024);
+    ok !$res->{matched}, 'no match within timeout';
+    is length $res->{string}, 1024, 'ring buffer returned';
+    print $write "\nprompt> ";
+    is_deeply $screen->read_until([qr/prompt> /, qr/other/], 1), {matched => 1, string => 'x' x 1015 . "\nprompt> "}, 'combined regexes found in ring buffer';
+    print $write "\xDF";
+    is_deeply $screen->read_until(qr/ss/i, 1), {matched => 1, string => "\xDF"}, 'case-insensitive match of "ss" against sharp s found';
+};
+
 done_testing;
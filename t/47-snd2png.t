@@ -10,6 +10,7 @@ use lib "$Bin/../external/os-autoinst-common/lib";
 use OpenQA::Test::TimeLimit '5';
 use Mojo::Base -signatures;
 use Mojo::File qw(path tempdir);
+use cv;
 
 # ensure a consistent base for relative paths
 chdir "$Bin/..";
@@ -30,4 +31,37 @@ my $expected_md5_content = $original_md5_file->slurp;
 my ($expected_md5) = $expected_md5_content =~ /^([0-9a-f]+)/;
 is $actual_md5, $expected_md5, 'md5sum matches original';
 
+subtest 'spectrogram computed and matched natively by tinycv' => sub {
+    cv::init();
+    require tinycv;
+    ok my $spectrogram = tinycv::read_sound("$wav"), 'spectrogram computed';
+    is $spectrogram->similarity(tinycv::read("$test_pnm")), 1_000_000, 'spectrogram identical to the one of snd2png';
+    ok !tinycv::read_sound("$dir/missing.wav"), 'no spectrogram for missing file';
+
+    my $shifted = $spectrogram->copy;
+    $shifted->replacerect(0, 0, 1024, 768);
+    $shifted->blend($spectrogram->copyrect(0, 0, 1000, 768), 24, 0);
+    my ($similarity, $x, $y) = $shifted->match_sound($spectrogram, 10, 400, 200, 300, 50);
+    cmp_ok $similarity, '>', 0.999, 'needle area matches recording shifted in time';
+    is_deeply [$x, $y], [34, 400], 'needle area found at the shifted position';
+};
+
+subtest 'spectrogram of growing recording computed incrementally' => sub {
+    require tinycv;
+    my $content = $wav->slurp;
+    my $recording = path($dir, 'growing.wav');
+    $recording->spew(substr $content, 0, 20);
+    ok my $tail = tinycv::new_sound_tail("$recording"), 'recording opened';
+    is $tail->update, 0, 'nothing analysed before header is complete';
+    my $half = int(length($content) / 4) * 2;
+    $recording->spew(substr $content, 0, $half);
+    cmp_ok my $windows = $tail->update, '>', 0, 'first half of recording analysed';
+    $recording->spew($content);
+    cmp_ok $windows += $tail->update, '>', 300, 'remaining recording analysed';
+    is $tail->update, 0, 'no further windows without new samples';
+    is sprintf('%.1f', $tail->seconds), '3.2', 'duration of analysed recording';
+    is $tail->spectrogram->similarity(tinycv::read_sound("$wav")), 1_000_000, 'spectrogram identical to the one of the complete recording';
+    ok !tinycv::new_sound_tail("$dir/missing.wav"), 'missing recording not opened';
+};
+
 done_testing();
@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+#
+# Copyright SUSE LLC
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+use Test::Most;
+use Test::Warnings ':report_warnings';
+use Mojo::Base -signatures;
+use FindBin '$Bin';
+use lib "$Bin/../external/os-autoinst-common/lib";
+use OpenQA::Test::TimeLimit '5';
+use Mojo::File 'tempdir';
+use IO::Select;
+use OpenQA::FileTail;
+
+my $dir = tempdir;
+my $file = $dir->child('serial0');
+
+subtest 'following a growing file' => sub {
+    my $tail = OpenQA::FileTail->new(file => "$file");
+    is $tail->read, '', 'nothing read if the file does not exist yet';
+    $file->spew('foo');
+    is $tail->read, 'foo', 'existing data read';
+    is $tail->read, '', 'no new data';
+    $file->open('>>')->print('bar');
+    is $tail->read, 'bar', 'only appended data read';
+    is $tail->position, 6, 'position advanced';
+    $tail->position(1);
+    is $tail->read, 'oobar', 'read from position set explicitly';
+};
+
+subtest 'truncated and replaced files' => sub {
+    my $tail = OpenQA::FileTail->new(file => "$file", position => 6);
+    $file->spew('ab');
+    is $tail->read, 'ab', 'read from the beginning after truncation';
+    unlink $file;
+    $file->spew('new file');
+    is $tail->read, 'new file', 'replaced file reopened';
+};
+
+subtest 'watching modifications' => sub {
+    my $tail = OpenQA::FileTail->new(file => "$file");
+    plan skip_all => 'Linux::Inotify2 not available' unless OpenQA::FileTail::HAS_INOTIFY;
+    my $watch = $tail->watch_handle;
+    ok $watch, 'watch handle created';
+    is $tail->watch_handle, $watch, 'watch handle reused';
+    my $select = IO::Select->new($watch);
+    $tail->drain;
+    ok !$select->can_read(0), 'not readable without modification';
+    $file->open('>>')->print('more');
+    ok $select->can_read(1), 'readable after modification';
+    $tail->drain;
+    ok !$select->can_read(0), 'not readable anymore after draining events';
+};
+
+done_testing;
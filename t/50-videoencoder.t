@@ -0,0 +1,248 @@
+#!/usr/bin/perl
+#
+# Copyright SUSE LLC
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+use Test::Most;
+use Test::Warnings ':report_warnings';
+use FindBin '$Bin';
+use lib "$Bin/../external/os-autoinst-common/lib";
+use OpenQA::Test::TimeLimit '15';
+use Mojo::Base -signatures;
+use Mojo::File qw(path tempdir);
+use File::Which 'which';
+use Time::HiRes qw(sleep time);
+use cv;
+
+# ensure a consistent base for relative paths
+chdir "$Bin/..";
+cv::init();
+require tinycv;
+
+my $videoencoder = path('videoencoder')->to_abs;
+ok -x $videoencoder, 'videoencoder exists and is executable' or BAIL_OUT 'videoencoder not found, call "make"';
+my ($width, $height) = (64, 48);
+my %codecs = map { chomp; ($_ => 1) } qx{$videoencoder -L};
+ok $codecs{theora}, 'theora is supported' or always_explain \%codecs;
+
+# returns a PPM image with a gradient depending on the specified seed
+sub frame ($seed) {
+    my $pixels = join '', map {
+        my $y = $_;
+        map { pack 'C3', ($_ * 4 + $seed) % 256, ($y * 5) % 256, ($seed * 40) % 256 } 0 .. $width - 1
+    } 0 .. $height - 1;
+    return "P6\n$width $height\n255\n$pixels";
+}
+
+# starts the encoder within the specified directory and returns the pipe to pass commands via stdin
+sub start_encoder ($dir, @args) {
+    my $cwd = path->to_abs;
+    chdir $dir;
+    open my $encoder, '|-', $videoencoder, '-x', $width, '-y', $height, @args or die "Unable to start videoencoder: $!";
+    chdir $cwd;
+    $encoder->autoflush(1);
+    return $encoder;
+}
+
+# passes a PPM image (given as reference) or another command to the encoder
+sub send_command ($encoder, $command) { print $encoder ref $command ? 'E ' . length($$command) . "\n" . $$command : "$command\n" }
+
+# runs the encoder passing the specified commands and waits until it has finished
+sub encode ($dir, $commands, @args) {
+    my $encoder = start_encoder($dir, @args);
+    send_command($encoder, $_) for @$commands;
+    return close $encoder;
+}
+
+# reads a variable-length integer of EBML, keeping the length marker for element IDs
+sub ebml_vint ($data, $pos, $keep_marker = 0) {
+    my $first = ord substr $$data, $$pos, 1;
+    my $length = 1;
+    $length++ while $length < 8 && !($first & (0x80 >> ($length - 1)));
+    my $value = $keep_marker ? $first : $first & (0xff >> $length);
+    $value = $value * 256 + ord substr $$data, $$pos + $_, 1 for 1 .. $length - 1;
+    $$pos += $length;
+    return $value;
+}
+
+# returns the elements between the specified positions as hashes with ID, start of the element and
+# position and size of its data
+sub ebml_elements ($data, $start, $end) {
+    my @elements;
+    for (my $pos = $start; $pos < $end;) {
+        my $element_start = $pos;
+        my $id = ebml_vint($data, \$pos, 1);
+        my $size = ebml_vint($data, \$pos);
+        push @elements, {id => $id, start => $element_start, pos => $pos, size => $size};
+        $pos += $size;
+    }
+    return @elements;
+}
+
+sub ebml_children ($data, $element) { ebml_elements($data, $element->{pos}, $element->{pos} + $element->{size}) }
+sub ebml_child ($data, $element, $id) { (grep { $_->{id} == $id } ebml_children($data, $element))[0] }
+sub ebml_bytes ($data, $element) { substr $$data, $element->{pos}, $element->{size} }
+sub ebml_uint ($data, $element) { unpack 'Q>', substr("\0" x 8 . ebml_bytes($data, $element), -8) }
+
+subtest 'WebM structure' => sub {
+    my ($codec) = grep { $codecs{$_} } qw(vp9 av1);
+    plan skip_all => 'videoencoder built without libvpx and libaom' unless $codec;
+    my $dir = tempdir("/tmp/$FindBin::Script-XXXX");
+    my @frames = map { \frame($_) } 1 .. 3;
+    ok encode($dir, [$frames[0], 'R', 'R', $frames[1], $frames[2]], '-n', '-o', "$codec:$dir/video.webm", "$dir/video.ogv"), "$codec video encoded";
+    my $webm = $dir->child('video.webm')->slurp;
+    my $data = \$webm;
+
+    my @top = ebml_elements($data, 0, length $webm);
+    is_deeply [map { $_->{id} } @top], [0x1A45DFA3, 0x18538067], 'EBML header followed by segment' or return;
+    is ebml_bytes($data, ebml_child($data, $top[0], 0x4282)), 'webm', 'doc type is WebM';
+    my $segment = $top[1];
+    is $segment->{pos} + $segment->{size}, length $webm, 'segment size filled in when finishing';
+
+    my @elements = grep { $_->{id} != 0xEC } ebml_children($data, $segment);
+    my @ids = map { $_->{id} } @elements;
+    is_deeply [@ids[0 .. 2]], [0x114D9B74, 0x1549A966, 0x1654AE6B], 'segment starts with seek head, info and tracks' or always_explain \@ids;
+    is $ids[-1], 0x1C53BB6B, 'segment ends with cues';
+    my @clusters = grep { $_->{id} == 0x1F43B675 } @elements;
+    is scalar @clusters, @elements - 4, 'clusters in between';
+
+    my $info = $elements[1];
+    is unpack('d>', ebml_bytes($data, ebml_child($data, $info, 0x4489))), 208, 'duration covers repeated frames';
+    my $track = ebml_child($data, $elements[2], 0xAE);
+    is ebml_bytes($data, ebml_child($data, $track, 0x86)), $codec eq 'vp9' ? 'V_VP9' : 'V_AV1', 'codec ID';
+    my $video = ebml_child($data, $track, 0xE0);
+    is_deeply [map { ebml_uint($data, ebml_child($data, $video, $_)) } 0xB0, 0xBA], [$width, $height], 'frame size';
+
+    my (@timecodes, @keyframes);
+    for my $cluster (@clusters) {
+        my ($timecode, @blocks) = ebml_children($data, $cluster);
+        is $timecode->{id}, 0xE7, 'cluster starts with its timecode';
+        for my $block (@blocks) {
+            is $block->{id}, 0xA3, 'cluster contains simple blocks';
+            my ($track_number, $relative, $flags) = unpack 'C s> C', ebml_bytes($data, $block);
+            is $track_number, 0x81, 'block belongs to the video track';
+            push @timecodes, ebml_uint($data, $timecode) + $relative;
+            push @keyframes, $flags & 0x80 ? 1 : 0;
+        }
+    }
+    is_deeply \@timecodes, [0, 125, 167], 'one block per frame with repeated frames extending its duration';
+    is $keyframes[0], 1, 'video starts with a keyframe';
+
+    my $cue_point = ebml_child($data, $elements[-1], 0xBB);
+    my $positions = ebml_child($data, $cue_point, 0xB7);
+    is ebml_uint($data, ebml_child($data, $cue_point, 0xB3)), 0, 'cue points to start';
+    is $segment->{pos} + ebml_uint($data, ebml_child($data, $positions, 0xF1)), $clusters[0]->{start}, 'cue refers to first cluster';
+
+    SKIP: {
+        skip 'ffprobe not available', 1 unless my $ffprobe = which 'ffprobe';
+        my $probed = qx{$ffprobe -v error -count_frames -select_streams v -show_entries stream=codec_name,width,height,nb_read_frames -of csv=p=0 $dir/video.webm};
+        is $probed, "$codec,$width,$height,3\n", 'video readable by ffprobe';
+    }
+};
+
+subtest 'frame index and extraction' => sub {
+    my $dir = tempdir("/tmp/$FindBin::Script-XXXX");
+    my @frames = map { \frame($_) } 1 .. 70;
+    # the keyframe interval is 64 frames so the video contains more than one keyframe
+    ok encode($dir, [@frames[0 .. 2], 'R', 'R', @frames[3 .. 69]], "$dir/video.ogv"), 'theora video encoded';
+    my $video = $dir->child('video.ogv');
+    my $index = $dir->child('video.ogv.idx');
+    my $video_data = $video->slurp;
+    my $index_data = $index->slurp;
+
+    is_deeply [unpack 'a4 V3', $index_data], ['OAVI', 1, 24, 1], 'index header with magic, version and frame rate';
+    my @entries = map { [unpack 'V4 Q<2', substr $index_data, 16 + $_ * 32, 32] } 0 .. (length($index_data) - 16) / 32 - 1;
+    is scalar @entries, 70, 'one entry per encoded frame';
+    is_deeply [map { $_->[1] } @entries[0 .. 3]], [1, 1, 3, 1], 'repeated frames collapsed into the entry of the repeated frame';
+    my ($next_frame, @keyframes) = (0);
+    for my $entry (@entries) {
+        my ($first_frame, $frame_count, $keyframe_frame, $flags, $page_offset, $keyframe_offset) = @$entry;
+        is $first_frame, $next_frame, "entry of frame $first_frame follows previous entry";
+        $next_frame += $frame_count;
+        cmp_ok $page_offset, '<', length $video_data, "page of frame $first_frame within video";
+        push @keyframes, $first_frame if $flags & 1;
+        next unless $flags & 1;
+        is $keyframe_frame, $first_frame, "keyframe $first_frame refers to itself";
+        is $keyframe_offset, $page_offset, "keyframe $first_frame starts a new page";
+        is substr($video_data, $page_offset, 4), 'OggS', "page of keyframe $first_frame found at offset";
+    }
+    is $next_frame, 72, 'index covers all frames';
+    is $keyframes[0], 0, 'video starts with a keyframe';
+    cmp_ok scalar @keyframes, '>=', 2, 'further keyframe after keyframe interval' or always_explain \@keyframes;
+    is $entries[-1][2], $keyframes[-1], 'last frame refers to last keyframe';
+
+    my $extract = sub ($frame) {
+        my $png = $dir->child("frame-$frame.png");
+        my $output = qx{$videoencoder -e $frame $video $png 2>&1};
+        return ($?, $output, -e $png ? tinycv::read("$png") : undef);
+    };
+    # the PNG shows the encoded frame which is more similar to the expected one than to others
+    my $shows = sub ($image, $expected, $other) {
+        my ($similarity, $other_similarity) = map { $image->similarity(tinycv::from_ppm(${$frames[$_]})) } $expected, $other;
+        cmp_ok $similarity, '>', $other_similarity, "extracted frame shows frame $expected";
+    };
+    for my $case ([0, 0, 1], [4, 2, 3], [5, 3, 2], [71, 69, 68]) {
+        my ($frame, $expected, $other) = @$case;
+        my ($status, $output, $image) = $extract->($frame);
+        is $status, 0, "frame $frame extracted" or always_explain $output;
+        ok $image, "PNG of frame $frame written" or next;
+        is_deeply [$image->xres, $image->yres], [$width, $height], "size of frame $frame";
+        $shows->($image, $expected, $other);
+    }
+
+    my ($status, $output) = $extract->(72);
+    isnt $status, 0, 'extracting frame beyond end fails';
+    like $output, qr/Frame 72 is not contained in/, 'error about missing frame';
+
+    # a truncated index still allows extracting frames of the remaining entries
+    $index->spew(substr $index_data, 0, 16 + 2 * 32 + 10);
+    ($status, $output) = $extract->(71);
+    isnt $status, 0, 'extracting frame not covered by truncated index fails';
+    like $output, qr/Frame 71 is not contained in/, 'error about frame not contained in truncated index';
+    my $image;
+    ($status, $output, $image) = $extract->(1);
+    is $status, 0, 'frame covered by truncated index extracted' or always_explain $output;
+    $shows->($image, 1, 0) if $image;
+
+    $index->spew(substr $index_data, 0, 10);
+    ($status, $output) = $extract->(0);
+    isnt $status, 0, 'extracting frame with truncated index header fails';
+    like $output, qr/video\.ogv\.idx: error: no usable index/, 'error about unusable index';
+
+    $index->remove;
+    ($status, $output) = $extract->(0);
+    isnt $status, 0, 'extracting frame without index fails';
+    like $output, qr/video\.ogv\.idx: error: no usable index/, 'error about missing index';
+};
+
+subtest 'live log' => sub {
+    my $dir = tempdir("/tmp/$FindBin::Script-XXXX");
+    my $screenshots = $dir->child('qemuscreenshot')->make_path;
+    my $pngs = sub () { [sort { $a->[0] <=> $b->[0] || $a->[1] <=> $b->[1] } map { [/(\d+)\.(\d+)\.png$/] } grep { /\d+\.\d+\.png$/ } $screenshots->list->each] };
+    my $encoder = start_encoder($dir, '-n', '-r', 4, "$dir/video.ogv");
+    my @frames = map { \frame($_) } 1 .. 25;
+    for my $frame (@frames[0 .. 4]) { send_command($encoder, $frame); sleep .05 }
+    sleep .3;
+    is_deeply $pngs->(), [], 'no PNGs written without live log';
+
+    $dir->child('live_log')->touch;
+    sleep .2;
+    my $start = time;
+    for my $frame (@frames[5 .. 24]) { send_command($encoder, $frame); sleep .05 }
+    my $elapsed = time - $start;
+    sleep .5;
+    my $written = $pngs->();
+    # the first frame is written right away, then at most one frame per 0.25 s
+    cmp_ok scalar @$written, '>=', 2, 'PNGs written after live log has been enabled';
+    cmp_ok scalar @$written, '<=', 2 + int($elapsed / .25), 'PNGs written at most at the specified rate' or always_explain $written;
+    my @gaps = map { $written->[$_][0] - $written->[$_ - 1][0] + ($written->[$_][1] - $written->[$_ - 1][1]) / 1e6 } 1 .. $#$written;
+    ok !(grep { $_ < .24 } @gaps), 'PNGs written not more often than the specified rate' or always_explain \@gaps;
+
+    my $last = $screenshots->child('last.png');
+    ok -l $last, 'last.png is a symlink';
+    is readlink $last, "$written->[-1][0].$written->[-1][1].png", 'last.png refers to the newest PNG';
+    is tinycv::read("$last")->similarity(tinycv::from_ppm(${$frames[-1]})), 1_000_000, 'newest PNG shows the last frame';
+    ok close($encoder), 'encoder finished';
+};
+
+done_testing;
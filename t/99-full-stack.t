@@ -26,6 +26,8 @@ note "data dir: $data_dir";
 note "pool dir: $pool_dir";
 
 $ENV{OS_AUTOINST_STORAGE_KEEP_FREE_RATIO} = 0;
+# keep the needle index and other caches within the temporary directory
+$ENV{XDG_CACHE_HOME} = "$dir/cache";
 
 chdir $pool_dir;
 my $cleanup = scope_guard sub { chdir $Bin; undef $dir };
@@ -21,7 +21,6 @@ use OpenQA::Exceptions;
 use OpenQA::Isotovideo::NeedleDownloader;
 use Digest::MD5 'md5_base64';
 use Carp qw(cluck croak);
-use MIME::Base64 'decode_base64';
 use Scalar::Util qw(looks_like_number reftype);
 use B::Deparse;
 use Time::Seconds;
@@ -272,7 +271,7 @@ sub force_soft_failure ($reason) {
 sub _handle_found_needle ($foundneedle, $rsp, $tags) {
     # convert the needle back to an object
     $foundneedle->{needle} = needle->new($foundneedle->{needle});
-    my $img = tinycv::from_ppm(decode_base64($rsp->{image}));
+    my $img = tinycv::from_ppm(myjsonrpc::attachment_data($rsp->{image}));
     my $frame = $rsp->{frame};
     $autotest::current_test->record_screenmatch($img, $foundneedle, $tags, $rsp->{candidates}, $frame);
     my $lastarea = $foundneedle->{area}->[-1];
@@ -302,7 +301,7 @@ sub _check_backend_response ($rsp, $check, $timeout, $mustmatch) {
             my $current_test = $autotest::current_test;
             if ($final_mismatch) {
                 $autotest::current_test->record_screenfail(
-                    img => tinycv::from_ppm(decode_base64($final_mismatch->{image})),
+                    img => tinycv::from_ppm(myjsonrpc::attachment_data($final_mismatch->{image})),
                     needles => $final_mismatch->{candidates},
                     tags => $tags,
                     result => 'unk',
@@ -327,7 +326,7 @@ sub _check_backend_response ($rsp, $check, $timeout, $mustmatch) {
         # only care for the last one
         $failed_screens = [$final_mismatch] if $check && defined $final_mismatch;
         for my $l (@$failed_screens) {
-            my $img = tinycv::from_ppm(decode_base64($l->{image}));
+            my $img = tinycv::from_ppm(myjsonrpc::attachment_data($l->{image}));
             my $result = $check ? 'unk' : 'fail';
             $result = 'unk' if ($l != $final_mismatch);
             $autotest::current_test->record_screenfail(
@@ -1806,44 +1805,77 @@ sub start_audiocapture () {
     return query_isotovideo('backend_start_audiocapture', {filename => $filename});
 }
 
-sub _snd2png ($wavfile, $imgpath) { system "$bmwqemu::topdir/snd2png $wavfile $imgpath" }    # uncoverable statement
+# FFTW plans measured when computing spectrograms are cached per host, an empty SND2PNG_WISDOM_DIR disables this
+sub _snd2png_wisdom_dir () {
+    my $dir = $bmwqemu::vars{SND2PNG_WISDOM_DIR};
+    unless (defined $dir) {
+        my $cache_home = $ENV{XDG_CACHE_HOME} || ($ENV{HOME} ? "$ENV{HOME}/.cache" : undef);
+        return undef unless $cache_home;
+        $dir = "$cache_home/os-autoinst";
+    }
+    return undef unless length $dir;
+    make_path($dir, {error => \my $errors});
+    return $dir unless @$errors;
+    bmwqemu::diag "Unable to create FFTW wisdom directory $dir";
+    return undef;
+}
 
-sub _check_or_assert_sound ($mustmatch, $check = undef) {
+# polls the live analysis of the audio capture until the sound has been recorded or the timeout is exceeded
+sub _wait_for_recorded_sound ($mustmatch, $timeout) {
+    while ($timeout >= 0) {
+        my $rsp = query_isotovideo('backend_check_audiocapture', {mustmatch => $mustmatch});
+        if (my $found = $rsp->{found}) {
+            bmwqemu::diag sprintf('found %s after %.2f seconds of recording, similarity %.2f', $found->{needle}, $found->{seconds}, $found->{similarity});
+            return 1;
+        }
+        sleep 0.5;
+        $timeout -= 0.5;
+    }
+    return 0;
+}
+
+sub _check_or_assert_sound ($mustmatch, $check = undef, %args) {
+    _wait_for_recorded_sound($mustmatch, bmwqemu::scale_timeout($args{timeout})) if $args{timeout};
     my $result = $autotest::current_test->stop_audiocapture();
     my $wavfile = join '/', bmwqemu::result_dir(), $result->{audio};
     my $imgpath = "$result->{audio}.png";
-    _snd2png($wavfile, $imgpath);
-    return $autotest::current_test->verify_sound_image($imgpath, $mustmatch, $check);
+    return $autotest::current_test->verify_sound_image($imgpath, $mustmatch, $check, $wavfile, _snd2png_wisdom_dir);
 }
 
 =head2 assert_recorded_sound
 
-  assert_recorded_sound('we-will-rock-you');
+  assert_recorded_sound('we-will-rock-you' [, timeout => $timeout]);
 
 Tells the backend to record a C<.wav> file of the sound card and asserts if it matches
 expected audio. Comparison is performed after conversion to the image.
 
+With C<timeout> the recording is analysed while it is still going on and it is only
+stopped once the expected audio has been recorded or the timeout is exceeded. This
+allows to assert the sound as soon as it has been played instead of sleeping for the
+duration of the sound.
+
 I<Only supported by QEMU backend.>
 
 =cut
 
-sub assert_recorded_sound ($mustmatch) {
-    return _check_or_assert_sound $mustmatch;
+sub assert_recorded_sound ($mustmatch, %args) {
+    return _check_or_assert_sound $mustmatch, 0, %args;
 }
 
 =head2 check_recorded_sound
 
-  check_recorded_sound('we-will-rock-you');
+  check_recorded_sound('we-will-rock-you' [, timeout => $timeout]);
 
 Tells the backend to record a C<.wav> file of the sound card and checks if it matches
-expected audio. Comparison is performed after conversion to the image.
+expected audio. Comparison is performed after conversion to the image. See
+C<assert_recorded_sound> for the C<timeout> parameter.
 
 I<Only supported by QEMU backend.>
 
 =cut
 
-sub check_recorded_sound ($mustmatch) {
-    return _check_or_assert_sound $mustmatch, 1;
+sub check_recorded_sound ($mustmatch, %args) {
+    return _check_or_assert_sound $mustmatch, 1, %args;
 }
 
 =head1 miscellaneous
@@ -26,14 +26,51 @@
 This program makes an Ogg Theora file from a sequence of PPM images.
 It expects the PPM images to be passed via stdin. The following
 commands are used:
-    * Enqueue a new frame: "E " + to_string(length_of_ppm_image) + "\n" + ppm_image
+    * Enqueue a new frame: "E " + to_string(length_of_image) + "\n" + image
+                           where the image is a QOI or PPM image
+    * Enqueue a new frame from the frame ring:
+                           "F <slot> <width> <height> <stride>\n"
     * Repeat last frame:   "R\n"
 
+The "E" and "F" commands may be followed by " <tile_size>:<bitmap>", a hex
+bitmap of the tiles which changed since the previous frame. Only those
+tiles are converted into Y'CbCr then; the rest of the previous frame is
+kept.
+
+The frame ring is a memfd shared with the backend which contains raw BGR
+frames (see ppmclibs/frame_ring.h). Its file descriptor is inherited and
+passed via '-f'. The slot of the last frame is referenced until the next
+frame arrives and only then released to the backend.
+
+Passing '-S FD' makes the encoder write statistics as JSON lines to the
+file descriptor FD every 10 seconds (or the interval passed via '-I') and
+when exiting: the numbers of frames received, encoded and repeated, the
+data pending in the pipe and the frame ring, the bytes written to all
+outputs, the number of live log PNGs and percentiles of the time spent on
+reading, decoding, converting and encoding frames within the interval.
+
 If the file "live_log" exists the last PNG for the live log is produced.
+PNGs are written by a background thread, at most 4 per second unless a
+different rate is passed via '-r' (0 means unlimited).
 
 The output file path needs to be passed as CLI argument. Passing '-n'
 prevents the actual video encoding so only the PNG is produced
-anymore (as needed).
+anymore (as needed). Passing '-p 420' or '-p 422' subsamples the chroma
+planes (default is '444').
+
+Additional outputs can be specified via '-o CODEC:PATH', e.g.
+'-o vp9:video.webm'. Each frame is decoded only once and then encoded
+into all outputs. VP9 and AV1 are written as WebM and always use 4:2:0
+chroma subsampling; repeated frames are encoded as a single frame with
+a longer duration. Passing '-L' lists the supported codecs (VP9 and AV1
+are only available if libvpx/libaom were found at build time).
+
+Next to the Theora video an index is written to OUTPUT.idx. It maps each
+frame number to the Ogg page its packet starts in and to the preceding
+keyframe; repeated frames are collapsed into a single entry. Every
+keyframe starts a new page. Passing '-e FRAME VIDEO PNG' uses the index
+to write a single frame of a recorded video as PNG, decoding only from
+the preceding keyframe on.
 
 This program will wait until it receives a TERM signal to complete the
 video.
@@ -46,139 +83,1622 @@ video.
 #include <opencv2/opencv.hpp>
 
 #include <ogg/ogg.h>
+#include <theora/theoradec.h>
 #include <theora/theoraenc.h>
 
+#ifdef HAVE_VPX
+#include <vpx/vp8cx.h>
+#include <vpx/vpx_encoder.h>
+#endif
+
+#ifdef HAVE_AOM
+#include <aom/aom_encoder.h>
+#include <aom/aomcx.h>
+#endif
+
+#include "frame_ring.h"
+#include "qoi.h"
+
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cinttypes>
 #include <csignal>
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
 const char* option_output;
 
-static FILE* ogg_fp = NULL;
-static ogg_stream_state ogg_os;
-static ogg_packet op;
-static ogg_page og;
-
-static th_enc_ctx* td;
-static th_info ti;
+static constexpr int fps = 24;
+static constexpr ogg_uint32_t keyframe_frequency = 64;
 
 int loop = 1;
 
-static int theora_write_frame(th_ycbcr_buffer ycbcr, int last)
+using namespace cv;
+
+/*
+ * BT.601 studio range coefficients of the former integer formula in fixed point; the offsets
+ * include the rounding term so shifting out the fraction bits (plus the number of summed-up
+ * samples) yields the rounded value without clamping
+ */
+static constexpr int fraction_bits = 20;
+
+struct Coefficients {
+    int r, g, b, offset;
+};
+
+static constexpr int to_fixed(double v) { return static_cast<int>(v * (1 << fraction_bits) + (v < 0 ? -0.5 : 0.5)); }
+
+static constexpr Coefficients y_coefficients = { to_fixed(65481.0 / 255000), to_fixed(128553.0 / 255000), to_fixed(24966.0 / 255000), to_fixed(4207500.0 / 255000) };
+static constexpr Coefficients cb_coefficients = { to_fixed(-33488.0 / 225930), to_fixed(-65744.0 / 225930), to_fixed(99232.0 / 225930), to_fixed(29032005.0 / 225930) };
+static constexpr Coefficients cr_coefficients = { to_fixed(157024.0 / 357510), to_fixed(-131488.0 / 357510), to_fixed(-25536.0 / 357510), to_fixed(45940035.0 / 357510) };
+
+static constexpr int positive_part(int c) { return c > 0 ? c : 0; }
+static constexpr int negative_part(int c) { return c < 0 ? c : 0; }
+static constexpr bool fits_into_byte(const Coefficients& c)
 {
-    ogg_packet op;
-    ogg_page og;
-    assert(ogg_fp);
+    return ((positive_part(c.r) + positive_part(c.g) + positive_part(c.b)) * 255 + c.offset) >> fraction_bits <= 255
+        && (negative_part(c.r) + negative_part(c.g) + negative_part(c.b)) * 255 + c.offset >= 0;
+}
+static_assert(fits_into_byte(y_coefficients) && fits_into_byte(cb_coefficients) && fits_into_byte(cr_coefficients),
+    "conversion must not need clamping");
+
+/*
+ * Pixels are converted in groups using generic vector types (supported by GCC and Clang) so
+ * the arithmetic maps to SSE/AVX, NEON, VSX or the z/Architecture vector facility without any
+ * architecture specific code; on other targets the compiler falls back to scalar code
+ */
+typedef int32_t lanes __attribute__((vector_size(16)));
+static constexpr int lane_count = sizeof(lanes) / sizeof(int32_t);
+
+// converts sums of 2^shift pixels
+static inline void convert(const Coefficients& c, const lanes& r, const lanes& g, const lanes& b, int shift, lanes& out)
+{
+    out = (c.r * r + c.g * g + c.b * b + (c.offset << shift)) >> (fraction_bits + shift);
+}
 
-    /* Theora is a one-frame-in,one-frame-out system; submit a frame
-   for compression and pull out the packet */
-    if (th_encode_ycbcr_in(td, ycbcr)) {
-        fprintf(stderr, "%s: error: could not encode frame\n", option_output);
-        return 1;
+static void convert_luma_row(const unsigned char* bgr, unsigned char* out, int width)
+{
+    for (int x = 0; x < width; x += lane_count) {
+        const int n = std::min(lane_count, width - x);
+        lanes b = {}, g = {}, r = {};
+        for (int i = 0; i < n; i++) {
+            b[i] = bgr[3 * (x + i) + 0];
+            g[i] = bgr[3 * (x + i) + 1];
+            r[i] = bgr[3 * (x + i) + 2];
+        }
+        lanes y;
+        convert(y_coefficients, r, g, b, 0, y);
+        for (int i = 0; i < n; i++)
+            out[x + i] = static_cast<unsigned char>(y[i]);
     }
+}
 
-    while (true) {
-        int ret = th_encode_packetout(td, last, &op);
-        if (ret == 0)
-            return 0;
+/*
+ * computes one row of chroma samples, each averaging a block of (1 + hdec) x (1 + vdec) pixels;
+ * the last column/row is duplicated if the width/height is odd
+ */
+template <int hdec, int vdec>
+static void convert_chroma_row(const unsigned char* row0, const unsigned char* row1, unsigned char* cb, unsigned char* cr, int width)
+{
+    const int chroma_width = (width + hdec) >> hdec;
+    for (int cx = 0; cx < chroma_width; cx += lane_count) {
+        const int n = std::min(lane_count, chroma_width - cx);
+        lanes b = {}, g = {}, r = {};
+        for (int i = 0; i < n; i++) {
+            const int x0 = 3 * ((cx + i) << hdec);
+            const int x1 = hdec ? 3 * std::min(((cx + i) << hdec) + 1, width - 1) : x0;
+            b[i] = row0[x0 + 0];
+            g[i] = row0[x0 + 1];
+            r[i] = row0[x0 + 2];
+            if (hdec) {
+                b[i] += row0[x1 + 0];
+                g[i] += row0[x1 + 1];
+                r[i] += row0[x1 + 2];
+            }
+            if (vdec) {
+                b[i] += row1[x0 + 0] + (hdec ? row1[x1 + 0] : 0);
+                g[i] += row1[x0 + 1] + (hdec ? row1[x1 + 1] : 0);
+                r[i] += row1[x0 + 2] + (hdec ? row1[x1 + 2] : 0);
+            }
+        }
+        lanes u, v;
+        convert(cb_coefficients, r, g, b, hdec + vdec, u);
+        convert(cr_coefficients, r, g, b, hdec + vdec, v);
+        for (int i = 0; i < n; i++) {
+            cb[cx + i] = static_cast<unsigned char>(u[i]);
+            cr[cx + i] = static_cast<unsigned char>(v[i]);
+        }
+    }
+}
+
+/*
+ * converts a region of the frame; its position needs to be even and its size needs to be even as
+ * well unless it extends to the edge of the frame so chroma samples are not split between regions
+ */
+template <int hdec, int vdec>
+static void convert_region(const Mat& image, th_ycbcr_buffer ycbcr, const Rect& region)
+{
+    const int x = region.x, w = region.width, bottom = region.y + region.height;
+    for (int y = region.y; y < bottom; y++)
+        // rows are not necessarily contiguous (e.g. frames within the frame ring are padded)
+        convert_luma_row(image.ptr<unsigned char>(y) + 3 * x, ycbcr[0].data + y * ycbcr[0].stride + x, w);
+
+    const int chroma_bottom = (bottom + vdec) >> vdec;
+    for (int cy = region.y >> vdec; cy < chroma_bottom; cy++) {
+        const int y0 = cy << vdec;
+        const int y1 = std::min(y0 + vdec, bottom - 1);
+        convert_chroma_row<hdec, vdec>(image.ptr<unsigned char>(y0) + 3 * x, image.ptr<unsigned char>(y1) + 3 * x,
+            ycbcr[1].data + cy * ycbcr[1].stride + (x >> hdec), ycbcr[2].data + cy * ycbcr[2].stride + (x >> hdec), w);
+    }
+}
+
+template <int hdec, int vdec>
+static void convert_frame(const Mat& image, th_ycbcr_buffer ycbcr, int w, int h, const vector<Rect>* regions)
+{
+    const Rect frame(0, 0, w, h);
+    if (!regions)
+        return convert_region<hdec, vdec>(image, ycbcr, frame);
+    for (const auto& region : *regions) {
+        const auto visible = region & frame;
+        if (!visible.empty())
+            convert_region<hdec, vdec>(image, ycbcr, visible);
+    }
+}
+
+/*
+ * converts the BGR image into the planes of the specified buffer; the chroma subsampling is
+ * deduced from the plane sizes; if regions are specified only those are converted and the
+ * rest of the planes is kept
+ *
+ * This ignores gamma and RGB primary/whitepoint differences.
+ */
+void rgb_to_yuv(Mat* image, th_ycbcr_buffer ycbcr, int xres, int yres, const vector<Rect>* regions = nullptr)
+{
+    assert(image->type() == CV_8UC3);
+    const int w = std::min(xres, image->cols);
+    const int h = std::min(yres, image->rows);
+    const bool hdec = ycbcr[1].width < ycbcr[0].width;
+    const bool vdec = ycbcr[1].height < ycbcr[0].height;
+    if (hdec && vdec)
+        convert_frame<1, 1>(*image, ycbcr, w, h, regions);
+    else if (hdec)
+        convert_frame<1, 0>(*image, ycbcr, w, h, regions);
+    else
+        convert_frame<0, 0>(*image, ycbcr, w, h, regions);
+}
+
+/*
+ * parses the optional "TILE_SIZE:BITMAP" argument of a frame command as sent by the backend
+ * (see image_changed_tiles in ppmclibs/tinycv_impl.cc) into the regions which changed since
+ * the previous frame, joining adjacent tiles of a row; returns false if the whole frame needs
+ * to be converted
+ */
+static bool parse_changed_tiles(const char* argument, int w, int h, vector<Rect>& regions)
+{
+    int tile_size = 0, offset = 0;
+    if (sscanf(argument, " %d:%n", &tile_size, &offset) != 1 || !offset || tile_size <= 0 || tile_size % 2)
+        return false;
+    const char* hex = argument + offset;
+    const int tiles_x = (w + tile_size - 1) / tile_size;
+    const int tiles_y = (h + tile_size - 1) / tile_size;
+    const int tile_count = tiles_x * tiles_y;
+    if (strspn(hex, "0123456789abcdef") != strlen(hex) || strlen(hex) != static_cast<size_t>((tile_count + 7) / 8 * 2))
+        return false;
+
+    const auto tile_changed = [hex](int tile) {
+        const char digit = hex[tile / 8 * 2 + (tile % 8 < 4)];
+        const int nibble = digit <= '9' ? digit - '0' : digit - 'a' + 10;
+        return (nibble >> (tile % 4)) & 1;
+    };
+    regions.clear();
+    for (int ty = 0; ty < tiles_y; ty++)
+        for (int tx = 0; tx < tiles_x; tx++) {
+            if (!tile_changed(ty * tiles_x + tx))
+                continue;
+            const int first = tx;
+            while (tx + 1 < tiles_x && tile_changed(ty * tiles_x + tx + 1))
+                ++tx;
+            regions.emplace_back(first * tile_size, ty * tile_size, (tx + 1 - first) * tile_size, tile_size);
+        }
+    return true;
+}
+
+// the planes of a frame converted into a certain pixel format
+struct Planes {
+    th_ycbcr_buffer ycbcr;
+    vector<unsigned char> data;
+
+    Planes(int w, int h, th_pixel_fmt pixel_fmt)
+    {
+        // chroma planes cover the picture with odd sizes rounded up as expected by th_encode_ycbcr_in
+        const int hdec = !(pixel_fmt & 1);
+        const int vdec = !(pixel_fmt & 2);
+        ycbcr[0].width = w;
+        ycbcr[0].height = h;
+        ycbcr[0].stride = w;
+        ycbcr[1].width = (w + hdec) >> hdec;
+        ycbcr[1].stride = ycbcr[1].width;
+        ycbcr[1].height = (h + vdec) >> vdec;
+        ycbcr[2].width = ycbcr[1].width;
+        ycbcr[2].stride = ycbcr[1].stride;
+        ycbcr[2].height = ycbcr[1].height;
+
+        const size_t luma_size = static_cast<size_t>(ycbcr[0].stride) * ycbcr[0].height;
+        const size_t chroma_size = static_cast<size_t>(ycbcr[1].stride) * ycbcr[1].height;
+        data.resize(luma_size + 2 * chroma_size);
+        ycbcr[0].data = data.data();
+        ycbcr[1].data = ycbcr[0].data + luma_size;
+        ycbcr[2].data = ycbcr[1].data + chroma_size;
+    }
+    Planes(const Planes&) = delete;
+    Planes& operator=(const Planes&) = delete;
+};
+
+// an encoder writing one output file
+class Sink {
+public:
+    explicit Sink(th_pixel_fmt pixel_fmt)
+        : pixel_fmt(pixel_fmt)
+    {
+    }
+    virtual ~Sink() = default;
+
+    // encodes a frame which is shown for 1 + repeat frame durations; returns false on errors
+    virtual bool write_frame(th_ycbcr_buffer ycbcr, int repeat, bool last) = 0;
+    // flushes pending data and completes the output file
+    virtual void finish() = 0;
+    // returns the number of bytes written to the output file so far
+    virtual uint64_t bytes_written() const = 0;
+
+    const th_pixel_fmt pixel_fmt;
+};
+
+/*
+ * Index written next to the Theora video (OUTPUT.idx) allowing to find frames without decoding
+ * the video from its beginning. All numbers are little-endian. The 16-byte header consists of
+ * the magic "OAVI", the version and the frame rate (numerator and denominator as 32-bit integers).
+ * It is followed by one 32-byte entry per encoded frame, a frame and its repetitions being a
+ * single entry:
+ *   u32 first frame number, u32 number of frames, u32 frame number of the last keyframe,
+ *   u32 flags (1 = keyframe), u64 offset of the Ogg page to start reading the frame's packet at,
+ *   u64 offset of the Ogg page starting with the last keyframe
+ */
+namespace frame_index {
+
+constexpr char magic[4] = { 'O', 'A', 'V', 'I' };
+constexpr uint32_t version = 1;
+constexpr size_t header_size = 16;
+constexpr size_t entry_size = 32;
+constexpr uint32_t keyframe_flag = 1;
+
+struct Entry {
+    uint32_t first_frame = 0;
+    uint32_t frame_count = 0;
+    uint32_t keyframe_frame = 0;
+    uint32_t flags = 0;
+    uint64_t page_offset = 0;
+    uint64_t keyframe_offset = 0;
+};
+
+static void put(unsigned char*& p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        *p++ = static_cast<unsigned char>(value >> (8 * i));
+}
+
+static uint64_t get(const unsigned char*& p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<uint64_t>(*p++) << (8 * i);
+    return value;
+}
+
+static bool write_header(FILE* fp, uint32_t fps_numerator, uint32_t fps_denominator)
+{
+    unsigned char header[header_size];
+    unsigned char* p = header;
+    memcpy(p, magic, sizeof(magic));
+    p += sizeof(magic);
+    put(p, version, 4);
+    put(p, fps_numerator, 4);
+    put(p, fps_denominator, 4);
+    return fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+static bool check_header(FILE* fp)
+{
+    unsigned char header[header_size];
+    const unsigned char* p = header + sizeof(magic);
+    return fread(header, sizeof(header), 1, fp) == 1 && !memcmp(header, magic, sizeof(magic)) && get(p, 4) == version;
+}
+
+static bool write_entry(FILE* fp, const Entry& entry)
+{
+    unsigned char data[entry_size];
+    unsigned char* p = data;
+    put(p, entry.first_frame, 4);
+    put(p, entry.frame_count, 4);
+    put(p, entry.keyframe_frame, 4);
+    put(p, entry.flags, 4);
+    put(p, entry.page_offset, 8);
+    put(p, entry.keyframe_offset, 8);
+    return fwrite(data, sizeof(data), 1, fp) == 1;
+}
 
+static bool read_entry(FILE* fp, size_t index, Entry& entry)
+{
+    unsigned char data[entry_size];
+    if (fseeko(fp, static_cast<off_t>(header_size + index * entry_size), SEEK_SET) || fread(data, sizeof(data), 1, fp) != 1)
+        return false;
+    const unsigned char* p = data;
+    entry.first_frame = static_cast<uint32_t>(get(p, 4));
+    entry.frame_count = static_cast<uint32_t>(get(p, 4));
+    entry.keyframe_frame = static_cast<uint32_t>(get(p, 4));
+    entry.flags = static_cast<uint32_t>(get(p, 4));
+    entry.page_offset = get(p, 8);
+    entry.keyframe_offset = get(p, 8);
+    return true;
+}
+
+}
+
+class TheoraSink : public Sink {
+public:
+    TheoraSink(const char* path, int w, int h, th_pixel_fmt pixel_fmt)
+        : Sink(pixel_fmt)
+        , path(path)
+    {
+        ogg_fp = fopen(path, "wb");
+        if (!ogg_fp) {
+            fprintf(stderr, "%s: error: %s\n", path,
+                "couldn't open output file");
+            exit(1);
+        }
+
+        const auto index_path = string(path) + ".idx";
+        index_fp = fopen(index_path.c_str(), "wb");
+        if (!index_fp || !frame_index::write_header(index_fp, fps, 1)) {
+            fprintf(stderr, "%s: error: %s\n", index_path.c_str(),
+                "couldn't create index file");
+            exit(1);
+        }
+
+        srand(time(NULL));
+        if (ogg_stream_init(&ogg_os, rand())) {
+            fprintf(stderr, "%s: error: %s\n", path,
+                "couldn't create ogg stream state");
+            exit(1);
+        }
+
+        th_info ti;
+        th_info_init(&ti);
+        ti.frame_width = ((w + 15) >> 4) << 4;
+        ti.frame_height = ((h + 15) >> 4) << 4;
+        ti.pic_width = w;
+        ti.pic_height = h;
+        ti.pic_x = 0;
+        ti.pic_y = 0;
+        ti.fps_numerator = fps;
+        ti.fps_denominator = 1;
+        ti.aspect_numerator = 0;
+        ti.aspect_denominator = 0;
+        ti.colorspace = TH_CS_UNSPECIFIED;
+        ti.pixel_fmt = pixel_fmt;
+        ti.target_bitrate = -1;
+        ti.quality = 48; /* 63 is maximum */
+        ti.keyframe_granule_shift = ilog(keyframe_frequency - 1);
+
+        td = th_encode_alloc(&ti);
+        th_info_clear(&ti);
+
+        /* setting just the granule shift only allows power-of-two keyframe
+       spacing.  Set the actual requested spacing. */
+        ogg_uint32_t requested_keyframe_frequency = keyframe_frequency;
+        int ret = th_encode_ctl(td, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+            &requested_keyframe_frequency, sizeof(requested_keyframe_frequency - 1));
         if (ret < 0) {
-            fprintf(stderr, "%s: error: could not read packets\n", option_output);
-            return 1;
+            fprintf(stderr, "Could not set keyframe interval to %d.\n",
+                (int)keyframe_frequency);
+        }
+        /* Get maximum encoding speed value (trade quality for speed) */
+        int splevel;
+        ret = th_encode_ctl(td, TH_ENCCTL_GET_SPLEVEL_MAX, &splevel, sizeof(int));
+        if (ret < 0)
+            fprintf(stderr, "Could not get SPLEVEL_MAX");
+        ret = th_encode_ctl(td, TH_ENCCTL_SET_SPLEVEL, &splevel, sizeof(int));
+        if (ret < 0)
+            fprintf(stderr, "Could not set SPLEVEL");
+
+        write_headers();
+    }
+
+    bool write_frame(th_ycbcr_buffer ycbcr, int repeat, bool last) override
+    {
+        if (th_encode_ctl(td, TH_ENCCTL_SET_DUP_COUNT, &repeat, sizeof(repeat)) < 0)
+            fprintf(stderr, "Could not set repeat count to %d.\n", repeat);
+
+        if (theora_write_frame(ycbcr, last))
+            return false;
+
+        if (++fsls > 10) {
+            fflush(ogg_fp);
+            fflush(index_fp);
+            fsls = 0;
         }
+        return true;
+    }
+
+    void finish() override
+    {
+        th_encode_free(td);
 
+        ogg_page og;
+        if (ogg_stream_flush(&ogg_os, &og)) {
+            write_page(og);
+        }
+        fflush(ogg_fp);
+        fclose(ogg_fp);
+        fclose(index_fp);
+
+        ogg_stream_clear(&ogg_os);
+    }
+
+    uint64_t bytes_written() const override { return written; }
+
+private:
+    static int ilog(unsigned _v)
+    {
+        int ret;
+        for (ret = 0; _v; ret++)
+            _v >>= 1;
+        return ret;
+    }
+
+    void write_headers()
+    {
+        th_comment tc;
+        ogg_packet op;
+        ogg_page og;
+        int ret;
+
+        /* write the bitstream header packets with proper page interleave */
+        th_comment_init(&tc);
+        /* first packet will get its own page automatically */
+        if (th_encode_flushheader(td, &tc, &op) <= 0) {
+            fprintf(stderr, "Internal Theora library error.\n");
+            exit(1);
+        }
+        th_comment_clear(&tc);
         ogg_stream_packetin(&ogg_os, &op);
-        while (ogg_stream_pageout(&ogg_os, &og)) {
-            fwrite(og.header, og.header_len, 1, ogg_fp);
-            fwrite(og.body, og.body_len, 1, ogg_fp);
+        if (ogg_stream_pageout(&ogg_os, &og) != 1) {
+            fprintf(stderr, "Internal Ogg library error.\n");
+            exit(1);
+        }
+        write_page(og);
+        /* create the remaining theora headers */
+        for (;;) {
+            ret = th_encode_flushheader(td, &tc, &op);
+            if (ret < 0) {
+                fprintf(stderr, "Internal Theora library error.\n");
+                exit(1);
+            } else if (!ret)
+                break;
+            ogg_stream_packetin(&ogg_os, &op);
+        }
+        /* Flush the rest of our headers. This ensures
+       the actual data in each stream will start
+       on a new page, as per spec. */
+        for (;;) {
+            int result = ogg_stream_flush(&ogg_os, &og);
+            if (result < 0) {
+                /* can't get here */
+                fprintf(stderr, "Internal Ogg library error.\n");
+                exit(1);
+            }
+            if (result == 0)
+                break;
+            write_page(og);
         }
     }
+
+    int theora_write_frame(th_ycbcr_buffer ycbcr, int last)
+    {
+        ogg_packet op;
+        ogg_page og;
+        assert(ogg_fp);
+
+        /* Theora is a one-frame-in,one-frame-out system; submit a frame
+       for compression and pull out the packet */
+        if (th_encode_ycbcr_in(td, ycbcr)) {
+            fprintf(stderr, "%s: error: could not encode frame\n", path);
+            return 1;
+        }
+
+        // the frame packet is followed by an empty packet for each repetition
+        frame_index::Entry entry;
+        while (true) {
+            int ret = th_encode_packetout(td, last, &op);
+            if (ret == 0)
+                break;
+
+            if (ret < 0) {
+                fprintf(stderr, "%s: error: could not read packets\n", path);
+                return 1;
+            }
+
+            if (!entry.frame_count) {
+                // let keyframes start on a new page so decoding can start right there
+                if (is_keyframe(op)) {
+                    while (ogg_stream_flush(&ogg_os, &og)) {
+                        write_page(og);
+                    }
+                    keyframe_frame = frame_number;
+                    keyframe_offset = static_cast<uint64_t>(ftello(ogg_fp));
+                    entry.flags |= frame_index::keyframe_flag;
+                }
+                entry.first_frame = frame_number;
+                entry.keyframe_frame = keyframe_frame;
+                entry.keyframe_offset = keyframe_offset;
+                entry.page_offset = static_cast<uint64_t>(ftello(ogg_fp));
+            }
+            ++entry.frame_count;
+            ++frame_number;
+
+            ogg_stream_packetin(&ogg_os, &op);
+            while (ogg_stream_pageout(&ogg_os, &og)) {
+                write_page(og);
+            }
+        }
+        if (entry.frame_count && !frame_index::write_entry(index_fp, entry))
+            fprintf(stderr, "%s: error: could not write index\n", path);
+        return 0;
+    }
+
+    void write_page(const ogg_page& og)
+    {
+        fwrite(og.header, og.header_len, 1, ogg_fp);
+        fwrite(og.body, og.body_len, 1, ogg_fp);
+        written += static_cast<uint64_t>(og.header_len + og.body_len);
+    }
+
+    // checks the packet type (data) and frame type (intra) bits of a Theora data packet
+    static bool is_keyframe(const ogg_packet& op) { return op.bytes > 0 && !(op.packet[0] & 0xC0); }
+
+    const char* path;
+    FILE* ogg_fp = nullptr;
+    FILE* index_fp = nullptr;
+    ogg_stream_state ogg_os;
+    th_enc_ctx* td = nullptr;
+    int fsls = 0; // frames since last sync
+    uint64_t written = 0;
+    uint32_t frame_number = 0;
+    uint32_t keyframe_frame = 0;
+    uint64_t keyframe_offset = 0;
+};
+
+#if defined(HAVE_VPX) || defined(HAVE_AOM)
+
+typedef vector<uint8_t> Buffer;
+
+static void ebml_id(Buffer& buffer, uint32_t id)
+{
+    // the length of an element ID is encoded within its first byte
+    const int length = id >= 0x1000000 ? 4 : id >= 0x10000 ? 3 : id >= 0x100 ? 2 : 1;
+    for (int i = length - 1; i >= 0; i--)
+        buffer.push_back(static_cast<uint8_t>(id >> (8 * i)));
 }
 
-static unsigned char clamp(int d)
+static void ebml_size(Buffer& buffer, uint64_t size, int length = 0)
 {
-    if (d < 0)
-        return 0;
+    // use the shortest variable-length integer unless a fixed length is requested; all ones is reserved
+    if (!length)
+        for (length = 1; length < 8 && size >= (uint64_t(1) << (7 * length)) - 1;)
+            length++;
+    buffer.push_back(static_cast<uint8_t>((0x80 >> (length - 1)) | (size >> (8 * (length - 1)))));
+    for (int i = length - 2; i >= 0; i--)
+        buffer.push_back(static_cast<uint8_t>(size >> (8 * i)));
+}
 
-    if (d > 255)
-        return 255;
+static void ebml_binary(Buffer& buffer, uint32_t id, const void* data, size_t size)
+{
+    ebml_id(buffer, id);
+    ebml_size(buffer, size);
+    const auto bytes = static_cast<const uint8_t*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+static void ebml_string(Buffer& buffer, uint32_t id, const char* value) { ebml_binary(buffer, id, value, strlen(value)); }
 
-    return d;
+static void ebml_master(Buffer& buffer, uint32_t id, const Buffer& content) { ebml_binary(buffer, id, content.data(), content.size()); }
+
+static void ebml_uint(Buffer& buffer, uint32_t id, uint64_t value)
+{
+    int length = 1;
+    while (length < 8 && value >> (8 * length))
+        length++;
+    ebml_id(buffer, id);
+    ebml_size(buffer, length);
+    for (int i = length - 1; i >= 0; i--)
+        buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
 }
 
-using namespace cv;
+static void ebml_float(Buffer& buffer, uint32_t id, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ebml_id(buffer, id);
+    ebml_size(buffer, sizeof(bits));
+    for (int i = 7; i >= 0; i--)
+        buffer.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+}
 
-void rgb_to_yuv(Mat* image, th_ycbcr_buffer ycbcr, int xres, int yres)
+// appends a Void element occupying exactly the specified number of bytes (at least 2)
+static void ebml_void(Buffer& buffer, size_t total_size)
 {
-    unsigned int x;
-    unsigned int y;
+    ebml_id(buffer, 0xEC);
+    const int size_length = total_size - 2 < 127 ? 1 : 8;
+    ebml_size(buffer, total_size - 1 - size_length, size_length);
+    buffer.insert(buffer.end(), total_size - 1 - size_length, 0);
+}
+
+/*
+ * minimal WebM muxer for a single video track
+ *
+ * Clusters are started at keyframes and written as a whole so everything up to the last complete
+ * cluster stays playable if the encoder is killed. The segment size, the duration, the cues and
+ * the seek head are filled in when finishing the file.
+ */
+class WebmWriter {
+public:
+    bool open(const char* path, const char* codec_id, int width, int height, const Buffer& codec_private)
+    {
+        if (!(fp = fopen(path, "wb"))) {
+            fprintf(stderr, "%s: error: couldn't open output file\n", path);
+            return false;
+        }
+
+        Buffer header, content;
+        ebml_uint(content, 0x4286, 1); // EBMLVersion
+        ebml_uint(content, 0x42F7, 1); // EBMLReadVersion
+        ebml_uint(content, 0x42F2, 4); // EBMLMaxIDLength
+        ebml_uint(content, 0x42F3, 8); // EBMLMaxSizeLength
+        ebml_string(content, 0x4282, "webm"); // DocType
+        ebml_uint(content, 0x4287, 4); // DocTypeVersion
+        ebml_uint(content, 0x4285, 2); // DocTypeReadVersion
+        ebml_master(header, 0x1A45DFA3, content);
+
+        // Segment with unknown size until finished
+        ebml_id(header, 0x18538067);
+        segment_size_pos = static_cast<off_t>(header.size());
+        ebml_size(header, (uint64_t(1) << 56) - 1, 8);
+        segment_data_pos = static_cast<off_t>(header.size());
+
+        // space for the SeekHead written when finishing
+        seek_head_pos = static_cast<off_t>(header.size());
+        ebml_void(header, seek_head_space);
+
+        // Info with Duration last so its position is known
+        info_pos = static_cast<off_t>(header.size());
+        content.clear();
+        ebml_uint(content, 0x2AD7B1, 1000000); // TimecodeScale, timecodes are in milliseconds
+        ebml_string(content, 0x4D80, "os-autoinst videoencoder"); // MuxingApp
+        ebml_string(content, 0x5741, "os-autoinst videoencoder"); // WritingApp
+        ebml_float(content, 0x4489, 0.0); // Duration
+        ebml_master(header, 0x1549A966, content);
+        duration_pos = static_cast<off_t>(header.size()) - 8;
+
+        tracks_pos = static_cast<off_t>(header.size());
+        Buffer video, track;
+        ebml_uint(video, 0xB0, width); // PixelWidth
+        ebml_uint(video, 0xBA, height); // PixelHeight
+        ebml_uint(track, 0xD7, 1); // TrackNumber
+        ebml_uint(track, 0x73C5, 1); // TrackUID
+        ebml_uint(track, 0x83, 1); // TrackType: video
+        ebml_uint(track, 0x9C, 0); // FlagLacing
+        ebml_uint(track, 0x23E383, 1000000000 / fps); // DefaultDuration
+        ebml_string(track, 0x86, codec_id); // CodecID
+        if (!codec_private.empty())
+            ebml_binary(track, 0x63A2, codec_private.data(), codec_private.size()); // CodecPrivate
+        ebml_master(track, 0xE0, video); // Video
+        content.clear();
+        ebml_master(content, 0xAE, track); // TrackEntry
+        ebml_master(header, 0x1654AE6B, content); // Tracks
+
+        return write(header);
+    }
+
+    bool write_frame(const void* data, size_t size, int64_t timecode, bool keyframe)
+    {
+        // block timecodes are relative to the cluster and stored as 16-bit signed integers
+        if (keyframe || cluster_timecode < 0 || timecode - cluster_timecode > INT16_MAX) {
+            if (!write_cluster())
+                return false;
+            cluster_timecode = timecode;
+            cluster_keyframe = keyframe;
+            ebml_uint(cluster, 0xE7, static_cast<uint64_t>(timecode)); // Timecode
+        }
+        const auto relative_timecode = static_cast<int16_t>(timecode - cluster_timecode);
+        ebml_id(cluster, 0xA3); // SimpleBlock
+        ebml_size(cluster, 4 + size);
+        cluster.push_back(0x81); // track number
+        cluster.push_back(static_cast<uint8_t>(relative_timecode >> 8));
+        cluster.push_back(static_cast<uint8_t>(relative_timecode));
+        cluster.push_back(keyframe ? 0x80 : 0x00);
+        const auto bytes = static_cast<const uint8_t*>(data);
+        cluster.insert(cluster.end(), bytes, bytes + size);
+        return true;
+    }
 
-    unsigned long yuv_w;
+    bool finish(int64_t duration)
+    {
+        if (!write_cluster())
+            return false;
+
+        Buffer cues;
+        const off_t cues_pos = ftello(fp) - segment_data_pos;
+        for (const auto& cue : cue_points) {
+            Buffer cue_point, positions;
+            ebml_uint(positions, 0xF7, 1); // CueTrack
+            ebml_uint(positions, 0xF1, cue.second); // CueClusterPosition
+            ebml_uint(cue_point, 0xB3, cue.first); // CueTime
+            ebml_master(cue_point, 0xB7, positions); // CueTrackPositions
+            ebml_master(cues, 0xBB, cue_point); // CuePoint
+        }
+        Buffer content;
+        if (!cue_points.empty()) {
+            ebml_master(content, 0x1C53BB6B, cues);
+            if (!write(content))
+                return false;
+        }
+        const off_t end_pos = ftello(fp);
+
+        Buffer seek_head, seeks;
+        const pair<uint32_t, uint64_t> elements[] = {
+            { 0x1549A966, static_cast<uint64_t>(info_pos - segment_data_pos) },
+            { 0x1654AE6B, static_cast<uint64_t>(tracks_pos - segment_data_pos) },
+            { 0x1C53BB6B, static_cast<uint64_t>(cues_pos) },
+        };
+        for (const auto& element : elements) {
+            if (element.first == 0x1C53BB6B && cue_points.empty())
+                continue;
+            Buffer seek, id;
+            ebml_id(id, element.first);
+            ebml_binary(seek, 0x53AB, id.data(), id.size()); // SeekID
+            ebml_uint(seek, 0x53AC, element.second); // SeekPosition
+            ebml_master(seeks, 0x4DBB, seek); // Seek
+        }
+        ebml_master(seek_head, 0x114D9B74, seeks);
+        assert(seek_head.size() + 2 <= seek_head_space);
+        ebml_void(seek_head, seek_head_space - seek_head.size());
+
+        Buffer duration_value;
+        ebml_float(duration_value, 0x4489, static_cast<double>(duration));
+        Buffer segment_size;
+        ebml_size(segment_size, static_cast<uint64_t>(end_pos - segment_data_pos), 8);
+
+        const bool ok = write_at(seek_head_pos, seek_head.data(), seek_head.size())
+            && write_at(duration_pos, duration_value.data() + duration_value.size() - 8, 8)
+            && write_at(segment_size_pos, segment_size.data(), segment_size.size());
+        return !fclose(fp) && ok;
+    }
 
-    unsigned char* yuv_y;
-    unsigned char* yuv_u;
-    unsigned char* yuv_v;
+    uint64_t bytes_written() const { return written; }
 
-    unsigned long w, h;
-    w = yuv_w = xres;
-    /* Must hold: yuv_h >= h */
-    h = yres;
+private:
+    static constexpr size_t seek_head_space = 128;
 
-    yuv_w = ycbcr[0].width;
+    bool write(const Buffer& buffer)
+    {
+        written += buffer.size();
+        return fwrite(buffer.data(), buffer.size(), 1, fp) == 1;
+    }
 
-    yuv_y = ycbcr[0].data;
-    yuv_u = ycbcr[1].data;
-    yuv_v = ycbcr[2].data;
+    bool write_at(off_t pos, const uint8_t* data, size_t size)
+    {
+        return !fseeko(fp, pos, SEEK_SET) && fwrite(data, size, 1, fp) == 1;
+    }
+
+    bool write_cluster()
+    {
+        if (cluster.empty())
+            return true;
+        const off_t pos = ftello(fp);
+        if (cluster_keyframe)
+            cue_points.emplace_back(cluster_timecode, pos - segment_data_pos);
+        Buffer header;
+        ebml_id(header, 0x1F43B675); // Cluster
+        ebml_size(header, cluster.size());
+        const bool ok = write(header) && write(cluster) && !fflush(fp);
+        cluster.clear();
+        return ok;
+    }
 
-    /*This ignores gamma and RGB primary/whitepoint differences.
-   It also isn't terribly fast (though a decent compiler will
-   strength-reduce the division to a multiplication). */
+    FILE* fp = nullptr;
+    uint64_t written = 0;
+    off_t segment_size_pos = 0, segment_data_pos = 0, seek_head_pos = 0, info_pos = 0, duration_pos = 0, tracks_pos = 0;
+    Buffer cluster;
+    int64_t cluster_timecode = -1;
+    bool cluster_keyframe = false;
+    vector<pair<uint64_t, uint64_t>> cue_points; // timecode and cluster position
+};
 
-    for (y = 0; y < h; y++) {
-        for (x = 0; x < w; x++) {
-            unsigned char b = image->data[image->channels() * (image->cols * y + x) + 0];
-            unsigned char g = image->data[image->channels() * (image->cols * y + x) + 1];
-            unsigned char r = image->data[image->channels() * (image->cols * y + x) + 2];
+static unsigned int encoder_threads()
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return static_cast<unsigned int>(std::max(1L, std::min(4L, cpus)));
+}
 
-            yuv_y[x + y * yuv_w] = clamp((65481 * r + 128553 * g + 24966 * b + 4207500) / 255000);
-            yuv_u[x + y * yuv_w] = clamp((-33488 * r - 65744 * g + 99232 * b + 29032005) / 225930);
-            yuv_v[x + y * yuv_w] = clamp((157024 * r - 131488 * g - 25536 * b + 45940035) / 357510);
+// base for encoders which produce WebM; frame timestamps are counted in frame durations
+class WebmSink : public Sink {
+public:
+    WebmSink()
+        : Sink(TH_PF_420)
+    {
+    }
+
+    uint64_t bytes_written() const override { return webm.bytes_written(); }
+
+protected:
+    static int64_t timecode(int64_t pts) { return (pts * 1000 + fps / 2) / fps; }
+
+    WebmWriter webm;
+    int64_t pts = 0;
+};
+
+#endif
+
+#ifdef HAVE_VPX
+class VpxSink : public WebmSink {
+public:
+    bool open(const char* path, int w, int h)
+    {
+        vpx_codec_enc_cfg_t cfg;
+        if (vpx_codec_enc_config_default(vpx_codec_vp9_cx(), &cfg, 0)) {
+            fprintf(stderr, "%s: error: unable to get the default VP9 configuration\n", path);
+            return false;
+        }
+        cfg.g_w = w;
+        cfg.g_h = h;
+        cfg.g_timebase.num = 1;
+        cfg.g_timebase.den = fps;
+        cfg.g_threads = encoder_threads();
+        cfg.g_lag_in_frames = 0; // frames are supposed to be written as they come in
+        cfg.rc_end_usage = VPX_Q;
+        cfg.kf_max_dist = keyframe_frequency;
+        if (vpx_codec_enc_init(&codec, vpx_codec_vp9_cx(), &cfg, 0)) {
+            fprintf(stderr, "%s: error: unable to initialize VP9 encoder: %s\n", path, vpx_codec_error_detail(&codec));
+            return false;
         }
+        initialized = true;
+        vpx_codec_control(&codec, VP8E_SET_CPUUSED, 8);
+        vpx_codec_control(&codec, VP8E_SET_CQ_LEVEL, 35);
+        vpx_codec_control(&codec, VP9E_SET_ROW_MT, 1);
+        vpx_codec_control(&codec, VP9E_SET_TILE_COLUMNS, 2);
+        vpx_codec_control(&codec, VP9E_SET_TUNE_CONTENT, VP9E_CONTENT_SCREEN);
+        return webm.open(path, "V_VP9", w, h, Buffer());
     }
+
+    ~VpxSink() override
+    {
+        if (initialized)
+            vpx_codec_destroy(&codec);
+    }
+
+    bool write_frame(th_ycbcr_buffer ycbcr, int repeat, bool last) override
+    {
+        (void)last;
+        vpx_image_t image;
+        vpx_img_wrap(&image, VPX_IMG_FMT_I420, ycbcr[0].width, ycbcr[0].height, 1, ycbcr[0].data);
+        for (int plane = 0; plane < 3; plane++) {
+            image.planes[plane] = ycbcr[plane].data;
+            image.stride[plane] = ycbcr[plane].stride;
+        }
+        if (vpx_codec_encode(&codec, &image, pts, 1 + repeat, 0, VPX_DL_REALTIME)) {
+            fprintf(stderr, "Could not encode VP9 frame: %s\n", vpx_codec_error_detail(&codec));
+            return false;
+        }
+        pts += 1 + repeat;
+        return write_packets();
+    }
+
+    void finish() override
+    {
+        if (vpx_codec_encode(&codec, nullptr, pts, 1, 0, VPX_DL_REALTIME) || !write_packets() || !webm.finish(timecode(pts)))
+            fprintf(stderr, "Could not finish VP9 video\n");
+    }
+
+private:
+    bool write_packets()
+    {
+        vpx_codec_iter_t iter = nullptr;
+        while (const vpx_codec_cx_pkt_t* packet = vpx_codec_get_cx_data(&codec, &iter)) {
+            if (packet->kind != VPX_CODEC_CX_FRAME_PKT)
+                continue;
+            const auto& frame = packet->data.frame;
+            if (!webm.write_frame(frame.buf, frame.sz, timecode(frame.pts), frame.flags & VPX_FRAME_IS_KEY))
+                return false;
+        }
+        return true;
+    }
+
+    vpx_codec_ctx_t codec;
+    bool initialized = false;
+};
+#endif
+
+#ifdef HAVE_AOM
+// reads the bits of an OBU payload most significant bit first
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size)
+        : data(data)
+        , size(size)
+    {
+    }
+    unsigned int read(int bits)
+    {
+        unsigned int value = 0;
+        for (; bits > 0; bits--, pos++)
+            value = (value << 1) | (pos / 8 < size ? (data[pos / 8] >> (7 - pos % 8)) & 1 : 0);
+        return value;
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+/*
+ * creates the AV1CodecConfigurationRecord (av1C) required as CodecPrivate from the sequence
+ * header OBU as returned by aom_codec_get_global_headers
+ */
+static Buffer av1_codec_private(const uint8_t* obus, size_t size)
+{
+    unsigned int profile = 0, level = 31; // level 31 means "unspecified"
+    if (size > 2 && ((obus[0] >> 3) & 0xF) == 1) { // OBU_SEQUENCE_HEADER
+        size_t offset = 1 + ((obus[0] >> 2) & 1); // skip the extension header if present
+        if (obus[0] & 2) // skip the LEB128 size field if present
+            while (offset < size && obus[offset++] & 0x80)
+                ;
+        BitReader reader(obus + offset, size - offset);
+        profile = reader.read(3);
+        reader.read(1); // still_picture
+        if (reader.read(1)) // reduced_still_picture_header
+            level = reader.read(5);
+        else if (!reader.read(1)) { // timing_info_present_flag, determining the level is not worth it otherwise
+            reader.read(1); // initial_display_delay_present_flag
+            reader.read(5); // operating_points_cnt_minus_1
+            reader.read(12); // operating_point_idc[0]
+            level = reader.read(5);
+        }
+    }
+    Buffer config = {
+        0x81, // marker and version
+        static_cast<uint8_t>(profile << 5 | level),
+        0x0C, // tier 0, 8-bit, 4:2:0 with unknown chroma sample position
+        0x00, // no initial presentation delay
+    };
+    config.insert(config.end(), obus, obus + size);
+    return config;
 }
 
-static int ilog(unsigned _v)
+class AomSink : public WebmSink {
+public:
+    bool open(const char* path, int w, int h)
+    {
+        aom_codec_enc_cfg_t cfg;
+        if (aom_codec_enc_config_default(aom_codec_av1_cx(), &cfg, AOM_USAGE_REALTIME)) {
+            fprintf(stderr, "%s: error: unable to get the default AV1 configuration\n", path);
+            return false;
+        }
+        cfg.g_w = w;
+        cfg.g_h = h;
+        cfg.g_timebase.num = 1;
+        cfg.g_timebase.den = fps;
+        cfg.g_threads = encoder_threads();
+        cfg.g_lag_in_frames = 0; // frames are supposed to be written as they come in
+        cfg.rc_end_usage = AOM_Q;
+        cfg.kf_max_dist = keyframe_frequency;
+        if (aom_codec_enc_init(&codec, aom_codec_av1_cx(), &cfg, 0)) {
+            fprintf(stderr, "%s: error: unable to initialize AV1 encoder: %s\n", path, aom_codec_error_detail(&codec));
+            return false;
+        }
+        initialized = true;
+        aom_codec_control(&codec, AOME_SET_CPUUSED, 8);
+        aom_codec_control(&codec, AOME_SET_CQ_LEVEL, 40);
+        aom_codec_control(&codec, AV1E_SET_ROW_MT, 1);
+        aom_codec_control(&codec, AV1E_SET_TILE_COLUMNS, 2);
+        aom_codec_control(&codec, AV1E_SET_TUNE_CONTENT, AOM_CONTENT_SCREEN);
+
+        aom_fixed_buf_t* sequence_header = aom_codec_get_global_headers(&codec);
+        if (!sequence_header) {
+            fprintf(stderr, "%s: error: unable to get AV1 sequence header\n", path);
+            return false;
+        }
+        const auto codec_private = av1_codec_private(static_cast<const uint8_t*>(sequence_header->buf), sequence_header->sz);
+        free(sequence_header->buf);
+        free(sequence_header);
+        return webm.open(path, "V_AV1", w, h, codec_private);
+    }
+
+    ~AomSink() override
+    {
+        if (initialized)
+            aom_codec_destroy(&codec);
+    }
+
+    bool write_frame(th_ycbcr_buffer ycbcr, int repeat, bool last) override
+    {
+        (void)last;
+        aom_image_t image;
+        aom_img_wrap(&image, AOM_IMG_FMT_I420, ycbcr[0].width, ycbcr[0].height, 1, ycbcr[0].data);
+        for (int plane = 0; plane < 3; plane++) {
+            image.planes[plane] = ycbcr[plane].data;
+            image.stride[plane] = ycbcr[plane].stride;
+        }
+        if (aom_codec_encode(&codec, &image, pts, 1 + repeat, 0)) {
+            fprintf(stderr, "Could not encode AV1 frame: %s\n", aom_codec_error_detail(&codec));
+            return false;
+        }
+        pts += 1 + repeat;
+        return write_packets();
+    }
+
+    void finish() override
+    {
+        if (aom_codec_encode(&codec, nullptr, pts, 1, 0) || !write_packets() || !webm.finish(timecode(pts)))
+            fprintf(stderr, "Could not finish AV1 video\n");
+    }
+
+private:
+    bool write_packets()
+    {
+        aom_codec_iter_t iter = nullptr;
+        while (const aom_codec_cx_pkt_t* packet = aom_codec_get_cx_data(&codec, &iter)) {
+            if (packet->kind != AOM_CODEC_CX_FRAME_PKT)
+                continue;
+            const auto& frame = packet->data.frame;
+            auto data = static_cast<const uint8_t*>(frame.buf);
+            auto size = frame.sz;
+            // temporal delimiters are implied by the blocks in Matroska and should be removed
+            if (size >= 2 && data[0] == 0x12 && data[1] == 0x00) {
+                data += 2;
+                size -= 2;
+            }
+            if (!webm.write_frame(data, size, timecode(frame.pts), frame.flags & AOM_FRAME_IS_KEY))
+                return false;
+        }
+        return true;
+    }
+
+    aom_codec_ctx_t codec;
+    bool initialized = false;
+};
+#endif
+
+static const char* const supported_codecs[] = {
+    "theora",
+#ifdef HAVE_VPX
+    "vp9",
+#endif
+#ifdef HAVE_AOM
+    "av1",
+#endif
+};
+
+// creates a sink from "CODEC:PATH" as passed via '-o'
+static unique_ptr<Sink> create_sink(const string& output, int w, int h, th_pixel_fmt pixel_fmt)
 {
-    int ret;
-    for (ret = 0; _v; ret++)
-        _v >>= 1;
-    return ret;
+    const auto separator = output.find(':');
+    if (separator == string::npos) {
+        fprintf(stderr, "Output %s is not specified as CODEC:PATH\n", output.c_str());
+        return nullptr;
+    }
+    const auto codec = output.substr(0, separator);
+    const auto path = output.c_str() + separator + 1;
+    if (codec == "theora")
+        return unique_ptr<Sink>(new TheoraSink(path, w, h, pixel_fmt));
+#ifdef HAVE_VPX
+    if (codec == "vp9") {
+        unique_ptr<VpxSink> sink(new VpxSink);
+        return sink->open(path, w, h) ? move(sink) : nullptr;
+    }
+#endif
+#ifdef HAVE_AOM
+    if (codec == "av1") {
+        unique_ptr<AomSink> sink(new AomSink);
+        return sink->open(path, w, h) ? move(sink) : nullptr;
+    }
+#endif
+    fprintf(stderr, "Unsupported codec %s (see -L for supported codecs)\n", codec.c_str());
+    return nullptr;
 }
 
-bool need_last_png() { return !access("live_log", R_OK); }
+/*
+ * writes the PNGs for the live log within a background thread so encoding is not delayed
+ *
+ * Only the newest submitted frame is written and at most `max_rate` PNGs per second. Whether the
+ * live log is enabled (file "live_log" exists) is tracked via inotify so checking is cheap.
+ */
+class LiveLogWriter {
+public:
+    explicit LiveLogWriter(double max_rate)
+        : interval(max_rate > 0 ? chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / max_rate)) : chrono::steady_clock::duration::zero())
+    {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, ".", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB) < 0) {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+        if (inotify_fd < 0)
+            perror("Unable to watch for live_log, checking periodically instead");
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            perror("Unable to create eventfd");
+            exit(1);
+        }
+        update_enabled();
+        worker = thread(&LiveLogWriter::run, this);
+    }
 
-int main(int argc, char* argv[])
+    ~LiveLogWriter()
+    {
+        stop = true;
+        notify();
+        worker.join();
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+        close(event_fd);
+    }
+
+    bool enabled() const { return live_log.load(memory_order_relaxed); }
+    uint64_t pngs_written() const { return written.load(memory_order_relaxed); }
+
+    // copies the frame as the caller's buffer might be reused (e.g. the frame ring slot is released)
+    void submit(const Mat& frame)
+    {
+        {
+            lock_guard<mutex> lock(pending_mutex);
+            frame.copyTo(pending);
+            has_pending = true;
+        }
+        notify();
+    }
+
+private:
+    void notify()
+    {
+        const uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("Unable to notify live log writer");
+    }
+
+    void update_enabled() { live_log.store(!access("live_log", R_OK), memory_order_relaxed); }
+
+    void handle_inotify_events()
+    {
+        alignas(inotify_event) char events[4096];
+        bool relevant = false;
+        ssize_t len;
+        while ((len = read(inotify_fd, events, sizeof(events))) > 0)
+            for (char* p = events; p < events + len;) {
+                const auto event = reinterpret_cast<const inotify_event*>(p);
+                relevant = relevant || (event->len && !strcmp(event->name, "live_log"));
+                p += sizeof(inotify_event) + event->len;
+            }
+        if (relevant)
+            update_enabled();
+    }
+
+    void run()
+    {
+        Mat frame;
+        auto next_write = chrono::steady_clock::now();
+        while (!stop) {
+            int timeout = inotify_fd < 0 ? 1000 : -1;
+            bool pending_frame;
+            {
+                lock_guard<mutex> lock(pending_mutex);
+                pending_frame = has_pending;
+            }
+            const auto now = chrono::steady_clock::now();
+            if (pending_frame && now < next_write) {
+                const auto wait = chrono::duration_cast<chrono::milliseconds>(next_write - now).count() + 1;
+                timeout = timeout < 0 ? static_cast<int>(wait) : std::min(timeout, static_cast<int>(wait));
+            } else if (pending_frame)
+                timeout = 0;
+
+            pollfd fds[] = { { event_fd, POLLIN, 0 }, { inotify_fd, POLLIN, 0 } };
+            if (poll(fds, inotify_fd < 0 ? 1 : 2, timeout) < 0 && errno != EINTR) {
+                perror("Unable to poll within live log writer");
+                return;
+            }
+            if (fds[0].revents & POLLIN) {
+                uint64_t count;
+                if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("Unable to read eventfd");
+            }
+            if (inotify_fd < 0)
+                update_enabled();
+            else if (fds[1].revents & POLLIN)
+                handle_inotify_events();
+
+            if (chrono::steady_clock::now() < next_write)
+                continue;
+            {
+                lock_guard<mutex> lock(pending_mutex);
+                if (!has_pending)
+                    continue;
+                std::swap(frame, pending);
+                has_pending = false;
+            }
+            if (write_png(frame))
+                written.fetch_add(1, memory_order_relaxed);
+            next_write = chrono::steady_clock::now() + interval;
+        }
+    }
+
+    static bool write_png(const Mat& frame)
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "qemuscreenshot/%ld.%ld.png", tv.tv_sec, tv.tv_usec);
+        if (!imwrite(path, frame, { IMWRITE_PNG_COMPRESSION, 1 }))
+            return false;
+        // replace the symlink atomically so readers never miss last.png
+        unlink("qemuscreenshot/.last.png.tmp");
+        if (symlink(basename(path), "qemuscreenshot/.last.png.tmp") || rename("qemuscreenshot/.last.png.tmp", "qemuscreenshot/last.png")) {
+            perror("Unable to update qemuscreenshot/last.png");
+            unlink("qemuscreenshot/.last.png.tmp");
+        }
+        return true;
+    }
+
+    const chrono::steady_clock::duration interval;
+    int inotify_fd = -1;
+    int event_fd = -1;
+    atomic<bool> live_log { false };
+    atomic<bool> stop { false };
+    atomic<uint64_t> written { 0 };
+    mutex pending_mutex;
+    Mat pending;
+    bool has_pending = false;
+    thread worker;
+};
+
+/*
+ * statistics about the load of the encoder written as JSON lines to the file descriptor passed
+ * via '-S'; counters are totals since the start while the times of the stages are percentiles
+ * (in milliseconds) of the last interval
+ */
+class Stats {
+public:
+    enum Stage { decode, convert, encode, io, stage_count };
+
+    // measures the time spent within a stage until going out of scope
+    class Timer {
+    public:
+        Timer(Stats& stats, Stage stage)
+            : stats(stats)
+            , stage(stage)
+            , start(chrono::steady_clock::now())
+        {
+        }
+        ~Timer()
+        {
+            if (stats.enabled())
+                stats.samples[stage].push_back(chrono::duration<float, milli>(chrono::steady_clock::now() - start).count());
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        Stats& stats;
+        const Stage stage;
+        const chrono::steady_clock::time_point start;
+    };
+
+    void open(int stats_fd, double interval_seconds)
+    {
+        // never block encoding because nobody reads the statistics
+        fd = stats_fd;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(interval_seconds));
+        last_report = started = chrono::steady_clock::now();
+    }
+
+    bool enabled() const { return fd >= 0; }
+    bool due() const { return enabled() && chrono::steady_clock::now() - last_report >= interval; }
+
+    void report(uint64_t bytes_written, uint64_t live_pngs, const frame_ring::Header* ring, bool final)
+    {
+        const auto now = chrono::steady_clock::now();
+        int pipe_bytes = 0;
+        ioctl(STDIN_FILENO, FIONREAD, &pipe_bytes);
+        string line = format("{\"elapsed\":%.3f,\"interval\":%.3f,\"frames_in\":%" PRIu64 ",\"frames_out\":%" PRIu64
+                             ",\"repeats\":%" PRIu64 ",\"pipe_bytes\":%d,\"bytes_written\":%" PRIu64 ",\"live_pngs\":%" PRIu64,
+            chrono::duration<double>(now - started).count(), chrono::duration<double>(now - last_report).count(),
+            frames_in, frames_out, repeats, pipe_bytes, bytes_written, live_pngs);
+        if (ring)
+            line += format(",\"ring_pending\":%" PRIu64, ring->produced.load(memory_order_relaxed) - ring->released.load(memory_order_relaxed));
+        static const char* const stage_names[stage_count] = { "decode", "convert", "encode", "io" };
+        for (int stage = 0; stage < stage_count; stage++) {
+            auto& times = samples[stage];
+            sort(times.begin(), times.end());
+            const auto percentile = [&times](double p) { return times.empty() ? 0.0 : times[std::min(times.size() - 1, static_cast<size_t>(p * times.size()))]; };
+            line += format(",\"%s\":{\"count\":%zu,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}", stage_names[stage],
+                times.size(), percentile(0.5), percentile(0.9), percentile(0.99), times.empty() ? 0.0 : times.back());
+            times.clear();
+        }
+        line += final ? ",\"final\":true}\n" : "}\n";
+        if (write(fd, line.data(), line.size()) < 0 && errno != EAGAIN)
+            perror("Unable to write statistics");
+        last_report = now;
+    }
+
+    uint64_t frames_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t repeats = 0;
+
+private:
+    __attribute__((format(printf, 1, 2))) static string format(const char* pattern, ...)
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, pattern);
+        vsnprintf(buffer, sizeof(buffer), pattern, args);
+        va_end(args);
+        return buffer;
+    }
+
+    int fd = -1;
+    chrono::steady_clock::duration interval;
+    chrono::steady_clock::time_point started, last_report;
+    vector<float> samples[stage_count];
+};
+
+static frame_ring::Header* map_frame_ring(int fd)
 {
-    th_comment tc;
-    int ret;
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < frame_ring::header_size) {
+        fprintf(stderr, "Frame ring fd %d is not usable\n", fd);
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Unable to map frame ring");
+        return nullptr;
+    }
+    auto header = static_cast<frame_ring::Header*>(mapping);
+    if (header->magic != frame_ring::magic || header->version != frame_ring::version
+        || frame_ring::mapping_size(header->slot_count, header->slot_size) > static_cast<size_t>(st.st_size)) {
+        fprintf(stderr, "Frame ring has an unexpected layout\n");
+        munmap(mapping, st.st_size);
+        return nullptr;
+    }
+    return header;
+}
+
+// converts a decoded frame from studio range BT.601 YCbCr back to BGR
+static Mat ycbcr_to_bgr(th_ycbcr_buffer ycbcr, const th_info& info)
+{
+    const int hdec = !(info.pixel_fmt & 1), vdec = !(info.pixel_fmt & 2);
+    Mat image(static_cast<int>(info.pic_height), static_cast<int>(info.pic_width), CV_8UC3);
+    for (int y = 0; y < image.rows; y++) {
+        const int frame_y = static_cast<int>(info.pic_y) + y;
+        const unsigned char* luma = ycbcr[0].data + frame_y * ycbcr[0].stride;
+        const unsigned char* cb = ycbcr[1].data + (frame_y >> vdec) * ycbcr[1].stride;
+        const unsigned char* cr = ycbcr[2].data + (frame_y >> vdec) * ycbcr[2].stride;
+        unsigned char* out = image.ptr<unsigned char>(y);
+        for (int x = 0; x < image.cols; x++, out += 3) {
+            const int frame_x = static_cast<int>(info.pic_x) + x;
+            const double l = 1.164 * (luma[frame_x] - 16), u = cb[frame_x >> hdec] - 128, v = cr[frame_x >> hdec] - 128;
+            out[0] = saturate_cast<unsigned char>(l + 2.018 * u);
+            out[1] = saturate_cast<unsigned char>(l - 0.391 * u - 0.813 * v);
+            out[2] = saturate_cast<unsigned char>(l + 1.596 * v);
+        }
+    }
+    return image;
+}
 
+/*
+ * writes the specified frame of a Theora video produced by this program as PNG; the index is used
+ * to start decoding at the preceding keyframe instead of the beginning of the video
+ */
+static int extract_frame(const char* video_path, unsigned long frame, const char* png_path)
+{
+    const auto index_path = string(video_path) + ".idx";
+    FILE* index_fp = fopen(index_path.c_str(), "rb");
+    if (!index_fp || !frame_index::check_header(index_fp) || fseeko(index_fp, 0, SEEK_END)) {
+        fprintf(stderr, "%s: error: %s\n", index_path.c_str(), "no usable index");
+        return 1;
+    }
+    const auto entry_count = (static_cast<size_t>(ftello(index_fp)) - frame_index::header_size) / frame_index::entry_size;
+    frame_index::Entry entry;
+    size_t low = 0, high = entry_count;
+    bool found = false;
+    while (!found && low < high) {
+        const auto middle = low + (high - low) / 2;
+        if (!frame_index::read_entry(index_fp, middle, entry))
+            break;
+        if (frame < entry.first_frame)
+            high = middle;
+        else if (frame >= static_cast<unsigned long>(entry.first_frame) + entry.frame_count)
+            low = middle + 1;
+        else
+            found = true;
+    }
+    fclose(index_fp);
+    if (!found) {
+        fprintf(stderr, "Frame %lu is not contained in %s\n", frame, video_path);
+        return 1;
+    }
+
+    FILE* video_fp = fopen(video_path, "rb");
+    if (!video_fp) {
+        fprintf(stderr, "%s: error: %s\n", video_path, "couldn't open video file");
+        return 1;
+    }
+    ogg_sync_state oy;
+    ogg_stream_state os;
+    ogg_page og;
+    ogg_packet op;
+    ogg_sync_init(&oy);
+    const auto next_page = [&]() {
+        while (ogg_sync_pageout(&oy, &og) != 1) {
+            char* buffer = ogg_sync_buffer(&oy, 4096);
+            const auto bytes = fread(buffer, 1, 4096, video_fp);
+            if (!bytes)
+                return false;
+            ogg_sync_wrote(&oy, static_cast<long>(bytes));
+        }
+        return true;
+    };
+
+    // the headers are needed to set up the decoder
+    th_info info;
+    th_comment comment;
+    th_setup_info* setup = nullptr;
+    th_info_init(&info);
+    th_comment_init(&comment);
+    bool stream_initialized = false;
+    int headers = 0;
+    while (headers < 3 && next_page()) {
+        if (!stream_initialized) {
+            ogg_stream_init(&os, ogg_page_serialno(&og));
+            stream_initialized = true;
+        }
+        ogg_stream_pagein(&os, &og);
+        while (headers < 3 && ogg_stream_packetout(&os, &op) == 1 && th_decode_headerin(&info, &comment, &setup, &op) > 0)
+            ++headers;
+    }
+    th_dec_ctx* decoder = headers == 3 ? th_decode_alloc(&info, setup) : nullptr;
+    th_setup_free(setup);
+    th_comment_clear(&comment);
+
+    // decode from the keyframe on, repetitions are empty packets
+    int ret = 1;
+    if (!decoder)
+        fprintf(stderr, "%s: error: %s\n", video_path, "no Theora headers found");
+    else if (fseeko(video_fp, static_cast<off_t>(entry.keyframe_offset), SEEK_SET))
+        fprintf(stderr, "%s: error: %s\n", video_path, "couldn't seek to keyframe");
+    else {
+        ogg_sync_reset(&oy);
+        ogg_stream_reset(&os);
+        unsigned long current = entry.keyframe_frame;
+        bool done = false;
+        while (!done && next_page()) {
+            ogg_stream_pagein(&os, &og);
+            while (!done && ogg_stream_packetout(&os, &op) == 1) {
+                if (th_decode_packetin(decoder, &op, nullptr) < 0) {
+                    fprintf(stderr, "%s: error: %s\n", video_path, "couldn't decode frame");
+                    done = true;
+                } else if (current++ == frame) {
+                    th_ycbcr_buffer ycbcr;
+                    th_decode_ycbcr_out(decoder, ycbcr);
+                    if (imwrite(png_path, ycbcr_to_bgr(ycbcr, info)))
+                        ret = 0;
+                    else
+                        fprintf(stderr, "%s: error: %s\n", png_path, "couldn't write image");
+                    done = true;
+                }
+            }
+        }
+        if (!done)
+            fprintf(stderr, "%s: error: %s\n", video_path, "unexpected end of video");
+    }
+
+    if (decoder)
+        th_decode_free(decoder);
+    if (stream_initialized)
+        ogg_stream_clear(&os);
+    th_info_clear(&info);
+    ogg_sync_clear(&oy);
+    fclose(video_fp);
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
     bool output_video = true;
     int xres = 1024;
     int yres = 768;
+    frame_ring::Header* ring = nullptr;
+    th_pixel_fmt pixel_fmt = TH_PF_444;
+    vector<string> outputs;
+    double live_log_rate = 4;
+    const char* extract = nullptr;
+    int stats_fd = -1;
+    double stats_interval = 10;
     int opt;
-    while ((opt = getopt(argc, argv, "nx:y:")) != -1) {
+    while ((opt = getopt(argc, argv, "LnI:S:e:f:o:p:r:x:y:")) != -1) {
         switch (opt) {
+        case 'L':
+            for (const auto codec : supported_codecs)
+                printf("%s\n", codec);
+            return 0;
         case 'n':
             output_video = false;
             break;
+        case 'I':
+            stats_interval = atof(optarg);
+            break;
+        case 'S':
+            stats_fd = atoi(optarg);
+            break;
+        case 'e':
+            extract = optarg;
+            break;
+        case 'f':
+            if (!(ring = map_frame_ring(atoi(optarg))))
+                exit(EXIT_FAILURE);
+            break;
+        case 'o':
+            outputs.emplace_back(optarg);
+            break;
+        case 'p':
+            if (!strcmp(optarg, "420"))
+                pixel_fmt = TH_PF_420;
+            else if (!strcmp(optarg, "422"))
+                pixel_fmt = TH_PF_422;
+            else if (!strcmp(optarg, "444"))
+                pixel_fmt = TH_PF_444;
+            else {
+                fprintf(stderr, "Unsupported pixel format %s (expected 420, 422 or 444)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            live_log_rate = atof(optarg);
+            break;
         case 'x':
             xres = atoi(optarg);
             break;
@@ -187,12 +1707,21 @@ int main(int argc, char* argv[])
             break;
         default: /* '?' */
             fprintf(stderr,
-                "%s: [-n] CMDS OUTPUT - reads commands from CMDS until TERMed\n",
-                argv[0]);
+                "%s: [-L] [-n] [-f FD] [-p 420|422|444] [-r RATE] [-S FD [-I SECONDS]] [-o CODEC:PATH]... CMDS OUTPUT - reads commands from CMDS until TERMed\n"
+                "%s: -e FRAME VIDEO PNG - writes the specified frame of VIDEO as PNG\n",
+                argv[0], argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (extract) {
+        if (optind != argc - 2) {
+            fprintf(stderr, "Expected VIDEO and PNG\n");
+            exit(EXIT_FAILURE);
+        }
+        return extract_frame(argv[optind], strtoul(extract, nullptr, 10), argv[optind + 1]);
+    }
+
     if (optind != argc - 1) {
         fprintf(stderr, "Expected CMDS and OUTPUT\n");
         exit(EXIT_FAILURE);
@@ -200,171 +1729,109 @@ int main(int argc, char* argv[])
 
     option_output = argv[optind];
 
-    if (output_video) {
-        ogg_fp = fopen(option_output, "wb");
-        if (!ogg_fp) {
-            fprintf(stderr, "%s: error: %s\n", option_output,
-                "couldn't open output file");
-            return 1;
-        }
+    vector<unique_ptr<Sink>> sinks;
+    if (output_video)
+        sinks.emplace_back(new TheoraSink(option_output, xres, yres, pixel_fmt));
+    for (const auto& output : outputs) {
+        auto sink = create_sink(output, xres, yres, pixel_fmt);
+        if (!sink)
+            exit(EXIT_FAILURE);
+        sinks.push_back(move(sink));
     }
 
-    srand(time(NULL));
-    if (ogg_stream_init(&ogg_os, rand())) {
-        fprintf(stderr, "%s: error: %s\n", option_output,
-            "couldn't create ogg stream state");
-        return 1;
+    // convert each frame only once per pixel format needed by the sinks
+    map<th_pixel_fmt, unique_ptr<Planes>> planes;
+    for (const auto& sink : sinks) {
+        auto& sink_planes = planes[sink->pixel_fmt];
+        if (!sink_planes)
+            sink_planes.reset(new Planes(xres, yres, sink->pixel_fmt));
     }
+    // only convert the tiles which changed since the previous frame if the backend tells us
+    vector<Rect> changed_regions;
+    bool planes_valid = false;
+    Stats stats;
+    if (stats_fd >= 0)
+        stats.open(stats_fd, stats_interval);
+    const auto bytes_written = [&sinks]() {
+        uint64_t bytes = 0;
+        for (const auto& sink : sinks)
+            bytes += sink->bytes_written();
+        return bytes;
+    };
+
+    const auto convert_frame = [&](Mat* image, const char* arguments) {
+        const Stats::Timer timer(stats, Stats::convert);
+        const bool partial = planes_valid && parse_changed_tiles(arguments, image->cols, image->rows, changed_regions);
+        for (const auto& format_planes : planes)
+            rgb_to_yuv(image, format_planes.second->ycbcr, xres, yres, partial ? &changed_regions : nullptr);
+        planes_valid = true;
+    };
+    const auto write_frame = [&](int repeat, bool last) {
+        const Stats::Timer timer(stats, Stats::encode);
+        ++stats.frames_out;
+        for (const auto& sink : sinks)
+            if (!sink->write_frame(planes[sink->pixel_fmt]->ycbcr, repeat, last)) {
+                fprintf(stderr, "Encoding error.\n");
+                exit(1);
+            }
+    };
 
-    int w = xres;
-    int h = yres;
-    th_ycbcr_buffer ycbcr;
-
-    ycbcr[0].width = w;
-    ycbcr[0].height = h;
-    ycbcr[0].stride = w;
-    ycbcr[1].width = w;
-    ycbcr[1].stride = ycbcr[1].width;
-    ycbcr[1].height = h;
-    ycbcr[2].width = ycbcr[1].width;
-    ycbcr[2].stride = ycbcr[1].stride;
-    ycbcr[2].height = ycbcr[1].height;
-
-    ycbcr[0].data = (unsigned char*)malloc(ycbcr[0].stride * ycbcr[0].height);
-    ycbcr[1].data = (unsigned char*)malloc(ycbcr[1].stride * ycbcr[1].height);
-    ycbcr[2].data = (unsigned char*)malloc(ycbcr[2].stride * ycbcr[2].height);
-
-    ogg_uint32_t keyframe_frequency = 64;
-
-    th_info_init(&ti);
-    ti.frame_width = ((w + 15) >> 4) << 4;
-    ti.frame_height = ((h + 15) >> 4) << 4;
-    ti.pic_width = w;
-    ti.pic_height = h;
-    ti.pic_x = 0;
-    ti.pic_y = 0;
-    ti.fps_numerator = 24;
-    ti.fps_denominator = 1;
-    ti.aspect_numerator = 0;
-    ti.aspect_denominator = 0;
-    ti.colorspace = TH_CS_UNSPECIFIED;
-    ti.pixel_fmt = TH_PF_444;
-    ti.target_bitrate = -1;
-    ti.quality = 48; /* 63 is maximum */
-    ti.keyframe_granule_shift = ilog(keyframe_frequency - 1);
-
-    td = th_encode_alloc(&ti);
-    th_info_clear(&ti);
-
-    /* setting just the granule shift only allows power-of-two keyframe
-   spacing.  Set the actual requested spacing. */
-    ret = th_encode_ctl(td, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
-        &keyframe_frequency, sizeof(keyframe_frequency - 1));
-    if (ret < 0) {
-        fprintf(stderr, "Could not set keyframe interval to %d.\n",
-            (int)keyframe_frequency);
-    }
-    /* Get maximum encoding speed value (trade quality for speed) */
-    int splevel;
-    ret = th_encode_ctl(td, TH_ENCCTL_GET_SPLEVEL_MAX, &splevel, sizeof(int));
-    if (ret < 0)
-        fprintf(stderr, "Could not get SPLEVEL_MAX");
-    ret = th_encode_ctl(td, TH_ENCCTL_SET_SPLEVEL, &splevel, sizeof(int));
-    if (ret < 0)
-        fprintf(stderr, "Could not set SPLEVEL");
-
-    /* write the bitstream header packets with proper page interleave */
-    th_comment_init(&tc);
-    /* first packet will get its own page automatically */
-    if (th_encode_flushheader(td, &tc, &op) <= 0) {
-        fprintf(stderr, "Internal Theora library error.\n");
-        exit(1);
-    }
-    th_comment_clear(&tc);
-    ogg_stream_packetin(&ogg_os, &op);
-    if (ogg_stream_pageout(&ogg_os, &og) != 1) {
-        fprintf(stderr, "Internal Ogg library error.\n");
-        exit(1);
-    }
-    if (ogg_fp) {
-        fwrite(og.header, 1, og.header_len, ogg_fp);
-        fwrite(og.body, 1, og.body_len, ogg_fp);
-    }
-    /* create the remaining theora headers */
-    for (;;) {
-        ret = th_encode_flushheader(td, &tc, &op);
-        if (ret < 0) {
-            fprintf(stderr, "Internal Theora library error.\n");
-            exit(1);
-        } else if (!ret)
-            break;
-        ogg_stream_packetin(&ogg_os, &op);
-    }
-    /* Flush the rest of our headers. This ensures
-   the actual data in each stream will start
-   on a new page, as per spec. */
-    for (;;) {
-        int result = ogg_stream_flush(&ogg_os, &og);
-        if (result < 0) {
-            /* can't get here */
-            fprintf(stderr, "Internal Ogg library error.\n");
-            exit(1);
-        }
-        if (result == 0)
-            break;
-        if (ogg_fp) {
-            fwrite(og.header, 1, og.header_len, ogg_fp);
-            fwrite(og.body, 1, og.body_len, ogg_fp);
-        }
-    }
+    LiveLogWriter live_log(live_log_rate);
 
     char line[PATH_MAX + 10];
-    int fsls = 0; // frames since last sync
 
     Mat last_frame_image;
     vector<uchar> buf;
     bool last_frame_converted = false;
+    bool holds_ring_slot = false;
     int repeat = -1;
 
     while (fgets(line, PATH_MAX + 8, stdin)) {
         line[strlen(line) - 1] = 0;
 
         if (repeat >= (static_cast<int>(keyframe_frequency) - 1) || line[0] != 'R') {
-            if (output_video && repeat >= 0) {
-                ret = th_encode_ctl(td, TH_ENCCTL_SET_DUP_COUNT, &repeat, sizeof(repeat));
-                if (ret < 0)
-                    fprintf(stderr, "Could not set repeat count to %d.\n", repeat);
+            if (repeat >= 0) {
+                write_frame(repeat, false);
                 repeat = -1;
-
-                if (theora_write_frame(ycbcr, 0)) {
-                    fprintf(stderr, "Encoding error.\n");
-                    exit(1);
-                }
-
-                if (++fsls > 10) {
-                    fflush(ogg_fp);
-                    fsls = 0;
-                }
             }
         }
 
+        // give the slot of the previous frame back to the backend as soon as it is replaced
+        if (holds_ring_slot && (line[0] == 'E' || line[0] == 'F')) {
+            last_frame_image.release();
+            ring->released.fetch_add(1, std::memory_order_release);
+            holds_ring_slot = false;
+        }
+
         if (line[0] == 'E') {
-            int len = 0;
-            if (sscanf(line, "E %d", &len) != 1) {
+            int len = 0, arguments = 0;
+            if (sscanf(line, "E %d%n", &len, &arguments) != 1) {
                 fprintf(stderr, "Can't parse %s\n", line);
                 exit(1);
             }
             buf.resize(len);
-            size_t r = fread(&buf[0], len, 1, stdin);
+            size_t r;
+            {
+                const Stats::Timer timer(stats, Stats::io);
+                r = fread(&buf[0], len, 1, stdin);
+            }
             if (r != 1) {
                 fprintf(stderr, "Unexpected end of data %ld\n", r);
                 exit(1);
             }
             last_frame_converted = false;
             repeat = 0;
-
-            if (output_video || need_last_png()) {
-                last_frame_image = imdecode(buf, cv::IMREAD_COLOR, &last_frame_image);
+            ++stats.frames_in;
+
+            if (!sinks.empty() || live_log.enabled()) {
+                const Stats::Timer timer(stats, Stats::decode);
+                uint32_t width = 0, height = 0;
+                if (qoi::read_header(buf.data(), buf.size(), width, height)) {
+                    last_frame_image.create(static_cast<int>(height), static_cast<int>(width), CV_8UC3);
+                    qoi::decode_bgr(buf.data(), buf.size(), last_frame_image.data, last_frame_image.step);
+                } else {
+                    last_frame_image = imdecode(buf, cv::IMREAD_COLOR, &last_frame_image);
+                }
 
                 if (!last_frame_image.data) {
                     cout << "Could not open or find the image" << endl;
@@ -372,49 +1839,59 @@ int main(int argc, char* argv[])
                 }
             }
 
-            if (output_video)
-                rgb_to_yuv(&last_frame_image, ycbcr, xres, yres);
+            convert_frame(&last_frame_image, line + arguments);
+
+        } else if (line[0] == 'F') {
+            unsigned int slot = 0;
+            int width = 0, height = 0, arguments = 0;
+            size_t stride = 0;
+            if (!ring || sscanf(line, "F %u %d %d %zu%n", &slot, &width, &height, &stride, &arguments) != 4
+                || slot >= ring->slot_count || width <= 0 || height <= 0 || stride < static_cast<size_t>(width) * 3
+                || stride * static_cast<size_t>(height) > ring->slot_size) {
+                fprintf(stderr, "Can't parse %s\n", line);
+                exit(1);
+            }
+            last_frame_converted = false;
+            repeat = 0;
+            holds_ring_slot = true;
+            ++stats.frames_in;
+
+            // refer to the frame within the slot directly, it is valid until released
+            last_frame_image = Mat(height, width, CV_8UC3, frame_ring::slot_data(ring, slot), stride);
+
+            convert_frame(&last_frame_image, line + arguments);
 
         } else if (line[0] == 'R') {
             // Just repeat the last frame
             repeat++;
+            ++stats.repeats;
         } else {
             fprintf(stderr, "unknown command line: %s\n", line);
         }
 
-        if (!last_frame_converted && !last_frame_image.empty() && need_last_png()) {
-            struct timeval tv;
-            gettimeofday(&tv, 0);
-            char path[PATH_MAX];
-            sprintf(path, "qemuscreenshot/%ld.%ld.png", tv.tv_sec, tv.tv_usec);
-            imwrite(path, last_frame_image);
-            unlink("qemuscreenshot/last.png");
-            symlink(basename(path), "qemuscreenshot/last.png");
+        // let the backend know how far the encoder has got
+        if (ring && (line[0] == 'E' || line[0] == 'F' || line[0] == 'R'))
+            ring->consumed.fetch_add(1, std::memory_order_relaxed);
+
+        if (!last_frame_converted && !last_frame_image.empty() && live_log.enabled()) {
+            live_log.submit(last_frame_image);
             last_frame_converted = true;
         }
-    }
 
-    // send last frame
-    if (ogg_fp) {
-        th_encode_ctl(td, TH_ENCCTL_SET_DUP_COUNT, &repeat, sizeof(repeat));
-        theora_write_frame(ycbcr, 1);
+        if (stats.due())
+            stats.report(bytes_written(), live_log.pngs_written(), ring, false);
     }
-    th_encode_free(td);
-    free(ycbcr[0].data);
-    free(ycbcr[1].data);
-    free(ycbcr[2].data);
 
-    if (ogg_fp) {
-        if (ogg_stream_flush(&ogg_os, &og)) {
-            fwrite(og.header, og.header_len, 1, ogg_fp);
-            fwrite(og.body, og.body_len, 1, ogg_fp);
-        }
-        fflush(ogg_fp);
-        if (ogg_fp != stdout)
-            fclose(ogg_fp);
-    }
+    if (holds_ring_slot)
+        ring->released.fetch_add(1, std::memory_order_release);
 
-    ogg_stream_clear(&ogg_os);
+    // send last frame
+    if (repeat >= 0)
+        write_frame(repeat, true);
+    for (const auto& sink : sinks)
+        sink->finish();
+    if (stats.enabled())
+        stats.report(bytes_written(), live_log.pngs_written(), ring, true);
 
     return 0;
 }